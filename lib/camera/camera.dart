@@ -9,6 +9,32 @@ import 'package:flutter_vision3d/flutter_vision3d.dart';
 
 enum DepthType { ALL, AT, RANGE }
 
+/// How a camera hands frames to its pipelines when they are slower than the sensor
+enum FramePolicy {
+  /// Acquisition waits for processing. Every frame is processed.
+  BLOCK,
+
+  /// Keep up to `queueSize` frames and discard the oldest when full
+  DROP_OLDEST,
+
+  /// Only the newest frame is kept. Lowest latency.
+  LATEST_WINS,
+}
+
+class FvFrameStats {
+  late int captured;
+  late int delivered;
+  late int dropped;
+  late int stale;
+
+  FvFrameStats.fromJson(Map<dynamic, dynamic> json) {
+    captured = (json['captured'] ?? 0) as int;
+    delivered = (json['delivered'] ?? 0) as int;
+    dropped = (json['dropped'] ?? 0) as int;
+    stale = (json['stale'] ?? 0) as int;
+  }
+}
+
 class FvCamera {
   late final CameraType cameraType;
 
@@ -123,6 +149,22 @@ class FvCamera {
     return await FlutterVision3d.channel.invokeMethod('fvPauseStream', {'pause': pause, 'serial': serial});
   }
 
+  /// Frames older than [staleMs] when processing starts are counted as stale.
+  Future<bool> setFramePolicy(FramePolicy policy, {int? queueSize, int? staleMs}) async {
+    return await FlutterVision3d.channel.invokeMethod('fvSetFramePolicy', {'serial': serial, 'policy': policy.index, 'queueSize': queueSize ?? 1, 'staleMs': staleMs ?? 100});
+  }
+
+  /// Publish the [index] stream (`StreamIndex`) at most [width] x [height] and [maxFps] frames per second, e.g. the
+  /// widget size and the display refresh rate. Processing still runs on full frames. 0: frame size, every frame.
+  Future<bool> setDisplaySize(int index, int width, int height, {double? maxFps}) async {
+    return await FlutterVision3d.channel.invokeMethod('fvSetDisplaySize', {'serial': serial, 'index': index, 'width': width, 'height': height, 'maxFps': maxFps ?? 0.0});
+  }
+
+  Future<FvFrameStats> frameStats({bool reset = false}) async {
+    Map<dynamic, dynamic> map = await FlutterVision3d.channel.invokeMethod('fvGetFrameStats', {'serial': serial, 'reset': reset});
+    return FvFrameStats.fromJson(map);
+  }
+
   Future<List<String>> getVideoModes(int index) async {
     List<Object?> modes = await FlutterVision3d.channel.invokeMethod('ni2GetAvailableVideoModes', {'index': index, 'serial': serial});
     return modes.map((e) => e.toString()).toList();
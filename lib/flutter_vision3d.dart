@@ -13,6 +13,64 @@ enum CameraType { OPENNI, REALSENSE, DUMMY, UVC, ROS }
 
 enum BarcodeDecoder { OPENCV, ZXING }
 
+/// What a change gate compares between frames
+enum ChangeGateMode {
+  /// Grayscale intensity, [threshold] in intensity levels
+  FRAME_DIFFERENCE,
+
+  /// 16-bit depth, [threshold] in millimeters. Holes are ignored.
+  DEPTH_OCCUPANCY,
+}
+
+/// Image registers of a camera, operands of `regCopy` and `regOp`
+class FvRegister {
+  /// The image flowing through the pipeline
+  static const CUR = 0;
+
+  /// General registers r1..r8
+  static int r(int n) => n;
+
+  /// Latest input frame of a stream of the same camera, read-only
+  static const RGB = 9;
+  static const DEPTH = 10;
+  static const IR = 11;
+}
+
+/// Operation of a `regOp` stage
+enum RegisterOp {
+  COPY,
+  ADD,
+  SUBTRACT,
+  ABS_DIFF,
+  AND,
+  OR,
+  XOR,
+  MIN,
+  MAX,
+
+  /// a where b (single channel) is nonzero, 0 elsewhere
+  MASK,
+
+  /// a * alpha + b * (1 - alpha)
+  BLEND,
+}
+
+/// Pixel layout of the image a `show` stage gets. Converted to the RGBA of the texture while it is written.
+enum ShowFormat {
+  /// RGBA, RGB, GRAY8 or GRAY16 by the image type
+  AUTO,
+  RGBA,
+  BGR,
+  RGB,
+  GRAY8,
+
+  /// 16-bit, high byte shown
+  GRAY16,
+
+  /// 16-bit depth in millimeters, colorized by a color map
+  DEPTH_Z16,
+}
+
 class StreamIndex {
   static const RGB = 1;
   static const DEPTH = 2;
@@ -130,6 +188,19 @@ class FlutterVision3d {
     return await channel.invokeMethod('tfliteCreateModel', {'modelPath': modelPath});
   }
 
+  /// Load a native stage library (see `linux/include/flutter_vision3d/fv_stage_plugin.h`). Returns the names of the
+  /// stages it registered, usable with [FvPipeline.pluginStage].
+  static Future<List<String>> loadStagePlugin(String path) async {
+    List<Object?> names = await channel.invokeMethod('pipelinePluginLoad', {'path': path});
+    return names.map((e) => e.toString()).toList();
+  }
+
+  /// Number of threads processing the frames of every streaming camera. Each camera's frames are processed in order
+  /// by one thread at a time. Returns the number of threads in use (1 to 64).
+  static Future<int> setProcessingThreads(int threads) async {
+    return await channel.invokeMethod('fvSetProcessingThreads', {'threads': threads});
+  }
+
   static Future<void> cameraOpen(int index) async {
     return await channel.invokeMethod('cameraOpen', {'index': index});
   }
@@ -179,8 +250,120 @@ const _FUNC_CUSTOM_DEPTH_ZERO_FILTER = 17;
 
 const _FUNC_CV_COPYTO = 18;
 const _FUNC_CV_LINE = 19;
+const _FUNC_SEGMENT = 20;
+const _FUNC_BRANCH = 21;
+const _FUNC_JOIN = 22;
+const _FUNC_TF_BATCH_INFERENCE = 23;
+const _FUNC_PLUGIN_STAGE = 24;
+const _FUNC_CHANGE_GATE = 25;
+const _FUNC_DEPTH_CLIP = 26;
+const _FUNC_DEPTH_COLORIZE = 27;
+const _FUNC_DEPTH_MASK = 28;
+const _FUNC_REG_COPY = 29;
+const _FUNC_REG_OP = 30;
+const _FUNC_STATIC_PIPELINE = 31;
+
+/// Function indices for [FvPipelineRecipe.add], as in the native `pipelineFuncs` table
+class PipelineFunc {
+  static const TEST = _FUNC_TEST;
+  static const CVTCOLOR = _FUNC_CVTCOLOR;
+  static const IMWRITE = _FUNC_IMWRITE;
+  static const SHOW = _FUNC_SHOW;
+  static const CONVERTO = _FUNC_CONVERTO;
+  static const APPLY_COLOR_MAP = _FUNC_APPLY_COLOR_MAP;
+  static const RESIZE = _FUNC_RESIZE;
+  static const CROP = _FUNC_CROP;
+  static const IMREAD = _FUNC_IMREAD;
+  static const CV_RECTANGLE = _FUNC_CV_RECTANGLE;
+  static const CV_ROTATE = _FUNC_CV_ROTATE;
+  static const SET_INPUT_TENSOR = _FUNC_SET_INPUT_TENSOR;
+  static const INFERENCE = _FUNC_INFERENCE;
+  static const CUSTOM_HANDLER = _FUNC_CUSTOM_HANDLER;
+  static const CV_NORMALIZE = _FUNC_CV_NORMALIZE;
+  static const CV_THRESHOLD = _FUNC_CV_THRESHOLD;
+  static const CV_RELU = _FUNC_CV_RELU;
+  static const CUSTOM_DEPTH_ZERO_FILTER = _FUNC_CUSTOM_DEPTH_ZERO_FILTER;
+  static const CV_COPYTO = _FUNC_CV_COPYTO;
+  static const CV_LINE = _FUNC_CV_LINE;
+  static const SEGMENT = _FUNC_SEGMENT;
+  static const BRANCH = _FUNC_BRANCH;
+  static const JOIN = _FUNC_JOIN;
+  static const TF_BATCH_INFERENCE = _FUNC_TF_BATCH_INFERENCE;
+  static const PLUGIN_STAGE = _FUNC_PLUGIN_STAGE;
+  static const CHANGE_GATE = _FUNC_CHANGE_GATE;
+  static const DEPTH_CLIP = _FUNC_DEPTH_CLIP;
+  static const DEPTH_COLORIZE = _FUNC_DEPTH_COLORIZE;
+  static const DEPTH_MASK = _FUNC_DEPTH_MASK;
+  static const REG_COPY = _FUNC_REG_COPY;
+  static const REG_OP = _FUNC_REG_OP;
+  static const STATIC_PIPELINE = _FUNC_STATIC_PIPELINE;
+}
+
+/// Binary pipeline description, installed with one [FvPipeline.load] call.
+///
+/// `params` use the same byte layout as `pipelineAdd` (integers big endian, floats in host order).
+class FvPipelineRecipe {
+  final BytesBuilder _stages = BytesBuilder();
+  int _count = 0;
+
+  /// [streams] is a mask of [StreamIndex]. 0 adds the stage to the pipeline `load` is called on.
+  /// A [gated] stage is skipped on frames a change gate found unchanged.
+  void add(int funcIndex, List<int> params, {int streams = 0, int interval = 0, bool runOnce = false, bool gated = false}) {
+    ByteData header = ByteData(9);
+    header.setUint8(0, streams);
+    header.setUint8(1, funcIndex);
+    header.setUint8(2, (runOnce ? 1 : 0) | (gated ? 2 : 0));
+    header.setUint32(3, interval);
+    header.setUint16(7, params.length);
+    _stages.add(header.buffer.asUint8List());
+    _stages.add(params);
+    _count++;
+  }
+
+  static Uint8List float32(double value) {
+    ByteData data = ByteData(4)..setFloat32(0, value, Endian.host);
+    return data.buffer.asUint8List();
+  }
+
+  Uint8List encode() {
+    ByteData header = ByteData(6);
+    header.setUint8(0, 'F'.codeUnitAt(0));
+    header.setUint8(1, 'V'.codeUnitAt(0));
+    header.setUint8(2, 'P'.codeUnitAt(0));
+    header.setUint8(3, 1);
+    header.setUint16(4, _count);
+    return Uint8List.fromList([...header.buffer.asUint8List(), ..._stages.toBytes()]);
+  }
+}
+
+class FvStageStats {
+  late String name;
+  late int calls;
+  late int skips;
+  late int errors;
+  late int bytesIn;
+  late int bytesOut;
+  late double meanUs;
+  late double maxUs;
+  late double p50Us;
+  late double p95Us;
+  late double p99Us;
+
+  FvStageStats.fromJson(Map<dynamic, dynamic> json) {
+    name = json['name'].toString();
+    calls = json['calls'] as int;
+    skips = json['skips'] as int;
+    errors = json['errors'] as int;
+    bytesIn = json['bytesIn'] as int;
+    bytesOut = json['bytesOut'] as int;
+    meanUs = (json['meanUs'] as num).toDouble();
+    maxUs = (json['maxUs'] as num).toDouble();
+    p50Us = (json['p50Us'] as num).toDouble();
+    p95Us = (json['p95Us'] as num).toDouble();
+    p99Us = (json['p99Us'] as num).toDouble();
+  }
+}
 
-// TODO: check method can be added to that pipeline
 class FvPipeline {
   static const RGB_FRAME = 1;
   static const DEPTH_FRAME = 2;
@@ -203,6 +386,28 @@ class FvPipeline {
 
   FvPipeline(this.serial, this.index);
 
+  /// Per-stage latency/throughput counters. The last entry (`name == 'frame'`) covers the whole pipeline.
+  Future<List<FvStageStats>> stats({bool reset = false}) async {
+    List<Object?> list = await FlutterVision3d.channel.invokeMethod('pipelineStats', {'index': index, 'serial': serial, 'reset': reset});
+    return list.map((e) => FvStageStats.fromJson(e as Map<dynamic, dynamic>)).toList();
+  }
+
+  /// Shape of the image after every stage, e.g. `resize 320x240 8UC3`, for input frames of [width] x [height] and
+  /// OpenCV [type] (default: the current frames). Throws a `PIPELINE_PLAN` [PlatformException] naming the first stage
+  /// that cannot take the image it would get.
+  Future<List<String>> plan({int? width, int? height, int? type}) async {
+    List<Object?> list = await FlutterVision3d.channel
+        .invokeMethod('pipelinePlan', {'index': index, 'serial': serial, 'width': width, 'height': height, 'type': type});
+    return list.cast<String>();
+  }
+
+  /// Keep up to [bytes] of stage outputs from [run] (0 disables). [run] from 0 then records the input and the output
+  /// of every stage, and [run] from `k` restarts from the output of stage `k - 1` instead of rerunning the stages
+  /// before it, as long as those stages are unchanged.
+  Future<int> setCheckpointBudget(int bytes) async {
+    return await FlutterVision3d.channel.invokeMethod('pipelineSetCheckpointBudget', {'index': index, 'serial': serial, 'bytes': bytes});
+  }
+
   Future<int> run({int? from, int? to}) async {
     return await FlutterVision3d.channel.invokeMethod('pipelineRun', {'index': index, 'serial': serial, 'from': from ?? 0, 'to': to ?? -1});
   }
@@ -267,12 +472,15 @@ class FvPipeline {
     });
   }
 
-  Future<void> show({int? at, int? interval, bool? append, bool? runOnce}) async {
+  /// Show the image on the texture. [format] tells how to read it; `DEPTH_Z16` maps [minDepth] ~ [maxDepth] mm to
+  /// [colorMap] (an `OpenCV.COLORMAP_*`, 255 for grayscale) and shows holes black.
+  Future<void> show({ShowFormat format = ShowFormat.AUTO, int colorMap = 2, int minDepth = 0, int maxDepth = 4000, int? at, int? interval, bool? append, bool? runOnce}) async {
+    Uint8List params = Uint8List.fromList([format.index, colorMap, minDepth >> 8, minDepth & 0xff, maxDepth >> 8, maxDepth & 0xff]);
     await FlutterVision3d.channel.invokeMethod('pipelineAdd', {
       'index': index,
       'funcIndex': _FUNC_SHOW,
-      'params': null,
-      'len': 0,
+      'params': params,
+      'len': params.length,
       'at': at ?? -1,
       'interval': interval ?? 0,
       'serial': serial,
@@ -431,6 +639,159 @@ class FvPipeline {
     });
   }
 
+  /// Run the current image as one item of a batched inference, shared with every pipeline (camera) using the same
+  /// model. Frames arriving within [deadlineMs] of the first one are run in one invoke of up to [maxBatch] items. The
+  /// image must match one batch item of input tensor [tensorIndex] (size and data type).
+  ///
+  /// Results arrive as `onBatchInference` with `{'textureId': int, 'model': int, 'outputs': List<Float32List>}`.
+  Future<void> batchInference(int modelIndex, {int tensorIndex = 0, int maxBatch = 4, int deadlineMs = 5, int? at, int? interval, bool? append, bool? runOnce}) async {
+    await FlutterVision3d.channel.invokeMethod('pipelineAdd', {
+      'index': index,
+      'funcIndex': _FUNC_TF_BATCH_INFERENCE,
+      'params': Uint8List.fromList([modelIndex, tensorIndex, maxBatch, deadlineMs]),
+      'len': 4,
+      'at': at ?? -1,
+      'interval': interval ?? 0,
+      'serial': serial,
+      'append': append ?? false,
+      'runOnce': runOnce ?? false,
+    });
+  }
+
+  /// Stage [name] of a library loaded with [FlutterVision3d.loadStagePlugin]. [params] are passed to the stage's
+  /// `init`. Results arrive as `onPluginResult` with `{'stage': String, 'textureId': int, 'result': Float32List}`.
+  Future<void> pluginStage(String name, {Uint8List? params, int? at, int? interval, bool? append, bool? runOnce}) async {
+    List<int> nameBytes = utf8.encode(name);
+    Uint8List raw = Uint8List.fromList([nameBytes.length, ...nameBytes, ...(params ?? [])]);
+    await FlutterVision3d.channel.invokeMethod('pipelineAdd', {
+      'index': index,
+      'funcIndex': _FUNC_PLUGIN_STAGE,
+      'params': raw,
+      'len': raw.length,
+      'at': at ?? -1,
+      'interval': interval ?? 0,
+      'serial': serial,
+      'append': append ?? false,
+      'runOnce': runOnce ?? false,
+    });
+  }
+
+  /// Run the C++ pipeline registered as [name] with `StaticPipelineRegistry` (see static_pipeline.h) as one stage
+  Future<void> staticPipeline(String name, {int? at, int? interval, bool? append, bool? runOnce}) async {
+    List<int> nameBytes = utf8.encode(name);
+    Uint8List raw = Uint8List.fromList([nameBytes.length, ...nameBytes]);
+    await FlutterVision3d.channel.invokeMethod('pipelineAdd', {
+      'index': index,
+      'funcIndex': _FUNC_STATIC_PIPELINE,
+      'params': raw,
+      'len': raw.length,
+      'at': at ?? -1,
+      'interval': interval ?? 0,
+      'serial': serial,
+      'append': append ?? false,
+      'runOnce': runOnce ?? false,
+    });
+  }
+
+  /// Compare each frame, downsampled by [scale], with the frame of the last change. The frame counts as changed when
+  /// more than [minChanged] (0.0 ~ 1.0) of the cells differ by more than [threshold]; the gate then stays open for
+  /// [hold] more frames. Stages after it marked with [setGated] only run on changed frames.
+  Future<void> changeGate(ChangeGateMode mode, double threshold, {double minChanged = 0.01, int scale = 8, int hold = 0, int? at, bool? append}) async {
+    Uint8List params = Uint8List.fromList([mode.index, ...FvPipelineRecipe.float32(threshold), ...FvPipelineRecipe.float32(minChanged), scale, hold]);
+    await FlutterVision3d.channel.invokeMethod('pipelineAdd', {
+      'index': index,
+      'funcIndex': _FUNC_CHANGE_GATE,
+      'params': params,
+      'len': params.length,
+      'at': at ?? -1,
+      'interval': 0,
+      'serial': serial,
+      'append': append ?? false,
+      'runOnce': false,
+    });
+  }
+
+  /// Set 16-bit depth outside [minDepth] ~ [maxDepth] mm to 0 (no depth)
+  Future<void> depthClip(int minDepth, int maxDepth, {int? at, int? interval, bool? append, bool? runOnce}) async {
+    Uint8List params = Uint8List.fromList([minDepth >> 8, minDepth & 0xff, maxDepth >> 8, maxDepth & 0xff]);
+    await FlutterVision3d.channel.invokeMethod('pipelineAdd', {
+      'index': index,
+      'funcIndex': _FUNC_DEPTH_CLIP,
+      'params': params,
+      'len': params.length,
+      'at': at ?? -1,
+      'interval': interval ?? 0,
+      'serial': serial,
+      'append': append ?? false,
+      'runOnce': runOnce ?? false,
+    });
+  }
+
+  /// 16-bit depth to RGBA: [minDepth] ~ [maxDepth] mm spans [colorMap] (an `OpenCV.COLORMAP_*`, 255 for grayscale),
+  /// holes are black
+  Future<void> depthColorize(int colorMap, int minDepth, int maxDepth, {int? at, int? interval, bool? append, bool? runOnce}) async {
+    Uint8List params = Uint8List.fromList([colorMap, minDepth >> 8, minDepth & 0xff, maxDepth >> 8, maxDepth & 0xff]);
+    await FlutterVision3d.channel.invokeMethod('pipelineAdd', {
+      'index': index,
+      'funcIndex': _FUNC_DEPTH_COLORIZE,
+      'params': params,
+      'len': params.length,
+      'at': at ?? -1,
+      'interval': interval ?? 0,
+      'serial': serial,
+      'append': append ?? false,
+      'runOnce': runOnce ?? false,
+    });
+  }
+
+  /// 16-bit depth to an 8-bit mask (255) of the pixels within [minDepth] ~ [maxDepth] mm, or with [invert] of the
+  /// pixels nearer or farther. Holes are never masked.
+  Future<void> depthMask(int minDepth, int maxDepth, {bool invert = false, int? at, int? interval, bool? append, bool? runOnce}) async {
+    Uint8List params = Uint8List.fromList([minDepth >> 8, minDepth & 0xff, maxDepth >> 8, maxDepth & 0xff, invert ? 1 : 0]);
+    await FlutterVision3d.channel.invokeMethod('pipelineAdd', {
+      'index': index,
+      'funcIndex': _FUNC_DEPTH_MASK,
+      'params': params,
+      'len': params.length,
+      'at': at ?? -1,
+      'interval': interval ?? 0,
+      'serial': serial,
+      'append': append ?? false,
+      'runOnce': runOnce ?? false,
+    });
+  }
+
+  Future<void> regCopy(int src, int dst, {int? at, int? interval, bool? append, bool? runOnce}) async {
+    await FlutterVision3d.channel.invokeMethod('pipelineAdd', {
+      'index': index,
+      'funcIndex': _FUNC_REG_COPY,
+      'params': Uint8List.fromList([src, dst]),
+      'len': 2,
+      'at': at ?? -1,
+      'interval': interval ?? 0,
+      'serial': serial,
+      'append': append ?? false,
+      'runOnce': runOnce ?? false,
+    });
+  }
+
+  Future<void> regOp(RegisterOp op, int a, int b, int dst, {double alpha = 0.5, int? at, int? interval, bool? append, bool? runOnce}) async {
+    List<Object?> alphaList = await FlutterVision3d.channel.invokeMethod("_float2uint8", {'value': alpha});
+    Uint8List alphaBytes = Uint8List.fromList(alphaList.map((e) => e as int).toList());
+
+    await FlutterVision3d.channel.invokeMethod('pipelineAdd', {
+      'index': index,
+      'funcIndex': _FUNC_REG_OP,
+      'params': Uint8List.fromList([op.index, a, b, dst, ...alphaBytes]),
+      'len': 8,
+      'at': at ?? -1,
+      'interval': interval ?? 0,
+      'serial': serial,
+      'append': append ?? false,
+      'runOnce': runOnce ?? false,
+    });
+  }
+
   Future<void> customHandler(int size, {int? at, int? interval, bool? append, bool? runOnce}) async {
     await FlutterVision3d.channel.invokeMethod('pipelineAdd', {
       'index': index,
@@ -537,6 +898,95 @@ class FvPipeline {
     });
   }
 
+  /// Stages added after this one run on their own thread, overlapping with the stages before it on the next frame.
+  /// [queueSize] frames (1 ~ 16) can wait in front of the segment.
+  Future<void> segment({int? queueSize, int? at, bool? append}) async {
+    await FlutterVision3d.channel.invokeMethod('pipelineAdd', {
+      'index': index,
+      'funcIndex': _FUNC_SEGMENT,
+      'params': Uint8List.fromList([queueSize ?? 2]),
+      'len': 1,
+      'at': at ?? -1,
+      'interval': 0,
+      'serial': serial,
+      'append': append ?? false,
+      'runOnce': false,
+    });
+  }
+
+  /// Starts a branch. Consecutive branches up to [join] get the same input frame and run in parallel, e.g.
+  /// `branch(), applyColorMap(..), show(), branch(), resize(..), setInputTensorData(..), inference(..), join()`.
+  Future<void> branch({int? at, bool? append}) async {
+    await _addMarker(_FUNC_BRANCH, at, append);
+  }
+
+  /// Ends the branches. Following stages continue with the frame from before the first branch.
+  Future<void> join({int? at, bool? append}) async {
+    await _addMarker(_FUNC_JOIN, at, append);
+  }
+
+  Future<void> _addMarker(int funcIndex, int? at, bool? append) async {
+    await FlutterVision3d.channel.invokeMethod('pipelineAdd', {
+      'index': index,
+      'funcIndex': funcIndex,
+      'params': Uint8List(0),
+      'len': 0,
+      'at': at ?? -1,
+      'interval': 0,
+      'serial': serial,
+      'append': append ?? false,
+      'runOnce': false,
+    });
+  }
+
+  /// Replace the stages of every stream the recipe has stages for, in one step. The recipe is validated first; on an
+  /// invalid stage nothing is installed and a [PlatformException] with code `PIPELINE_LOAD` is thrown.
+  Future<void> load(FvPipelineRecipe recipe) async {
+    await FlutterVision3d.channel.invokeMethod('pipelineLoad', {'index': index, 'serial': serial, 'recipe': recipe.encode()});
+  }
+
+  /// Text form of [load], one stage per line:
+  /// ```
+  /// # [streams] name [parameters...] [interval=ms] [once]
+  /// depth convertTo 0 0.0625 0
+  /// depth applyColorMap 2
+  /// rgb,depth show
+  /// ```
+  Future<void> loadText(String recipe) async {
+    await FlutterVision3d.channel.invokeMethod('pipelineLoad', {'index': index, 'serial': serial, 'text': recipe});
+  }
+
+  /// Skip the stage at [at] on frames a [changeGate] found unchanged. `tfInference`, `customHandler`,
+  /// `tfBatchInference` and plugin stages send their last results again instead.
+  Future<int> setGated(int at, bool gated) async {
+    return await FlutterVision3d.channel.invokeMethod('pipelineSetGated', {'index': index, 'serial': serial, 'at': at, 'gated': gated});
+  }
+
+  /// Set the parameter [field] of the stage at [at], named as in the stage's schema (e.g. `threshold` of
+  /// [threshold], `x2` of [cvRectangle]). [value] is a number or recipe text. Takes effect from the next frame without
+  /// rebuilding the pipeline, so it can follow a slider. Returns -1 on error, see [error].
+  Future<int> setParam(int at, String field, Object value) async {
+    return await FlutterVision3d.channel.invokeMethod('pipelineSetParam', {'index': index, 'serial': serial, 'at': at, 'field': field, 'value': value});
+  }
+
+  /// Run the stage at [at] every [period] ms, on the monotonic clock at `k * period + phase` ms. Pipelines with the
+  /// same period and different [phase] never run the stage in the same millisecond.
+  Future<int> scheduleEveryMs(int at, int period, {int phase = 0}) async {
+    return await FlutterVision3d.channel.invokeMethod('pipelineSetSchedule', {'index': index, 'serial': serial, 'at': at, 'cadence': 1, 'period': period, 'phase': phase});
+  }
+
+  /// Run the stage at [at] on every [period]th frame of this pipeline, offset by [phase] frames: on the frames where
+  /// `frame % period == phase`. Frames are counted from 0 per pipeline, starting with its first frame, so pipelines
+  /// of cameras that started at different times are not in step.
+  Future<int> scheduleEveryFrames(int at, int period, {int phase = 0}) async {
+    return await FlutterVision3d.channel.invokeMethod('pipelineSetSchedule', {'index': index, 'serial': serial, 'at': at, 'cadence': 2, 'period': period, 'phase': phase});
+  }
+
+  /// Run the stage at [at] on every frame
+  Future<int> scheduleAlways(int at) async {
+    return await FlutterVision3d.channel.invokeMethod('pipelineSetSchedule', {'index': index, 'serial': serial, 'at': at, 'cadence': 0, 'period': 0, 'phase': 0});
+  }
+
   Future<void> removeAt(int removeAt) async {
     await FlutterVision3d.channel.invokeMethod('pipelineRemoveAt', {
       'index': index,
@@ -0,0 +1,425 @@
+/*
+ * Runs every entry of `pipelineFuncs` headless (FV_HEADLESS) on synthetic frames and prints the cost per call as
+ * JSON on stdout:
+ *
+ *   [{"stage": "resize", "index": 6, "frame": "gray8", "width": 640, "height": 480, "status": "ok",
+ *     "iterations": 812, "nsPerCall": 246113.2, "nsPerPixel": 0.801, "allocsPerCall": 1.00}, ...]
+ *
+ * Options:
+ *   --filter <text>       only stages whose name contains <text>
+ *   --min-time-ms <ms>    measuring time per case (default 200)
+ *
+ * Allocations are counted by interposing malloc and friends, so they include OpenCV buffers and allocations on
+ * OpenCV's worker threads.
+ */
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <flutter_vision3d/pipeline/pipeline.h>
+#include <flutter_vision3d/pipeline/pipeline_recipe.h>
+
+static std::atomic<bool> countAllocations{false};
+static std::atomic<uint64_t> allocations{0};
+
+extern "C"
+{
+    void *__libc_malloc(size_t size);
+    void *__libc_calloc(size_t n, size_t size);
+    void *__libc_realloc(void *p, size_t size);
+    void *__libc_memalign(size_t alignment, size_t size);
+
+    static inline void countAllocation()
+    {
+        if (countAllocations.load(std::memory_order_relaxed))
+            allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void *malloc(size_t size)
+    {
+        countAllocation();
+        return __libc_malloc(size);
+    }
+
+    void *calloc(size_t n, size_t size)
+    {
+        countAllocation();
+        return __libc_calloc(n, size);
+    }
+
+    void *realloc(void *p, size_t size)
+    {
+        countAllocation();
+        return __libc_realloc(p, size);
+    }
+
+    void *memalign(size_t alignment, size_t size)
+    {
+        countAllocation();
+        return __libc_memalign(alignment, size);
+    }
+
+    void *aligned_alloc(size_t alignment, size_t size)
+    {
+        countAllocation();
+        return __libc_memalign(alignment, size);
+    }
+
+    int posix_memalign(void **p, size_t alignment, size_t size)
+    {
+        countAllocation();
+        *p = __libc_memalign(alignment, size);
+        return *p == nullptr ? ENOMEM : 0;
+    }
+}
+
+struct FrameKind
+{
+    const char *name;
+    int type;
+};
+
+static const FrameKind FRAME_KINDS[] = {
+    {"gray8", CV_8UC1},
+    {"depth16", CV_16UC1},
+    {"rgb", CV_8UC3},
+};
+
+static const cv::Size FRAME_SIZES[] = {{640, 480}, {1280, 720}, {1920, 1080}};
+
+/**
+ * @brief Parameters of one stage in recipe text form, per frame kind. nullptr: the stage does not take that frame.
+ * `skip` explains stages that cannot run headless. `quiet` stages print, their stdout goes to /dev/null.
+ */
+struct StageCase
+{
+    const char *name;
+    const char *params[3];
+    const char *skip;
+    bool quiet;
+};
+
+// %p is replaced by the address of the benchmark's destination Mat, %f by a temporary image file holding the frame
+static const StageCase STAGE_CASES[] = {
+    {"test", {"1", "1", "1"}, nullptr, true},
+    {"cvtColor", {"8", "8", "4"}},
+    {"imwrite", {"%f", "%f", "%f"}},
+    {"show", {"4", "6 2 0 4000", "2"}},
+    {"convertTo", {"0 1.5 10", "0 0.0625 0", "0 1.5 10"}},
+    {"applyColorMap", {"2", nullptr, "2"}},
+    {"resize", {"320 240 1", "320 240 1", "320 240 1"}},
+    {"crop", {"0 320 0 240", "0 320 0 240", "0 320 0 240"}},
+    {"imread", {"%f", "%f", "%f"}},
+    {"cvRectangle", {"10 10 200 200 255 0 0 255 2 8 0", "10 10 200 200 255 0 0 255 2 8 0", "10 10 200 200 255 0 0 255 2 8 0"}},
+    {"rotate", {"0", "0", "0"}},
+    {"tfSetTenorInput", {}, "needs a model"},
+    {"tfInference", {}, "needs a model"},
+    {"customHandler", {"3", "3", "3"}},
+    {"cvNormalized", {"0 255 32 0", "0 255 32 0", "0 255 32 0"}},
+    {"cvThreshold", {"128 255 0", "128 255 0", "128 255 0"}},
+    {"relu", {"64", nullptr, nullptr}},
+    {"zeroDepthFilter", {nullptr, "10 2", nullptr}},
+    {"PipelineCopyTo", {"%p", "%p", "%p"}},
+    {"cvLine", {"0 0 300 300 0 255 0 255 2 8", "0 0 300 300 0 255 0 255 2 8", "0 0 300 300 0 255 0 255 2 8"}},
+    {"segment", {"2", "2", "2"}},
+    {"branch", {"", "", ""}},
+    {"join", {"", "", ""}},
+    {"tfBatchInference", {}, "needs a model"},
+    {"pluginStage", {}, "needs a loaded plugin"},
+    {"changeGate", {"0 10 0.01 4", "1 50 0.01 4", "0 10 0.01 4"}},
+    {"depthClip", {nullptr, "500 3000", nullptr}},
+    {"depthColorize", {nullptr, "2 0 4000", nullptr}},
+    {"depthMask", {nullptr, "500 3000", nullptr}},
+    {"regCopy", {"cur r2", "cur r2", "cur r2"}},
+    {"regOp", {"3 cur r1 cur", "3 cur r1 cur", "3 cur r1 cur"}},
+    {"staticPipeline", {"benchmark", "benchmark", "benchmark"}},
+};
+
+static const StageCase *findCase(const char *name)
+{
+    for (const StageCase &c : STAGE_CASES)
+    {
+        if (strcmp(c.name, name) == 0)
+            return &c;
+    }
+
+    return nullptr;
+}
+
+/**
+ * @brief Sends stdout to /dev/null while alive, so a stage's prints stay out of the JSON
+ */
+class SilenceStdout
+{
+public:
+    explicit SilenceStdout(bool enable)
+    {
+        if (!enable)
+            return;
+
+        fflush(stdout);
+        saved = dup(STDOUT_FILENO);
+        int null = open("/dev/null", O_WRONLY);
+        if (saved < 0 || null < 0)
+        {
+            if (null >= 0)
+                close(null);
+
+            return;
+        }
+
+        dup2(null, STDOUT_FILENO);
+        close(null);
+    }
+
+    ~SilenceStdout()
+    {
+        if (saved < 0)
+            return;
+
+        fflush(stdout);
+        dup2(saved, STDOUT_FILENO);
+        close(saved);
+    }
+
+private:
+    int saved = -1;
+};
+
+static std::string jsonString(const std::string &s)
+{
+    std::string out = "\"";
+    for (char c : s)
+    {
+        if (c == '"' || c == '\\')
+            out += '\\';
+
+        if ((unsigned char)c < 0x20)
+            out += ' ';
+        else
+            out += c;
+    }
+
+    return out + "\"";
+}
+
+/**
+ * @brief Synthetic frame: a gradient with some structure, so thresholds and color maps do real work
+ */
+static cv::Mat makeFrame(const FrameKind &kind, cv::Size size)
+{
+    cv::Mat frame(size, kind.type);
+    int maxValue = CV_MAT_DEPTH(kind.type) == CV_16U ? 4000 : 255;
+    for (int y = 0; y < size.height; y++)
+    {
+        for (int x = 0; x < size.width; x++)
+        {
+            int v = ((x + y) * maxValue / (size.width + size.height) + (x % 7) * 3) % (maxValue + 1);
+            // Holes, as depth frames have them
+            if ((x / 16 + y / 16) % 11 == 0)
+                v = 0;
+
+            for (int c = 0; c < frame.channels(); c++)
+            {
+                if (CV_MAT_DEPTH(kind.type) == CV_16U)
+                    frame.ptr<uint16_t>(y)[x * frame.channels() + c] = v;
+                else
+                    frame.ptr<uint8_t>(y)[x * frame.channels() + c] = (v + c * 40) % 256;
+            }
+        }
+    }
+
+    return frame;
+}
+
+struct Result
+{
+    std::string status = "ok";
+    std::string reason = "";
+    uint64_t iterations = 0;
+    double nsPerCall = 0;
+    double allocsPerCall = 0;
+};
+
+static Result measure(const FuncDef &f, const cv::Mat &input, int64_t minTimeNs)
+{
+    Result r;
+    FlTextureRegistrar registrar;
+    FlMethodChannel channel;
+    std::vector<TFLiteModel *> models;
+    FvTexture fv{};
+    fv.models = &models;
+    // Register stages read r1, a copy of the frame
+    RegisterFile registers;
+    registers.store(1, input);
+    fv.registers = &registers;
+    fv.runtime = f.state->runtime.get();
+
+    // Stages that replace the image write into a buffer of their own, as they do in a planned pipeline
+    cv::Mat frame, output;
+    if (f.access == StageAccess::Replace)
+        fv.output = &output;
+
+    try
+    {
+        // Warm up caches and lazily initialized OpenCV state
+        for (int i = 0; i < 2; i++)
+        {
+            input.copyTo(frame);
+            fv.cvImage = frame;
+            f.func(&fv, f.params, registrar, &models, &channel);
+        }
+
+        int64_t total = 0;
+        uint64_t allocs = 0;
+        while ((total < minTimeNs || r.iterations < 3) && r.iterations < 10000)
+        {
+            input.copyTo(frame);
+            fv.cvImage = frame;
+
+            allocations.store(0, std::memory_order_relaxed);
+            countAllocations.store(true, std::memory_order_relaxed);
+            int64_t start = getMonotonicNs();
+            f.func(&fv, f.params, registrar, &models, &channel);
+            total += getMonotonicNs() - start;
+            countAllocations.store(false, std::memory_order_relaxed);
+            allocs += allocations.load(std::memory_order_relaxed);
+
+            r.iterations++;
+        }
+
+        r.nsPerCall = (double)total / r.iterations;
+        r.allocsPerCall = (double)allocs / r.iterations;
+    }
+    catch (std::exception &e)
+    {
+        countAllocations.store(false, std::memory_order_relaxed);
+        r.status = "error";
+        r.reason = e.what();
+    }
+
+    return r;
+}
+
+int main(int argc, char **argv)
+{
+    const char *filter = nullptr;
+    int64_t minTimeNs = 200 * 1000000LL;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+            filter = argv[++i];
+        else if (strcmp(argv[i], "--min-time-ms") == 0 && i + 1 < argc)
+            minTimeNs = atoll(argv[++i]) * 1000000LL;
+        else
+        {
+            fprintf(stderr, "usage: %s [--filter <text>] [--min-time-ms <ms>]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    // What `staticPipeline` runs: the convertTo and cvThreshold cases fused into one pass, then a float tensor
+    StaticPipelineRegistry::shared().add("benchmark", StaticPipeline::ConvertScale{1.5f, 10.0f},
+                                         StaticPipeline::Threshold<cv::THRESH_BINARY>{128, 255},
+                                         StaticPipeline::ToTensor<float>{1.0 / 255});
+
+    cv::Mat copyTarget;
+    char copyTargetAddress[32];
+    snprintf(copyTargetAddress, sizeof(copyTargetAddress), "%llu", (unsigned long long)(uintptr_t)&copyTarget);
+    // Read by `imread`, overwritten by `imwrite`
+    std::string imageFile = (std::filesystem::temp_directory_path() / ("fv_benchmark_" + std::to_string(getpid()) + ".png")).string();
+
+    bool first = true;
+    printf("[");
+    for (const FuncDef &def : pipelineFuncs)
+    {
+        if (filter != nullptr && strstr(def.name, filter) == nullptr)
+            continue;
+
+        const StageCase *c = findCase(def.name);
+        for (size_t k = 0; k < sizeof(FRAME_KINDS) / sizeof(FrameKind); k++)
+        {
+            const FrameKind &kind = FRAME_KINDS[k];
+            for (const cv::Size &size : FRAME_SIZES)
+            {
+                Result r;
+                FuncDef f;
+                std::string text;
+                std::vector<RecipeStage> stages;
+                std::string error;
+
+                if (c == nullptr)
+                {
+                    r.status = "skipped";
+                    r.reason = "no benchmark case";
+                }
+                else if (c->skip != nullptr)
+                {
+                    r.status = "skipped";
+                    r.reason = c->skip;
+                }
+                else if (c->params[k] == nullptr)
+                {
+                    r.status = "skipped";
+                    r.reason = "frame type not supported by the stage";
+                }
+                else
+                {
+                    std::string params = c->params[k];
+                    if (params == "%p")
+                        params = copyTargetAddress;
+                    else if (params == "%f")
+                        params = "\"" + imageFile + "\"";
+
+                    text = std::string(def.name) + " " + params;
+                    cv::Mat frame = makeFrame(kind, size);
+                    if (!PipelineRecipe::parseText(text, stages, error) ||
+                        !Pipeline::makeStage(stages[0].index, stages[0].params, 0, false, f, error))
+                    {
+                        r.status = "error";
+                        r.reason = error;
+                    }
+                    else if (strcmp(c->params[k], "%f") == 0 && !cv::imwrite(imageFile, frame))
+                    {
+                        r.status = "error";
+                        r.reason = "cannot write " + imageFile;
+                    }
+                    else
+                    {
+                        fprintf(stderr, "%s %s %dx%d\n", def.name, kind.name, size.width, size.height);
+                        SilenceStdout silence(c->quiet);
+                        r = measure(f, frame, minTimeNs);
+                    }
+                }
+
+                printf("%s\n  {\"stage\": %s, \"index\": %u, \"frame\": \"%s\", \"width\": %d, \"height\": %d, \"status\": \"%s\"",
+                       first ? "" : ",", jsonString(def.name).c_str(), def.index, kind.name, size.width, size.height, r.status.c_str());
+                if (r.status == "ok")
+                    printf(", \"iterations\": %llu, \"nsPerCall\": %.1f, \"nsPerPixel\": %.4f, \"allocsPerCall\": %.2f}",
+                           (unsigned long long)r.iterations, r.nsPerCall, r.nsPerCall / size.area(), r.allocsPerCall);
+                else
+                    printf(", \"reason\": %s}", jsonString(r.reason).c_str());
+
+                first = false;
+
+                // One entry per stage is enough when nothing runs
+                if (r.status == "skipped" && (c == nullptr || c->skip != nullptr))
+                    break;
+            }
+
+            if (c == nullptr || c->skip != nullptr)
+                break;
+        }
+    }
+
+    printf("\n]\n");
+    std::remove(imageFile.c_str());
+    return 0;
+}
@@ -303,6 +303,77 @@ static void flutter_vision3d_plugin_handle_method_call(
 
     response = FL_METHOD_RESPONSE(fl_method_success_response_new(fl_value_new_bool(ret)));
   }
+  else if (strcmp(method, "fvSetFramePolicy") == 0)
+  {
+    const char *serial = FL_ARG_STRING(args, "serial");
+    const int policy = FL_ARG_INT(args, "policy");
+    const int queueSize = FL_ARG_INT(args, "queueSize");
+    const int staleMs = FL_ARG_INT(args, "staleMs");
+
+    std::shared_ptr<FvCamera> cam = FvCamera::findCam(serial, &self->cams);
+    bool ret = false;
+    if (cam && policy >= FramePolicy::Block && policy <= FramePolicy::LatestWins)
+    {
+      cam->setFramePolicy(policy, queueSize, staleMs);
+      ret = true;
+    }
+
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(fl_value_new_bool(ret)));
+  }
+  else if (strcmp(method, "fvGetFrameStats") == 0)
+  {
+    const char *serial = FL_ARG_STRING(args, "serial");
+
+    bool reset = false;
+    FlValue *valueReset = fl_value_lookup_string(args, "reset");
+    if (valueReset != nullptr && fl_value_get_type(valueReset) != FL_VALUE_TYPE_NULL)
+      reset = fl_value_get_bool(valueReset);
+
+    auto m = fl_value_new_map();
+    std::shared_ptr<FvCamera> cam = FvCamera::findCam(serial, &self->cams);
+    if (cam)
+    {
+      FrameScheduling &s = cam->frameScheduling;
+      fl_value_set(m, fl_value_new_string("captured"), fl_value_new_int(s.captured));
+      fl_value_set(m, fl_value_new_string("delivered"), fl_value_new_int(s.delivered));
+      fl_value_set(m, fl_value_new_string("dropped"), fl_value_new_int(s.dropped));
+      fl_value_set(m, fl_value_new_string("stale"), fl_value_new_int(s.stale));
+      if (reset)
+        s.resetCounters();
+    }
+
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(m));
+  }
+  else if (strcmp(method, "fvSetDisplaySize") == 0)
+  {
+    const char *serial = FL_ARG_STRING(args, "serial");
+    const int index = FL_ARG_INT(args, "index");
+    const int width = FL_ARG_INT(args, "width");
+    const int height = FL_ARG_INT(args, "height");
+
+    double maxFps = 0;
+    FlValue *valueMaxFps = fl_value_lookup_string(args, "maxFps");
+    if (valueMaxFps != nullptr && fl_value_get_type(valueMaxFps) == FL_VALUE_TYPE_FLOAT)
+      maxFps = fl_value_get_float(valueMaxFps);
+
+    std::shared_ptr<FvCamera> cam = FvCamera::findCam(serial, &self->cams);
+    bool ret = false;
+    FvTexture *texture = cam ? cam->getTexture(index) : nullptr;
+    if (texture != nullptr)
+    {
+      texture->setDisplaySize(width, height, maxFps);
+      ret = true;
+    }
+
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(fl_value_new_bool(ret)));
+  }
+  else if (strcmp(method, "fvSetProcessingThreads") == 0)
+  {
+    const int threads = FL_ARG_INT(args, "threads");
+
+    unsigned int n = CameraRuntime::shared().setProcessingThreads(threads > 0 ? threads : 1);
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(fl_value_new_int(n)));
+  }
   else if (strcmp(method, "fvGetSerialNumber") == 0)
   {
     const char *serial = FL_ARG_STRING(args, "serial");
@@ -521,24 +592,25 @@ static void flutter_vision3d_plugin_handle_method_call(
     if (valueRunOnce != nullptr && fl_value_get_type(valueRunOnce) != FL_VALUE_TYPE_NULL)
       runOnce = fl_value_get_bool(valueRunOnce);
 
+    int ret = -1;
     std::shared_ptr<FvCamera> cam = FvCamera::findCam(serial, &self->cams);
     if (cam != nullptr)
     {
       if (index == VideoIndex::RGB)
       {
-        cam->rgbTexture->pipeline->add(funcIndex, params, len, insertAt, interval, append, runOnce);
+        ret = cam->rgbTexture->pipeline->add(funcIndex, params, len, insertAt, interval, append, runOnce);
       }
       else if (index == VideoIndex::Depth)
       {
-        cam->depthTexture->pipeline->add(funcIndex, params, len, insertAt, interval, append, runOnce);
+        ret = cam->depthTexture->pipeline->add(funcIndex, params, len, insertAt, interval, append, runOnce);
       }
       else if (index == VideoIndex::IR)
       {
-        cam->irTexture->pipeline->add(funcIndex, params, len, insertAt, interval, append, runOnce);
+        ret = cam->irTexture->pipeline->add(funcIndex, params, len, insertAt, interval, append, runOnce);
       }
     }
 
-    response = FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(fl_value_new_int(ret)));
   }
   else if (strcmp(method, "pipelineRemoveAt") == 0)
   {
@@ -566,6 +638,140 @@ static void flutter_vision3d_plugin_handle_method_call(
 
     response = FL_METHOD_RESPONSE(fl_method_success_response_new(fl_value_new_int(ret)));
   }
+  else if (strcmp(method, "pipelineSetSchedule") == 0)
+  {
+    const char *serial = FL_ARG_STRING(args, "serial");
+    int index = FL_ARG_INT(args, "index");
+    int at = FL_ARG_INT(args, "at");
+    int cadence = FL_ARG_INT(args, "cadence");
+    int period = FL_ARG_INT(args, "period");
+    int phase = FL_ARG_INT(args, "phase");
+
+    StageSchedule schedule;
+    if (cadence == StageSchedule::EveryMs)
+      schedule = StageSchedule::everyMs(period, phase);
+    else if (cadence == StageSchedule::EveryFrames)
+      schedule = StageSchedule::everyFrames(period, phase);
+
+    int ret = -1;
+    std::shared_ptr<FvCamera> cam = FvCamera::findCam(serial, &self->cams);
+    if (cam)
+    {
+      if (index == VideoIndex::RGB)
+      {
+        ret = cam->rgbTexture->pipeline->setSchedule(at, schedule);
+      }
+      else if (index == VideoIndex::Depth)
+      {
+        ret = cam->depthTexture->pipeline->setSchedule(at, schedule);
+      }
+      else if (index == VideoIndex::IR)
+      {
+        ret = cam->irTexture->pipeline->setSchedule(at, schedule);
+      }
+    }
+
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(fl_value_new_int(ret)));
+  }
+  else if (strcmp(method, "pipelineSetGated") == 0)
+  {
+    const char *serial = FL_ARG_STRING(args, "serial");
+    int index = FL_ARG_INT(args, "index");
+    int at = FL_ARG_INT(args, "at");
+    bool gated = FL_ARG_BOOL(args, "gated");
+
+    int ret = -1;
+    std::shared_ptr<FvCamera> cam = FvCamera::findCam(serial, &self->cams);
+    if (cam)
+    {
+      if (index == VideoIndex::RGB)
+      {
+        ret = cam->rgbTexture->pipeline->setGated(at, gated);
+      }
+      else if (index == VideoIndex::Depth)
+      {
+        ret = cam->depthTexture->pipeline->setGated(at, gated);
+      }
+      else if (index == VideoIndex::IR)
+      {
+        ret = cam->irTexture->pipeline->setGated(at, gated);
+      }
+    }
+
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(fl_value_new_int(ret)));
+  }
+  else if (strcmp(method, "pipelineSetParam") == 0)
+  {
+    const char *serial = FL_ARG_STRING(args, "serial");
+    int index = FL_ARG_INT(args, "index");
+    int at = FL_ARG_INT(args, "at");
+    const char *field = FL_ARG_STRING(args, "field");
+
+    // Numbers or recipe text
+    std::string value;
+    FlValue *valueValue = fl_value_lookup_string(args, "value");
+    if (valueValue != nullptr && fl_value_get_type(valueValue) == FL_VALUE_TYPE_INT)
+      value = std::to_string(fl_value_get_int(valueValue));
+    else if (valueValue != nullptr && fl_value_get_type(valueValue) == FL_VALUE_TYPE_FLOAT)
+    {
+      char text[32];
+      snprintf(text, sizeof(text), "%.9g", fl_value_get_float(valueValue));
+      value = text;
+    }
+    else if (valueValue != nullptr && fl_value_get_type(valueValue) == FL_VALUE_TYPE_STRING)
+      value = fl_value_get_string(valueValue);
+
+    int ret = -1;
+    std::shared_ptr<FvCamera> cam = FvCamera::findCam(serial, &self->cams);
+    if (cam)
+    {
+      if (index == VideoIndex::RGB)
+      {
+        ret = cam->rgbTexture->pipeline->setParam(at, field, value);
+      }
+      else if (index == VideoIndex::Depth)
+      {
+        ret = cam->depthTexture->pipeline->setParam(at, field, value);
+      }
+      else if (index == VideoIndex::IR)
+      {
+        ret = cam->irTexture->pipeline->setParam(at, field, value);
+      }
+    }
+
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(fl_value_new_int(ret)));
+  }
+  else if (strcmp(method, "pipelineSetCheckpointBudget") == 0)
+  {
+    const char *serial = FL_ARG_STRING(args, "serial");
+    int index = FL_ARG_INT(args, "index");
+    int64_t bytes = FL_ARG_INT(args, "bytes");
+
+    int ret = -1;
+    std::shared_ptr<FvCamera> cam = FvCamera::findCam(serial, &self->cams);
+    if (cam && bytes >= 0)
+    {
+      ret = 0;
+      if (index == VideoIndex::RGB)
+      {
+        cam->rgbTexture->pipeline->setCheckpointBudget(bytes);
+      }
+      else if (index == VideoIndex::Depth)
+      {
+        cam->depthTexture->pipeline->setCheckpointBudget(bytes);
+      }
+      else if (index == VideoIndex::IR)
+      {
+        cam->irTexture->pipeline->setCheckpointBudget(bytes);
+      }
+      else
+      {
+        ret = -1;
+      }
+    }
+
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(fl_value_new_int(ret)));
+  }
   else if (strcmp(method, "pipelineRun") == 0)
   {
     const char *serial = FL_ARG_STRING(args, "serial");
@@ -650,6 +856,132 @@ static void flutter_vision3d_plugin_handle_method_call(
 
     response = FL_METHOD_RESPONSE(fl_method_success_response_new(fl_value_new_string(info.c_str())));
   }
+  else if (strcmp(method, "pipelineLoad") == 0)
+  {
+    const char *serial = FL_ARG_STRING(args, "serial");
+    const int index = FL_ARG_INT(args, "index");
+
+    std::vector<RecipeStage> stages;
+    std::string error;
+    bool parsed = false;
+    FlValue *valueRecipe = fl_value_lookup_string(args, "recipe");
+    FlValue *valueText = fl_value_lookup_string(args, "text");
+    if (valueRecipe != nullptr && fl_value_get_type(valueRecipe) == FL_VALUE_TYPE_UINT8_LIST)
+      parsed = PipelineRecipe::parseBinary(fl_value_get_uint8_list(valueRecipe), fl_value_get_length(valueRecipe), stages, error);
+    else if (valueText != nullptr && fl_value_get_type(valueText) == FL_VALUE_TYPE_STRING)
+      parsed = PipelineRecipe::parseText(fl_value_get_string(valueText), stages, error);
+    else
+      error = "no recipe";
+
+    int ret = -1;
+    std::shared_ptr<FvCamera> cam = FvCamera::findCam(serial, &self->cams);
+    if (cam == nullptr)
+      error = "camera not found";
+    else if (parsed)
+      ret = cam->loadPipelines(stages, index, error);
+
+    if (ret == 0)
+      response = FL_METHOD_RESPONSE(fl_method_success_response_new(fl_value_new_int(ret)));
+    else
+      response = FL_METHOD_RESPONSE(fl_method_error_response_new("PIPELINE_LOAD", error.c_str(), nullptr));
+  }
+  else if (strcmp(method, "pipelineStats") == 0)
+  {
+    const char *serial = FL_ARG_STRING(args, "serial");
+    const int index = FL_ARG_INT(args, "index");
+
+    bool reset = false;
+    FlValue *valueReset = fl_value_lookup_string(args, "reset");
+    if (valueReset != nullptr && fl_value_get_type(valueReset) != FL_VALUE_TYPE_NULL)
+      reset = fl_value_get_bool(valueReset);
+
+    std::vector<StageStatsSnapshot> stats;
+    std::shared_ptr<FvCamera> cam = FvCamera::findCam(serial, &self->cams);
+    if (cam)
+    {
+      if (index == VideoIndex::RGB)
+      {
+        stats = cam->rgbTexture->pipeline->getPipelineStats(reset);
+      }
+      else if (index == VideoIndex::Depth)
+      {
+        stats = cam->depthTexture->pipeline->getPipelineStats(reset);
+      }
+      else if (index == VideoIndex::IR)
+      {
+        stats = cam->irTexture->pipeline->getPipelineStats(reset);
+      }
+    }
+
+    auto list = fl_value_new_list();
+    for (auto &s : stats)
+    {
+      auto m = fl_value_new_map();
+      fl_value_set(m, fl_value_new_string("name"), fl_value_new_string(s.name.c_str()));
+      fl_value_set(m, fl_value_new_string("calls"), fl_value_new_int(s.calls));
+      fl_value_set(m, fl_value_new_string("skips"), fl_value_new_int(s.skips));
+      fl_value_set(m, fl_value_new_string("errors"), fl_value_new_int(s.errors));
+      fl_value_set(m, fl_value_new_string("bytesIn"), fl_value_new_int(s.bytesIn));
+      fl_value_set(m, fl_value_new_string("bytesOut"), fl_value_new_int(s.bytesOut));
+      fl_value_set(m, fl_value_new_string("meanUs"), fl_value_new_float(s.meanUs));
+      fl_value_set(m, fl_value_new_string("maxUs"), fl_value_new_float(s.maxUs));
+      fl_value_set(m, fl_value_new_string("p50Us"), fl_value_new_float(s.p50Us));
+      fl_value_set(m, fl_value_new_string("p95Us"), fl_value_new_float(s.p95Us));
+      fl_value_set(m, fl_value_new_string("p99Us"), fl_value_new_float(s.p99Us));
+      fl_value_append_take(list, m);
+    }
+
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(list));
+  }
+  else if (strcmp(method, "pipelinePlan") == 0)
+  {
+    const char *serial = FL_ARG_STRING(args, "serial");
+    const int index = FL_ARG_INT(args, "index");
+
+    // Without a shape: the shape the pipeline is planned for, i.e. the current frames
+    ImageShape shape;
+    FlValue *valueWidth = fl_value_lookup_string(args, "width");
+    FlValue *valueHeight = fl_value_lookup_string(args, "height");
+    FlValue *valueType = fl_value_lookup_string(args, "type");
+    if (valueWidth != nullptr && fl_value_get_type(valueWidth) == FL_VALUE_TYPE_INT &&
+        valueHeight != nullptr && fl_value_get_type(valueHeight) == FL_VALUE_TYPE_INT &&
+        valueType != nullptr && fl_value_get_type(valueType) == FL_VALUE_TYPE_INT)
+    {
+      shape.size = cv::Size(fl_value_get_int(valueWidth), fl_value_get_int(valueHeight));
+      shape.type = fl_value_get_int(valueType);
+    }
+
+    Pipeline *pipeline = nullptr;
+    std::shared_ptr<FvCamera> cam = FvCamera::findCam(serial, &self->cams);
+    if (cam)
+    {
+      if (index == VideoIndex::RGB)
+      {
+        pipeline = cam->rgbTexture->pipeline;
+      }
+      else if (index == VideoIndex::Depth)
+      {
+        pipeline = cam->depthTexture->pipeline;
+      }
+      else if (index == VideoIndex::IR)
+      {
+        pipeline = cam->irTexture->pipeline;
+      }
+    }
+
+    std::vector<std::string> shapes;
+    std::string error = "camera not found";
+    if (pipeline != nullptr && pipeline->describePlan(shape, shapes, error))
+    {
+      auto list = fl_value_new_list();
+      for (const std::string &s : shapes)
+        fl_value_append_take(list, fl_value_new_string(s.c_str()));
+
+      response = FL_METHOD_RESPONSE(fl_method_success_response_new(list));
+    }
+    else
+      response = FL_METHOD_RESPONSE(fl_method_error_response_new("PIPELINE_PLAN", error.c_str(), nullptr));
+  }
   else if (strcmp(method, "pipelineError") == 0)
   {
     const char *serial = FL_ARG_STRING(args, "serial");
@@ -661,15 +993,15 @@ static void flutter_vision3d_plugin_handle_method_call(
     {
       if (index == VideoIndex::RGB)
       {
-        error = cam->rgbTexture->pipeline->error;
+        error = cam->rgbTexture->pipeline->getError();
       }
       else if (index == VideoIndex::Depth)
       {
-        error = cam->depthTexture->pipeline->error;
+        error = cam->depthTexture->pipeline->getError();
       }
       else if (index == VideoIndex::IR)
       {
-        error = cam->irTexture->pipeline->error;
+        error = cam->irTexture->pipeline->getError();
       }
     }
 
@@ -842,6 +1174,23 @@ static void flutter_vision3d_plugin_handle_method_call(
     int result = cv::countNonZero(*matA);
     response = FL_METHOD_RESPONSE(fl_method_success_response_new(fl_value_new_int(result)));
   }
+  else if (strcmp(method, "pipelinePluginLoad") == 0)
+  {
+    const char *path = FL_ARG_STRING(args, "path");
+
+    std::vector<std::string> names;
+    std::string error;
+    if (StagePluginRegistry::shared().load(path, names, error) == 0)
+    {
+      auto list = fl_value_new_list();
+      for (const std::string &name : names)
+        fl_value_append_take(list, fl_value_new_string(name.c_str()));
+
+      response = FL_METHOD_RESPONSE(fl_method_success_response_new(list));
+    }
+    else
+      response = FL_METHOD_RESPONSE(fl_method_error_response_new("PLUGIN_LOAD", error.c_str(), nullptr));
+  }
   else if (strcmp(method, "tfliteCreateModel") == 0)
   {
     const char *path = FL_ARG_STRING(args, "modelPath");
@@ -0,0 +1,259 @@
+#ifndef _DEF_CAMERA_RUNTIME_
+#define _DEF_CAMERA_RUNTIME_
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief What the runtime runs for one streaming camera
+ */
+class CameraWorkload
+{
+public:
+  virtual ~CameraWorkload() = default;
+
+  /**
+   * @brief Acquisition loop. Blocks on the SDK and queues frames until the stream stops.
+   */
+  virtual void runAcquisition() = 0;
+
+  /**
+   * @brief Process one queued frame
+   *
+   * @return false if no frame was queued
+   */
+  virtual bool processPendingFrame() = 0;
+};
+
+/**
+ * @brief Threads of every streaming camera.
+ *
+ * - Acquisition: one joinable thread per streaming camera, since SDK reads block. Started by `start`, joined by `stop`.
+ * - Processing: a fixed pool shared by all cameras. A camera with queued frames is on the ready queue at most once and
+ *   is served by one worker at a time, so its frames are processed in order. Cameras take turns frame by frame.
+ */
+class CameraRuntime
+{
+public:
+  // Never destroyed, so cameras can still stop while the process exits
+  static CameraRuntime &shared()
+  {
+    static CameraRuntime *runtime = new CameraRuntime();
+    return *runtime;
+  }
+
+  /**
+   * @brief Resize the processing pool. Frames being processed finish first; queued frames are kept.
+   *
+   * @return the number of processing threads
+   */
+  unsigned int setProcessingThreads(unsigned int n)
+  {
+    n = std::max(1u, std::min(n, MAX_PROCESSING_THREADS));
+
+    std::lock_guard<std::mutex> resize(resizeMutex);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      shutdown = true;
+    }
+    readyCond.notify_all();
+    for (std::thread &t : workers)
+      t.join();
+    workers.clear();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    shutdown = false;
+    for (unsigned int i = 0; i < n; i++)
+      workers.emplace_back(&CameraRuntime::processingLoop, this);
+
+    return n;
+  }
+
+  unsigned int processingThreads()
+  {
+    std::lock_guard<std::mutex> resize(resizeMutex);
+    return workers.size();
+  }
+
+  /**
+   * @brief Start the acquisition thread of `w`. If it is still running (stream enabled again before the loop noticed
+   * it was stopped), the loop runs once more instead of starting a second thread.
+   */
+  void start(CameraWorkload *w)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    std::unique_ptr<Entry> &entry = entries[w];
+    if (entry == nullptr)
+      entry = std::make_unique<Entry>();
+
+    if (entry->acquiring)
+    {
+      entry->restart = true;
+      return;
+    }
+
+    std::thread previous = std::move(entry->acquisition);
+    entry->acquiring = true;
+    entry->acquisition = std::thread(&CameraRuntime::acquisitionLoop, this, w, entry.get());
+    lock.unlock();
+
+    if (previous.joinable())
+      previous.join();
+  }
+
+  /**
+   * @brief Join the acquisition thread of `w` and wait for its frame in processing, if any. The camera must have
+   * stopped its acquisition loop already (stream flag cleared, mailbox closed). Not callable from the camera's own
+   * threads.
+   */
+  void stop(CameraWorkload *w)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    auto it = entries.find(w);
+    if (it == entries.end())
+      return;
+
+    Entry *entry = it->second.get();
+    entry->stopping = true;
+    entry->restart = false;
+    ready.erase(std::remove(ready.begin(), ready.end(), w), ready.end());
+    entry->queued = false;
+
+    std::thread acquisition = std::move(entry->acquisition);
+    lock.unlock();
+    if (acquisition.joinable())
+      acquisition.join();
+
+    lock.lock();
+    idleCond.wait(lock, [&]
+                  { return !entry->busy; });
+    entries.erase(w);
+  }
+
+  /**
+   * @brief A frame was queued by `w`
+   */
+  void notify(CameraWorkload *w)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    auto it = entries.find(w);
+    if (it == entries.end() || it->second->stopping)
+      return;
+
+    Entry *entry = it->second.get();
+    if (entry->busy)
+    {
+      entry->more = true;
+      return;
+    }
+
+    if (entry->queued)
+      return;
+
+    entry->queued = true;
+    ready.push_back(w);
+    lock.unlock();
+    readyCond.notify_one();
+  }
+
+  /**
+   * @brief Wait until no frame of `w` is being processed
+   */
+  void waitIdle(CameraWorkload *w)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    idleCond.wait(lock, [&]
+                  {
+                    auto it = entries.find(w);
+                    return it == entries.end() || !it->second->busy; });
+  }
+
+private:
+  static constexpr unsigned int MAX_PROCESSING_THREADS = 64;
+
+  struct Entry
+  {
+    std::thread acquisition;
+    bool acquiring = false;
+    bool restart = false;
+    bool stopping = false;
+    // On the ready queue
+    bool queued = false;
+    // A worker is processing one of its frames
+    bool busy = false;
+    // Frames were queued while busy
+    bool more = false;
+  };
+
+  std::mutex mutex;
+  std::condition_variable readyCond;
+  std::condition_variable idleCond;
+  std::map<CameraWorkload *, std::unique_ptr<Entry>> entries;
+  std::deque<CameraWorkload *> ready;
+  bool shutdown = false;
+
+  // Serializes pool resizes
+  std::mutex resizeMutex;
+  std::vector<std::thread> workers;
+
+  CameraRuntime()
+  {
+    setProcessingThreads(std::max(1u, std::thread::hardware_concurrency() / 2));
+  }
+
+  void acquisitionLoop(CameraWorkload *w, Entry *entry)
+  {
+    while (true)
+    {
+      w->runAcquisition();
+
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!entry->restart || entry->stopping)
+      {
+        entry->acquiring = false;
+        return;
+      }
+      entry->restart = false;
+    }
+  }
+
+  void processingLoop()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+      readyCond.wait(lock, [&]
+                     { return shutdown || !ready.empty(); });
+      if (shutdown)
+        return;
+
+      CameraWorkload *w = ready.front();
+      ready.pop_front();
+      Entry *entry = entries[w].get();
+      entry->queued = false;
+      entry->busy = true;
+      entry->more = false;
+      lock.unlock();
+
+      bool processed = w->processPendingFrame();
+
+      lock.lock();
+      entry->busy = false;
+      if ((processed || entry->more) && !entry->stopping)
+      {
+        // To the back, so every camera with frames gets a turn
+        entry->queued = true;
+        ready.push_back(w);
+        readyCond.notify_one();
+      }
+      idleCond.notify_all();
+    }
+  }
+};
+#endif
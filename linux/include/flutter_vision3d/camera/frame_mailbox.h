@@ -0,0 +1,157 @@
+#ifndef _DEF_FRAME_MAILBOX_
+#define _DEF_FRAME_MAILBOX_
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+
+#include "../pipeline/pipeline_stats.h"
+
+enum FramePolicy
+{
+  // Acquisition waits for the processing thread. Every frame is processed.
+  Block = 0,
+  // Queue up to `queueSize` frames, discard the oldest one when full
+  DropOldest = 1,
+  // One-slot mailbox, a new frame replaces the pending one
+  LatestWins = 2,
+};
+
+/**
+ * @brief Policy and counters shared by a camera's acquisition and processing threads. Can be changed while streaming.
+ */
+struct FrameScheduling
+{
+  std::atomic<int> policy{FramePolicy::Block};
+  std::atomic<unsigned int> queueSize{1};
+  // Frames older than this when processing starts are counted as stale
+  std::atomic<int64_t> staleNs{100 * 1000000LL};
+
+  std::atomic<uint64_t> captured{0};
+  std::atomic<uint64_t> delivered{0};
+  std::atomic<uint64_t> dropped{0};
+  std::atomic<uint64_t> stale{0};
+
+  void resetCounters()
+  {
+    captured = 0;
+    delivered = 0;
+    dropped = 0;
+    stale = 0;
+  }
+};
+
+/**
+ * @brief Hands frames from a camera's acquisition thread to the processing workers.
+ *
+ * T holds the SDK frame references, so a frame stays valid for as long as it is queued or being processed.
+ */
+template <typename T>
+class FrameMailbox
+{
+public:
+  /**
+   * @param onFrame called after each queued frame, outside the lock
+   */
+  FrameMailbox(FrameScheduling &s, std::function<void()> onFrame = nullptr) : scheduling(s), onFrame(std::move(onFrame)) {}
+
+  void open()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    frames.clear();
+    closed = false;
+  }
+
+  /**
+   * @brief Drop pending frames and wake both sides. `push` and `pop` return false afterwards.
+   */
+  void close()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      frames.clear();
+      closed = true;
+    }
+    cond.notify_all();
+  }
+
+  /**
+   * @return false if the mailbox is closed
+   */
+  bool push(T &&frame)
+  {
+    int64_t now = getMonotonicNs();
+    scheduling.captured.fetch_add(1, std::memory_order_relaxed);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    int policy = scheduling.policy.load(std::memory_order_relaxed);
+    size_t capacity = policy == FramePolicy::LatestWins ? 1 : std::max(1u, scheduling.queueSize.load(std::memory_order_relaxed));
+
+    if (policy == FramePolicy::Block)
+    {
+      cond.wait(lock, [&]
+                { return closed || frames.size() < capacity; });
+    }
+    else
+    {
+      while (frames.size() >= capacity)
+      {
+        frames.pop_front();
+        scheduling.dropped.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+
+    if (closed)
+      return false;
+
+    frames.push_back({std::move(frame), now});
+    lock.unlock();
+    cond.notify_all();
+    if (onFrame)
+      onFrame();
+
+    return true;
+  }
+
+  /**
+   * @brief Take the next frame without waiting
+   *
+   * @return false if no frame is queued or the mailbox is closed
+   */
+  bool pop(T &frame)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (closed || frames.empty())
+      return false;
+
+    frame = std::move(frames.front().frame);
+    int64_t age = getMonotonicNs() - frames.front().timestamp;
+    frames.pop_front();
+    lock.unlock();
+    cond.notify_all();
+
+    scheduling.delivered.fetch_add(1, std::memory_order_relaxed);
+    if (age > scheduling.staleNs.load(std::memory_order_relaxed))
+      scheduling.stale.fetch_add(1, std::memory_order_relaxed);
+
+    return true;
+  }
+
+private:
+  struct Entry
+  {
+    T frame;
+    int64_t timestamp;
+  };
+
+  FrameScheduling &scheduling;
+  std::function<void()> onFrame;
+  std::deque<Entry> frames;
+  bool closed = false;
+  std::mutex mutex;
+  std::condition_variable cond;
+};
+#endif
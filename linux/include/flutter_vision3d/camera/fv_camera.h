@@ -2,8 +2,11 @@
 #define _DEF_CAMERA_
 
 #include "../pipeline/pipeline.h"
+#include "../pipeline/pipeline_recipe.h"
 #include "../fv_texture.h"
 #include "../opengl.h"
+#include "frame_mailbox.h"
+#include "camera_runtime.h"
 
 #define NOT_SUPPORT -99
 
@@ -16,7 +19,7 @@ enum VideoIndex
   Camera2D = 0b10000,
 };
 
-class FvCamera
+class FvCamera : public CameraWorkload
 {
 public:
   OpenGLFL *glfl;
@@ -28,12 +31,14 @@ public:
   FvTexture *rgbTexture;
   FvTexture *depthTexture;
   FvTexture *irTexture;
-  bool videoStart = false;
+  std::atomic<bool> videoStart{false};
   bool enablePointCloud = false;
-  bool pauseStream = false;
+  std::atomic<bool> pauseStream{false};
   int type;
-  bool videoFeedProcessing = false;
   cv::Rect crop;
+  FrameScheduling frameScheduling;
+  // Shared by the three pipelines, so stages of one stream can read the frames of the others
+  RegisterFile registers;
 
   uint16_t *depthData = new uint16_t[1280 * 720];
   int depthWidth = 0, depthHeight = 0;
@@ -104,6 +109,9 @@ public:
     FV_TEXTURE(depthTexture)->models = models;
     FV_TEXTURE(irTexture)->pipeline = new Pipeline(&FV_TEXTURE(irTexture)->cvImage);
     FV_TEXTURE(irTexture)->models = models;
+    rgbTexture->pipeline->setRegisters(&registers, RegisterFile::RGB);
+    depthTexture->pipeline->setRegisters(&registers, RegisterFile::DEPTH);
+    irTexture->pipeline->setRegisters(&registers, RegisterFile::IR);
   }
 
   int64_t getTextureId(int index)
@@ -124,6 +132,24 @@ public:
     return -1;
   }
 
+  FvTexture *getTexture(int index)
+  {
+    if (index == VideoIndex::RGB)
+    {
+      return rgbTexture;
+    }
+    else if (index == VideoIndex::Depth)
+    {
+      return depthTexture;
+    }
+    else if (index == VideoIndex::IR)
+    {
+      return irTexture;
+    }
+
+    return nullptr;
+  }
+
   // TODO: check if long is enough
   uintptr_t getOpenCVMat(int index)
   {
@@ -143,20 +169,45 @@ public:
     return 0;
   }
 
+  /**
+   * @brief Pause or resume the stream. Acquisition sleeps while paused and queued frames are dropped. Pausing returns
+   * once the frame being processed, if any, is done.
+   */
   void pause(bool p)
   {
-    pauseStream = p;
+    {
+      std::lock_guard<std::mutex> lock(pauseMutex);
+      pauseStream = p;
+    }
+    pauseCond.notify_all();
 
-    // [HedgeHao]
-    // Wait for video feed loop finish, or memory leak will happened.
-    // Empty while loop is not working. Must do something inside. DKW.
     if (p)
+      CameraRuntime::shared().waitIdle(this);
+  }
+
+  /**
+   * @brief Stop acquisition and wait for the camera's threads. Called by `closeDevice` before the SDK stream is
+   * released.
+   */
+  void stopVideoFeed()
+  {
     {
-      while (videoFeedProcessing)
-      {
-        std::cout << "";
-      }
+      std::lock_guard<std::mutex> lock(pauseMutex);
+      videoStart = false;
     }
+    pauseCond.notify_all();
+    _closeVideoFeed();
+    CameraRuntime::shared().stop(this);
+  }
+
+  void runAcquisition() override
+  {
+    _readVideoFeed();
+  }
+
+  bool processPendingFrame() override
+  {
+    return _processVideoFeed();
   }
 
   uint16_t *getDepthData()
@@ -170,6 +221,95 @@ public:
     std::cout << "Set Crop Area:" << startX << "," << startY << "," << endX << "," << endY << std::endl;
   }
 
+  /**
+   * @brief How frames are handed from the acquisition thread to the processing thread when processing is slower
+   * than the sensor
+   *
+   * @param policy FramePolicy
+   * @param queueSize frames kept by `DropOldest` and `Block`. `LatestWins` always keeps one.
+   * @param staleMs frames older than this when processing starts are counted as stale
+   */
+  void setFramePolicy(int policy, int queueSize, int staleMs)
+  {
+    frameScheduling.policy = policy;
+    frameScheduling.queueSize = queueSize > 0 ? queueSize : 1;
+    frameScheduling.staleNs = (int64_t)staleMs * 1000000;
+  }
+
+  /**
+   * @brief Install the stages of a recipe. Every stream that has stages in the recipe gets its list replaced in one
+   * publish; the other streams are untouched. Nothing is installed if any stage is invalid.
+   *
+   * @param defaultStream stream of the stages without one
+   */
+  int loadPipelines(const std::vector<RecipeStage> &stages, int defaultStream, std::string &error)
+  {
+    FvTexture *textures[] = {rgbTexture, depthTexture, irTexture};
+    const int streams[] = {VideoIndex::RGB, VideoIndex::Depth, VideoIndex::IR};
+    std::vector<FuncDef> lists[3];
+    bool used[3] = {false, false, false};
+
+    for (size_t i = 0; i < stages.size(); i++)
+    {
+      const RecipeStage &stage = stages[i];
+      unsigned int mask = stage.streams == 0 ? defaultStream : stage.streams;
+      if (mask == 0 || (mask & ~(VideoIndex::RGB | VideoIndex::Depth | VideoIndex::IR)) != 0)
+      {
+        error = "stage " + std::to_string(i) + ": invalid stream " + std::to_string(mask);
+        return -1;
+      }
+
+      for (int s = 0; s < 3; s++)
+      {
+        if ((mask & streams[s]) == 0)
+          continue;
+
+        FuncDef f;
+        std::string stageError;
+        if (!Pipeline::makeStage(stage.index, stage.params, stage.interval, stage.runOnce, f, stageError))
+        {
+          error = "stage " + std::to_string(i) + ": " + stageError;
+          return -1;
+        }
+
+        f.gated = stage.gated;
+        lists[s].push_back(f);
+        used[s] = true;
+      }
+    }
+
+    // All or nothing: check every stream before loading any. Planning stays locked in between, so a replan cannot
+    // make a checked list fail to load.
+    std::unique_lock<std::recursive_mutex> locks[3];
+    for (int s = 0; s < 3; s++)
+    {
+      if (used[s])
+        locks[s] = textures[s]->pipeline->lockPlanning();
+    }
+
+    const char *names[] = {"rgb", "depth", "ir"};
+    for (int s = 0; s < 3; s++)
+    {
+      std::string planError;
+      if (used[s] && !textures[s]->pipeline->check(lists[s], planError))
+      {
+        error = std::string(names[s]) + ": " + planError;
+        return -1;
+      }
+    }
+
+    for (int s = 0; s < 3; s++)
+    {
+      if (used[s] && textures[s]->pipeline->load(lists[s]) != 0)
+      {
+        error = std::string(names[s]) + ": " + textures[s]->pipeline->getError();
+        return -1;
+      }
+    }
+
+    return 0;
+  }
+
   virtual int camInit() = 0;
   virtual int openDevice() = 0;
   virtual int closeDevice() = 0;
@@ -187,7 +327,44 @@ public:
   virtual void loadPresetParameters(std::string &path) = 0;
   virtual ~FvCamera() = default;
 
+protected:
+  /**
+   * @brief Called by acquisition loops before each read. Sleeps while the stream is paused.
+   *
+   * @return false if the stream was stopped
+   */
+  bool waitWhilePaused()
+  {
+    std::unique_lock<std::mutex> lock(pauseMutex);
+    pauseCond.wait(lock, [&]
+                   { return !pauseStream || !videoStart; });
+    return videoStart;
+  }
+
+  /**
+   * @brief Queue hook of the camera's mailbox
+   */
+  void frameQueued()
+  {
+    CameraRuntime::shared().notify(this);
+  }
+
 private:
+  std::mutex pauseMutex;
+  std::condition_variable pauseCond;
+
   virtual int _readVideoFeed() = 0;
+
+  /**
+   * @brief Process one queued frame on a processing worker
+   *
+   * @return false if no frame was queued
+   */
+  virtual bool _processVideoFeed() { return false; }
+
+  /**
+   * @brief Wake an acquisition loop blocked on a full mailbox
+   */
+  virtual void _closeVideoFeed() {}
 };
 #endif
\ No newline at end of file
@@ -114,6 +114,7 @@ public:
       return -1;
     }
 
+    stopVideoFeed();
     if (vsColor.isValid())
     {
       vsColor.stop();
@@ -177,6 +178,9 @@ public:
     {
       if (*enable)
       {
+        // A crop changes the size the pipeline sees, the sensor mode does not help then
+        if (crop.empty())
+          negotiateMode(vsColor, openni::SENSOR_COLOR, rgbTexture->pipeline);
         vsColor.start();
         if (vsColor.isValid())
           isValid += VideoIndex::RGB;
@@ -193,6 +197,7 @@ public:
     {
       if (*enable)
       {
+        negotiateMode(vsDepth, openni::SENSOR_DEPTH, depthTexture->pipeline);
         vsDepth.start();
         if (vsDepth.isValid())
           isValid += VideoIndex::Depth;
@@ -209,6 +214,7 @@ public:
     {
       if (*enable)
       {
+        negotiateMode(vsIR, openni::SENSOR_IR, irTexture->pipeline);
         vsIR.start();
         if (vsIR.isValid())
           isValid += VideoIndex::IR;
@@ -235,11 +241,33 @@ public:
     return 0;
   }
 
+  /**
+   * @brief Switch `vs` to the resolution its pipeline resizes to first (`Pipeline::streamRequest`), if the sensor has a
+   * mode with that resolution and the current pixel format and fps
+   */
+  void negotiateMode(openni::VideoStream &vs, openni::SensorType sensor, Pipeline *p)
+  {
+    StreamRequest request = p->streamRequest();
+    if (request.width == 0 || !vs.isValid())
+      return;
+
+    openni::VideoMode current = vs.getVideoMode();
+    auto &modes = device->getSensorInfo(sensor)->getSupportedVideoModes();
+    for (int i = 0; i < modes.getSize(); i++)
+    {
+      if (modes[i].getResolutionX() == request.width && modes[i].getResolutionY() == request.height &&
+          modes[i].getPixelFormat() == current.getPixelFormat() && modes[i].getFps() == current.getFps())
+      {
+        vs.setVideoMode(modes[i]);
+        return;
+      }
+    }
+  }
+
   int readVideoFeed()
   {
     videoStart = true;
-    std::thread t(&OpenniCam::_readVideoFeed, this);
-    t.detach();
+    CameraRuntime::shared().start(this);
     return 0;
   }
 
@@ -398,6 +426,18 @@ private:
   bool enableDepth = false;
   bool enableIr = false;
 
+  struct NiFrame
+  {
+    VideoFrameRef rgb;
+    VideoFrameRef depth;
+    VideoFrameRef ir;
+  };
+
+  FrameMailbox<NiFrame> mailbox{frameScheduling, [this]
+                                 { frameQueued(); }};
+  // Frames being processed. Keeps `depthData` valid until the next one.
+  NiFrame currentFrame;
+
   void createVideoStream(int videoMode = 7) // create all video stream by default
   {
     if (device == nullptr)
@@ -497,15 +537,12 @@ private:
     *vertexCount = count;
   }
 
+  /**
+   * @brief Acquisition thread. Reads one frame of every enabled stream and queues them together.
+   */
   int _readVideoFeed()
   {
-    VideoFrameRef rgbFrame;
-    VideoFrameRef depthFrame;
-    VideoFrameRef irFrame;
-
-    bool rgbNewFrame = false;
-    bool depthNewFrame = false;
-    // bool irNewFrame = false;
+    VideoFrameRef frameRef;
 
     if (!(videoStart))
       return -1;
@@ -515,62 +552,77 @@ private:
     depthWidth = m.getResolutionX();
     depthHeight = m.getResolutionY();
 
-    while (videoStart)
+    mailbox.open();
+    while (waitWhilePaused())
     {
-      rgbNewFrame = false;
-      depthNewFrame = false;
-      // irNewFrame = false;
+      NiFrame frame;
+      if (niRgbAvailable && enableRgb && vsColor.isValid() && vsColor.readFrame(&frameRef) == STATUS_OK)
+        frame.rgb = frameRef;
+
+      if (niDepthAvailable && enableDepth && vsDepth.isValid() && vsDepth.readFrame(&frameRef) == STATUS_OK)
+        frame.depth = frameRef;
 
-      if (pauseStream)
+      if (niIrAvailable && enableIr && vsIR.isValid() && vsIR.readFrame(&frameRef) == STATUS_OK)
+        frame.ir = frameRef;
+
+      if (!frame.rgb.isValid() && !frame.depth.isValid() && !frame.ir.isValid())
         continue;
 
-      videoFeedProcessing = true;
+      if (!mailbox.push(std::move(frame)))
+        break;
+    }
 
-      if (niRgbAvailable && enableRgb && vsColor.isValid())
-      {
-        if (vsColor.readFrame(&rgbFrame) == STATUS_OK)
-        {
-          rgbTexture->cvImage = cv::Mat(rgbFrame.getHeight(), rgbFrame.getWidth(), CV_8UC3, (void *)rgbFrame.getData());
-          if (!crop.empty())
-          {
-            rgbTexture->cvImage = rgbTexture->cvImage(crop);
-          }
-          rgbTexture->pipeline->run(rgbTexture, *flRegistrar, models, flChannel);
-          rgbNewFrame = true;
-        }
-      }
+    mailbox.close();
+    return 0;
+  }
 
-      if (niDepthAvailable && enableDepth && vsDepth.isValid())
-      {
-        if (vsDepth.readFrame(&depthFrame) == STATUS_OK)
-        {
-          depthTexture->cvImage = cv::Mat(depthFrame.getHeight(), depthFrame.getWidth(), CV_16UC1, (void *)depthFrame.getData());
-          depthTexture->pipeline->run(depthTexture, *flRegistrar, models, flChannel);
-          depthNewFrame = true;
+  bool _processVideoFeed()
+  {
+    NiFrame frame;
+    if (!mailbox.pop(frame))
+      return false;
 
-          depthData = (uint16_t *)depthFrame.getData();
-        }
-      }
+    if (pauseStream)
+      return true;
 
-      if (niIrAvailable && enableIr && vsDepth.isValid())
-      {
-        if (vsIR.readFrame(&irFrame) == STATUS_OK)
-        {
-          irTexture->cvImage = cv::Mat(irFrame.getHeight(), irFrame.getWidth(), CV_16UC1, (void *)irFrame.getData());
-          irTexture->pipeline->run(irTexture, *flRegistrar, models, flChannel);
-          // irNewFrame = true;
-        }
-      }
+    currentFrame = frame;
 
-      if (enablePointCloud && niRgbAvailable && depthNewFrame && rgbNewFrame)
+    if (frame.rgb.isValid())
+    {
+      rgbTexture->cvImage = cv::Mat(frame.rgb.getHeight(), frame.rgb.getWidth(), CV_8UC3, (void *)frame.rgb.getData());
+      if (!crop.empty())
       {
-        niComputeCloud(vsDepth, (const openni::DepthPixel *)depthFrame.getData(), (const openni::RGB888Pixel *)rgbFrame.getData(), glfl->modelPointCloud->vertices, glfl->modelPointCloud->colors, glfl->modelPointCloud->colorsMap, &glfl->modelPointCloud->vertexPoints);
+        rgbTexture->cvImage = rgbTexture->cvImage(crop);
       }
+      rgbTexture->pipeline->run(rgbTexture, *flRegistrar, models, flChannel);
+    }
+
+    if (frame.depth.isValid())
+    {
+      depthTexture->cvImage = cv::Mat(frame.depth.getHeight(), frame.depth.getWidth(), CV_16UC1, (void *)frame.depth.getData());
+      depthTexture->pipeline->run(depthTexture, *flRegistrar, models, flChannel);
 
-      fl_method_channel_invoke_method(flChannel, "onNiFrame", nullptr, nullptr, nullptr, NULL);
-      videoFeedProcessing = false;
+      depthData = (uint16_t *)frame.depth.getData();
     }
-    return 0;
+
+    if (frame.ir.isValid())
+    {
+      irTexture->cvImage = cv::Mat(frame.ir.getHeight(), frame.ir.getWidth(), CV_16UC1, (void *)frame.ir.getData());
+      irTexture->pipeline->run(irTexture, *flRegistrar, models, flChannel);
+    }
+
+    if (enablePointCloud && niRgbAvailable && frame.depth.isValid() && frame.rgb.isValid())
+    {
+      niComputeCloud(vsDepth, (const openni::DepthPixel *)frame.depth.getData(), (const openni::RGB888Pixel *)frame.rgb.getData(), glfl->modelPointCloud->vertices, glfl->modelPointCloud->colors, glfl->modelPointCloud->colorsMap, &glfl->modelPointCloud->vertexPoints);
+    }
+
+    fl_method_channel_invoke_method(flChannel, "onNiFrame", nullptr, nullptr, nullptr, NULL);
+    return true;
+  }
+
+  void _closeVideoFeed()
+  {
+    mailbox.close();
   }
 };
 #endif
\ No newline at end of file
@@ -34,8 +34,6 @@ private:
 #include <vector>
 #include <thread>
 
-int64_t tsRs = 0;
-
 enum RsVideoIndex
 {
   RS_RGB = 0b1,
@@ -83,20 +81,17 @@ public:
   int openDevice()
   {
     pipeline = new rs2::pipeline(ctx);
-    cfg = rs2::config();
-    cfg.enable_stream(RS2_STREAM_COLOR, 1280, 720, RS2_FORMAT_BGR8, 30);
-    cfg.enable_stream(RS2_STREAM_DEPTH, 1280, 720, RS2_FORMAT_Z16, 30);
-    cfg.enable_stream(RS2_STREAM_INFRARED);
-    cfg.enable_device(serial);
+    // Replaced by the negotiated profile when streaming starts
+    cfg = makeConfig(1280, 720, RS2_FORMAT_BGR8, 1280, 720);
 
     return 0;
   }
 
   int closeDevice()
   {
+    stopVideoFeed();
     try
     {
-      videoStart = false;
       pipeline->stop();
     }
     catch (rs2::error &e)
@@ -157,10 +152,12 @@ public:
 
     if (*enable)
     {
+      negotiateStreams();
       cfg.enable_all_streams();
       try
       {
         profile = pipeline->start(cfg);
+        applyColorFormat();
       }
       catch (rs2::error &e)
       {
@@ -170,7 +167,8 @@ public:
     }
     else
     {
-      videoStart = false;
+      // Wakes a paused acquisition thread and joins it before the pipeline stops
+      stopVideoFeed();
       try
       {
         pipeline->stop();
@@ -188,8 +186,7 @@ public:
   int readVideoFeed()
   {
     videoStart = true;
-    std::thread t(&RealsenseCam::_readVideoFeed, this);
-    t.detach();
+    CameraRuntime::shared().start(this);
     return 0;
   }
 
@@ -314,11 +311,81 @@ private:
   rs2::pointcloud rsPointcloud;
   rs2::frame rgbFrame;
   std::vector<RsFilter> filters{};
+  FrameMailbox<rs2::frameset> mailbox{frameScheduling, [this]
+                                       { frameQueued(); }};
+  // Frameset being processed. Keeps `depthData` valid until the next one.
+  rs2::frameset currentFrames;
+  // Color frames come in BGR and the RGB pipeline did not ask for it, swap them before running it
+  bool swapColor = true;
+
+  /**
+   * @brief Enable the color and depth profiles the pipelines consume (`Pipeline::streamRequest`): the color order
+   * and resolution they convert to first, if the device has such a mode. Falls back step by step to 1280x720@30.
+   */
+  void negotiateStreams()
+  {
+    StreamRequest color = rgbTexture->pipeline->streamRequest();
+    StreamRequest depth = depthTexture->pipeline->streamRequest();
+    rs2_format colorFormat = color.bgr ? RS2_FORMAT_BGR8 : RS2_FORMAT_RGB8;
 
-  int _readVideoFeed()
+    struct Mode
+    {
+      int colorWidth, colorHeight;
+      rs2_format colorFormat;
+      int depthWidth, depthHeight;
+    };
+
+    const Mode modes[] = {
+        {color.width, color.height, colorFormat, depth.width, depth.height},
+        {color.width, color.height, colorFormat, 1280, 720},
+        {1280, 720, colorFormat, depth.width, depth.height},
+        {1280, 720, colorFormat, 1280, 720},
+    };
+
+    for (const Mode &m : modes)
+    {
+      if (m.colorWidth == 0 || m.depthWidth == 0)
+        continue;
+
+      rs2::config candidate = makeConfig(m.colorWidth, m.colorHeight, m.colorFormat, m.depthWidth, m.depthHeight);
+      if (candidate.can_resolve(*pipeline))
+      {
+        cfg = candidate;
+        return;
+      }
+    }
+
+    cfg = makeConfig(1280, 720, RS2_FORMAT_BGR8, 1280, 720);
+  }
+
+  rs2::config makeConfig(int colorWidth, int colorHeight, rs2_format colorFormat, int depthWidth, int depthHeight)
   {
-    int64_t now;
+    rs2::config c;
+    c.enable_stream(RS2_STREAM_COLOR, colorWidth, colorHeight, colorFormat, 30);
+    c.enable_stream(RS2_STREAM_DEPTH, depthWidth, depthHeight, RS2_FORMAT_Z16, 30);
+    c.enable_stream(RS2_STREAM_INFRARED);
+    c.enable_device(serial);
+    return c;
+  }
 
+  /**
+   * @brief Tell the RGB pipeline which color order it gets from the started profile
+   */
+  void applyColorFormat()
+  {
+    StreamRequest delivered;
+    bool bgr = profile.get_stream(RS2_STREAM_COLOR).format() == RS2_FORMAT_BGR8;
+    delivered.bgr = bgr && rgbTexture->pipeline->streamRequest().bgr;
+    swapColor = bgr && !delivered.bgr;
+    rgbTexture->pipeline->setSource(delivered);
+  }
+
+  /**
+   * @brief Acquisition thread. Only waits for the SDK and queues the frameset, so the SDK queue never backs up behind
+   * a slow pipeline.
+   */
+  int _readVideoFeed()
+  {
     if (videoStart)
     {
       rs2::frameset frames = pipeline->wait_for_frames(timeout);
@@ -326,77 +393,100 @@ private:
       depthHeight = frames.get_depth_frame().get_height();
     }
 
-    while (videoStart)
+    mailbox.open();
+    while (waitWhilePaused())
     {
-      if (pauseStream)
-        continue;
-
-      videoFeedProcessing = true;
-
-      getCurrentTime(&now);
-      if (now - tsRs < 32)
-      {
-        videoFeedProcessing = false;
-        continue;
-      }
-      tsRs = now;
-
       try
       {
         rs2::frameset frames = pipeline->wait_for_frames(timeout);
-        if (filters.size() > 0)
-        {
-          for (RsFilter f : filters)
-          {
-            frames = f.filter->process(frames);
-          }
-        }
-
-        rgbFrame = frames.get_color_frame();
-        auto depthFrame = frames.get_depth_frame();
-        auto irFrame = frames.get_infrared_frame();
+        if (!mailbox.push(std::move(frames)))
+          break;
+      }
+      catch (const rs2::error &e)
+      {
+        std::cerr << "RealSense error calling " << e.get_failed_function() << "(" << e.get_failed_args() << "):\n    " << e.what() << std::endl;
+      }
+      catch (const std::exception &e)
+      {
+        std::cerr << e.what() << std::endl;
+        videoStart = false;
+        break;
+      }
+    }
 
-        if (isRgbEnable && rgbFrame)
-        {
-          rgbTexture->cvImage = frame_to_mat(rgbFrame);
-          cv::cvtColor(rgbTexture->cvImage, rgbTexture->cvImage, cv::COLOR_BGR2RGB);
-          rgbTexture->pipeline->run(rgbTexture, *flRegistrar, models, flChannel);
-        }
+    mailbox.close();
+    return 0;
+  }
 
-        if (isDepthEnable && depthFrame)
-        {
-          depthTexture->cvImage = frame_to_mat(depthFrame);
-          depthTexture->pipeline->run(depthTexture, *flRegistrar, models, flChannel);
+  bool _processVideoFeed()
+  {
+    rs2::frameset frames;
+    if (!mailbox.pop(frames))
+      return false;
 
-          depthData = (uint16_t *)(depthFrame.get_data());
-        }
+    if (pauseStream)
+      return true;
 
-        if (isIrEnable && irFrame)
+    try
+    {
+      if (filters.size() > 0)
+      {
+        for (RsFilter f : filters)
         {
-          irTexture->cvImage = frame_to_mat(irFrame);
-          irTexture->pipeline->run(irTexture, *flRegistrar, models, flChannel);
+          frames = f.filter->process(frames);
         }
+      }
 
-        if (enablePointCloud)
-        {
-          glfl->modelRsPointCloud->points = rsPointcloud.calculate(depthFrame);
-          rsPointcloud.map_to(rgbFrame);
-        }
+      currentFrames = frames;
+      rgbFrame = frames.get_color_frame();
+      auto depthFrame = frames.get_depth_frame();
+      auto irFrame = frames.get_infrared_frame();
+
+      if (isRgbEnable && rgbFrame)
+      {
+        rgbTexture->cvImage = frame_to_mat(rgbFrame);
+        if (swapColor)
+          cv::cvtColor(rgbTexture->cvImage, rgbTexture->cvImage, cv::COLOR_BGR2RGB);
+        rgbTexture->pipeline->run(rgbTexture, *flRegistrar, models, flChannel);
       }
-      catch (const rs2::error &e)
+
+      if (isDepthEnable && depthFrame)
       {
-        std::cerr << "RealSense error calling " << e.get_failed_function() << "(" << e.get_failed_args() << "):\n    " << e.what() << std::endl;
+        depthTexture->cvImage = frame_to_mat(depthFrame);
+        depthTexture->pipeline->run(depthTexture, *flRegistrar, models, flChannel);
+
+        depthData = (uint16_t *)(depthFrame.get_data());
       }
-      catch (const std::exception &e)
+
+      if (isIrEnable && irFrame)
       {
-        std::cerr << e.what() << std::endl;
-        videoStart = false;
-        break;
+        irTexture->cvImage = frame_to_mat(irFrame);
+        irTexture->pipeline->run(irTexture, *flRegistrar, models, flChannel);
       }
 
-      videoFeedProcessing = false;
+      if (enablePointCloud)
+      {
+        glfl->modelRsPointCloud->points = rsPointcloud.calculate(depthFrame);
+        rsPointcloud.map_to(rgbFrame);
+      }
     }
-    return 0;
+    catch (const rs2::error &e)
+    {
+      std::cerr << "RealSense error calling " << e.get_failed_function() << "(" << e.get_failed_args() << "):\n    " << e.what() << std::endl;
+    }
+    catch (const std::exception &e)
+    {
+      std::cerr << e.what() << std::endl;
+      videoStart = false;
+      mailbox.close();
+    }
+
+    return true;
+  }
+
+  void _closeVideoFeed()
+  {
+    mailbox.close();
   }
 
   static cv::Mat frame_to_mat(const rs2::frame &f)
@@ -408,17 +498,11 @@ private:
     const int w = vf.get_width();
     const int h = vf.get_height();
 
-    if (f.get_profile().format() == RS2_FORMAT_BGR8)
+    // Color stays in the order the device sends it, see `swapColor`
+    if (f.get_profile().format() == RS2_FORMAT_BGR8 || f.get_profile().format() == RS2_FORMAT_RGB8)
     {
       return Mat(Size(w, h), CV_8UC3, (void *)f.get_data(), Mat::AUTO_STEP);
     }
-    else if (f.get_profile().format() == RS2_FORMAT_RGB8)
-    {
-      auto r_rgb = Mat(Size(w, h), CV_8UC3, (void *)f.get_data(), Mat::AUTO_STEP);
-      Mat r_bgr;
-      cvtColor(r_rgb, r_bgr, COLOR_RGB2BGR);
-      return r_bgr;
-    }
     else if (f.get_profile().format() == RS2_FORMAT_Z16)
     {
       return Mat(Size(w, h), CV_16UC1, (void *)f.get_data(), Mat::AUTO_STEP);
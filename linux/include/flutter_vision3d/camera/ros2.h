@@ -41,8 +41,9 @@ public:
       if (pauseStream)
         return;
 
-      cv_bridge::toCvShare(img, "rgba8")->image.copyTo(rgbTexture->cvImage);
-      rgbTexture->pipeline->run(rgbTexture, *flRegistrar, models, flChannel);
+      cv::Mat frame;
+      cv_bridge::toCvShare(img, "rgba8")->image.copyTo(frame);
+      mailbox.push(std::move(frame));
     };
     subscriber = this->create_subscription<sensor_msgs::msg::Image>(serial, 10, callback);
   }
@@ -51,21 +52,29 @@ public:
 
   int openDevice() { return 0; }
 
-  int closeDevice() { return 0; }
+  int closeDevice()
+  {
+    stopVideoFeed();
+    return 0;
+  }
 
   int isConnected() { return 0; }
 
   int configVideoStream(int streamIndex, bool *enable)
   {
-    videoStart = *enable;
+    // Wakes a paused acquisition thread
+    if (!*enable)
+      stopVideoFeed();
+    else
+      videoStart = true;
+
     return 0;
   }
 
   int readVideoFeed()
   {
     videoStart = true;
-    std::thread t(&RosCamera::_readVideoFeed, this);
-    t.detach();
+    CameraRuntime::shared().start(this);
     return 0;
   }
 
@@ -90,12 +99,42 @@ public:
 private:
   int _readVideoFeed()
   {
-    while (videoStart)
+    mailbox.open();
+    executor.add_node(get_node_base_interface());
+    while (waitWhilePaused())
     {
-      rclcpp::spin_some(shared_from_this());
+      // Sleeps until a message arrives; `_closeVideoFeed` cancels the wait
+      executor.spin_once(std::chrono::milliseconds(100));
     }
+
+    executor.remove_node(get_node_base_interface());
+    mailbox.close();
     return 0;
   }
+
+  bool _processVideoFeed()
+  {
+    cv::Mat frame;
+    if (!mailbox.pop(frame))
+      return false;
+
+    if (pauseStream)
+      return true;
+
+    rgbTexture->cvImage = frame;
+    rgbTexture->pipeline->run(rgbTexture, *flRegistrar, models, flChannel);
+    return true;
+  }
+
+  void _closeVideoFeed()
+  {
+    executor.cancel();
+    mailbox.close();
+  }
+
   rclcpp::Subscription<sensor_msgs::msg::Image>::SharedPtr subscriber;
+  rclcpp::executors::SingleThreadedExecutor executor;
+  FrameMailbox<cv::Mat> mailbox{frameScheduling, [this]
+                                 { frameQueued(); }};
 };
 #endif
\ No newline at end of file
@@ -1,6 +1,9 @@
 #ifndef _DEF_UVC_CAM_
 #define _DEF_UVC_CAM_
+#include <algorithm>
+#include <chrono>
 #include <iostream>
+#include <thread>
 
 #include "fv_camera.h"
 
@@ -34,6 +37,7 @@ public:
 
   int closeDevice()
   {
+    stopVideoFeed();
     cap->release();
     return 0;
   }
@@ -48,6 +52,15 @@ public:
     if (!cap->isOpened())
       return -2;
 
+    // Capture at the size the pipeline resizes to first. The driver picks the nearest mode it has; if that is not
+    // the requested one the resize stage still runs.
+    StreamRequest request = rgbTexture->pipeline->streamRequest();
+    if (*enable && request.width > 0)
+    {
+      cap->set(cv::CAP_PROP_FRAME_WIDTH, request.width);
+      cap->set(cv::CAP_PROP_FRAME_HEIGHT, request.height);
+    }
+
     videoStart = *enable;
 
     return 0;
@@ -56,8 +69,7 @@ public:
   int readVideoFeed()
   {
     videoStart = true;
-    std::thread t(&UvcCam::_readVideoFeed, this);
-    t.detach();
+    CameraRuntime::shared().start(this);
     return 0;
   }
 
@@ -89,27 +101,66 @@ public:
   void loadPresetParameters(std::string &path) {}
 
 private:
+  // Consecutive failed reads before the loop gives up, e.g. the camera was unplugged
+  static constexpr int MAX_READ_FAILURES = 50;
+  static constexpr int MAX_RETRY_MS = 500;
+
   int uvcIndex = -1;
   cv::VideoCapture *cap;
+  FrameMailbox<cv::Mat> mailbox{frameScheduling, [this]
+                                 { frameQueued(); }};
+
   int _readVideoFeed()
   {
-    bool newFrame = false;
-
     if (!(videoStart))
       return -1;
 
-    while (videoStart)
+    mailbox.open();
+    int failures = 0;
+    while (waitWhilePaused())
     {
-      newFrame = cap->read(rgbTexture->cvImage);
-
-      if (newFrame)
+      // Queued frames own their buffer, read into a new one
+      cv::Mat frame;
+      if (!cap->read(frame))
       {
-        rgbTexture->pipeline->run(rgbTexture, *flRegistrar, models, flChannel);
-        fl_method_channel_invoke_method(flChannel, "onUvcFrame", nullptr, nullptr, nullptr, NULL);
+        if (++failures >= MAX_READ_FAILURES)
+        {
+          std::cerr << "[UVC] camera " << uvcIndex << " stopped delivering frames" << std::endl;
+          break;
+        }
+
+        // 10, 20, 40 ... ms, so a dead device does not spin the thread
+        std::this_thread::sleep_for(std::chrono::milliseconds(std::min(MAX_RETRY_MS, 10 << std::min(failures - 1, 6))));
+        continue;
       }
+
+      failures = 0;
+      if (!mailbox.push(std::move(frame)))
+        break;
     }
 
+    mailbox.close();
     return 0;
   }
+
+  bool _processVideoFeed()
+  {
+    cv::Mat frame;
+    if (!mailbox.pop(frame))
+      return false;
+
+    if (pauseStream)
+      return true;
+
+    rgbTexture->cvImage = frame;
+    rgbTexture->pipeline->run(rgbTexture, *flRegistrar, models, flChannel);
+    fl_method_channel_invoke_method(flChannel, "onUvcFrame", nullptr, nullptr, nullptr, NULL);
+    return true;
+  }
+
+  void _closeVideoFeed()
+  {
+    mailbox.close();
+  }
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,67 @@
+#ifndef _DEF_FV_STAGE_PLUGIN_
+#define _DEF_FV_STAGE_PLUGIN_
+
+/*
+ * C ABI of runtime loaded pipeline stages. A stage library exports `fvRegisterStages` and is loaded with
+ * `pipelinePluginLoad`; each stage it lists is added to a pipeline by name (`pluginStage`).
+ *
+ * - `init` is called once per pipeline stage with the raw parameters given to `pipelineAdd` and returns the stage
+ *   instance (NULL on error).
+ * - `process` is called per frame with a view of the frame's pixels. The pixels are borrowed for the call and may be
+ *   modified in place, but not resized. `result` is owned by the host and preallocated with the `resultCapacity`
+ *   floats the stage declared; set `result->size` to the number of floats written, 0 sends nothing to Dart.
+ *   Returns 0 on success.
+ * - `destroy` is called when the stage is removed from every pipeline.
+ *
+ * The host never unloads a library, so the descriptors must stay valid for the life of the process.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define FV_STAGE_ABI_VERSION 1
+#define FV_STAGE_ENTRY "fvRegisterStages"
+
+    typedef struct FvImageView
+    {
+        uint8_t *data;
+        int32_t width;
+        int32_t height;
+        int32_t channels;
+        // OpenCV depth code (CV_8U = 0, CV_16U = 2, CV_32F = 5, ...)
+        int32_t depth;
+        // Bytes per row
+        size_t stride;
+    } FvImageView;
+
+    typedef struct FvResultBuffer
+    {
+        float *data;
+        uint32_t capacity;
+        uint32_t size;
+    } FvResultBuffer;
+
+    typedef struct FvStageDesc
+    {
+        const char *name;
+        uint32_t resultCapacity;
+        void *(*init)(const uint8_t *params, uint32_t len);
+        int (*process)(void *instance, FvImageView *image, FvResultBuffer *result);
+        void (*destroy)(void *instance);
+    } FvStageDesc;
+
+    /*
+     * Entry point of a stage library. Set `*stages` to an array of `*count` descriptors.
+     * Returns 0 if the library supports `abiVersion`.
+     */
+    typedef int (*FvRegisterStagesFn)(uint32_t abiVersion, const FvStageDesc **stages, uint32_t *count);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
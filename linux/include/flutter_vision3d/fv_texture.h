@@ -1,7 +1,17 @@
 #ifndef _DEF_FV_TEXTURE_
 #define _DEF_FV_TEXTURE_
+#ifdef FV_HEADLESS
+#include "headless/flutter_linux.h"
+#else
 #include <flutter_linux/flutter_linux.h>
 #include <gtk/gtk.h>
+#endif
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <mutex>
+#include <new>
+#include <type_traits>
 #include <vector>
 #include <thread>
 
@@ -11,27 +21,147 @@
 
 #include "tflite.h"
 
+class Pipeline;
+class RegisterFile;
+struct StageRuntime;
+
+#ifndef FV_HEADLESS
 #define FV_TEXTURE_TYPE (fv_texture_get_type())
 #define FV_TEXTURE(obj) (G_TYPE_CHECK_INSTANCE_CAST(obj, FV_TEXTURE_TYPE, FvTexture))
 struct FvTextureClass
 {
   FlPixelBufferTextureClass parent_class;
 };
+#endif
+
+/**
+ * @brief One published frame of a texture
+ */
+struct TextureFrame
+{
+  std::vector<uint8_t> pixels{};
+  int32_t width = 0;
+  int32_t height = 0;
+};
 
-class Pipeline;
 struct FvTexture
 {
+#ifndef FV_HEADLESS
   FlPixelBufferTexture flPixelBufferTexture;
+#endif
   int64_t textureId = 0;
-  std::vector<uint8_t> buffer{};
-  int32_t video_width = 0;
-  int32_t video_height = 0;
   bool video_start = false;
   cv::Mat cvImage;
   Pipeline *pipeline;
   std::vector<TFLiteModel *> *models;
+  // Set on a pipeline worker's private texture: the texture `show` publishes to
+  FvTexture *owner = nullptr;
+  // Cleared by a `changeGate` stage when the current frame did not change. Gated stages are skipped then.
+  bool sceneChanged = true;
+  // Buffer the pipeline planned for the output of the running stage, see `stageOutput`
+  cv::Mat *output = nullptr;
+  // State of the running stage, see `stageRuntime`
+  StageRuntime *runtime = nullptr;
+  // Image registers of the camera, set by the pipeline (see `Pipeline::setRegisters`)
+  RegisterFile *registers = nullptr;
+
+  /*
+   * Triple buffer between the pipeline and the raster thread. `publishFrame` fills frames[back] and swaps it into
+   * `ready`; `frontFrame` swaps a freshly published frame out of `ready` into frames[front]. Each side only touches
+   * its own slot, so the raster thread reads a stable frame while the next one is written, and slot buffers are
+   * reused once the frame size is stable. Constructed in `fv_texture_init` for textures created with g_object_new.
+   */
+  static const uint8_t FRAME_FRESH = 0x4;
+  TextureFrame frames[3];
+  uint8_t back = 0;
+  uint8_t front = 1;
+  // Slot index of the last published frame, with FRAME_FRESH until `frontFrame` takes it
+  std::atomic<uint8_t> ready{2};
+  // Serializes publishers, e.g. `show` stages of two segments of the pipeline
+  std::mutex publishMutex;
+
+  /*
+   * Size and rate the texture is displayed at, set from Dart when the widget changes (`setDisplaySize`). `show`
+   * downscales into the back buffer and skips frames that come sooner than the display can show them. 0: image size,
+   * every frame. Processing still runs on the full image.
+   */
+  std::atomic<int32_t> displayWidth{0};
+  std::atomic<int32_t> displayHeight{0};
+  std::atomic<int64_t> publishIntervalNs{0};
+  std::atomic<int64_t> lastPublishNs{0};
+  // Pixels of the downscaled image being published, under publishMutex
+  std::vector<uint8_t> displayPixels{};
+
+  void setDisplaySize(int width, int height, double maxFps)
+  {
+    displayWidth = std::max(0, width);
+    displayHeight = std::max(0, height);
+    publishIntervalNs = maxFps > 0 ? (int64_t)(1e9 / maxFps) : 0;
+  }
+
+  /**
+   * @brief Size `image` is published at: fit into the display size, aspect ratio kept, never upscaled
+   */
+  cv::Size displaySize(const cv::Size &image) const
+  {
+    int w = displayWidth, h = displayHeight;
+    if (w <= 0 || h <= 0 || (image.width <= w && image.height <= h))
+      return image;
+
+    double scale = std::min((double)w / image.width, (double)h / image.height);
+    return cv::Size(std::max(1, (int)std::lround(image.width * scale)), std::max(1, (int)std::lround(image.height * scale)));
+  }
+
+  /**
+   * @brief Claim the next publish slot. Frames up to 1/8 interval early still count, so a camera at the display rate
+   * does not lose frames to jitter.
+   *
+   * @return false if the last frame was published less than an interval ago
+   */
+  bool publishDue(int64_t nowNs)
+  {
+    int64_t interval = publishIntervalNs;
+    if (interval == 0)
+      return true;
+
+    int64_t last = lastPublishNs;
+    if (nowNs - last < interval - interval / 8)
+      return false;
+
+    return lastPublishNs.compare_exchange_strong(last, nowNs);
+  }
+
+  /**
+   * @brief Fill the back buffer with a `width` x `height` RGBA frame and publish it
+   *
+   * @param fill called with the back buffer's pixels
+   */
+  template <typename Fill>
+  void publishFrame(int width, int height, Fill fill)
+  {
+    std::lock_guard<std::mutex> lock(publishMutex);
+    TextureFrame &frame = frames[back];
+    frame.width = width;
+    frame.height = height;
+    frame.pixels.resize((size_t)width * height * 4);
+    fill(frame.pixels.data());
+
+    back = ready.exchange(back | FRAME_FRESH, std::memory_order_acq_rel) & ~FRAME_FRESH;
+  }
+
+  /**
+   * @brief Latest published frame. Raster thread only; valid until the next call.
+   */
+  const TextureFrame &frontFrame()
+  {
+    if ((ready.load(std::memory_order_acquire) & FRAME_FRESH) != 0)
+      front = ready.exchange(front, std::memory_order_acq_rel) & ~FRAME_FRESH;
+
+    return frames[front];
+  }
 };
 
+#ifndef FV_HEADLESS
 G_DEFINE_TYPE(FvTexture,
               fv_texture,
               fl_pixel_buffer_texture_get_type())
@@ -43,20 +173,69 @@ static gboolean fv_texture_copy_pixels(
     uint32_t *height,
     GError **error)
 {
-  *out_buffer = FV_TEXTURE(texture)->buffer.data();
-  *width = FV_TEXTURE(texture)->video_width;
-  *height = FV_TEXTURE(texture)->video_height;
+  const TextureFrame &frame = FV_TEXTURE(texture)->frontFrame();
+  *out_buffer = frame.pixels.data();
+  *width = frame.width;
+  *height = frame.height;
 
   return TRUE;
 }
 
+static void fv_texture_finalize(GObject *object)
+{
+  FvTexture *self = FV_TEXTURE(object);
+  auto destroy = [](auto &member)
+  {
+    using T = std::decay_t<decltype(member)>;
+    member.~T();
+  };
+
+  destroy(self->cvImage);
+  for (TextureFrame &frame : self->frames)
+    destroy(frame);
+  destroy(self->ready);
+  destroy(self->publishMutex);
+  destroy(self->displayWidth);
+  destroy(self->displayHeight);
+  destroy(self->publishIntervalNs);
+  destroy(self->lastPublishNs);
+  destroy(self->displayPixels);
+
+  G_OBJECT_CLASS(fv_texture_parent_class)->finalize(object);
+}
+
 static void fv_texture_class_init(
     FvTextureClass *klass)
 {
   FL_PIXEL_BUFFER_TEXTURE_CLASS(klass)->copy_pixels = fv_texture_copy_pixels;
+  G_OBJECT_CLASS(klass)->finalize = fv_texture_finalize;
 }
 
 static void fv_texture_init(FvTexture *self)
 {
+  // g_object_new only zero-fills the instance: construct the C++ members in place, `fv_texture_finalize` destroys them
+  new (&self->cvImage) cv::Mat();
+  for (TextureFrame &frame : self->frames)
+    new (&frame) TextureFrame();
+  new (&self->ready) std::atomic<uint8_t>(2);
+  new (&self->publishMutex) std::mutex();
+  new (&self->displayWidth) std::atomic<int32_t>(0);
+  new (&self->displayHeight) std::atomic<int32_t>(0);
+  new (&self->publishIntervalNs) std::atomic<int64_t>(0);
+  new (&self->lastPublishNs) std::atomic<int64_t>(0);
+  new (&self->displayPixels) std::vector<uint8_t>();
+
+  self->textureId = 0;
+  self->video_start = false;
+  self->pipeline = nullptr;
+  self->models = nullptr;
+  self->owner = nullptr;
+  self->sceneChanged = true;
+  self->output = nullptr;
+  self->runtime = nullptr;
+  self->registers = nullptr;
+  self->back = 0;
+  self->front = 1;
 }
-#endif
\ No newline at end of file
+#endif
+#endif
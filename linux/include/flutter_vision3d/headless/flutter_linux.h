@@ -0,0 +1,36 @@
+#ifndef _DEF_HEADLESS_FLUTTER_LINUX_
+#define _DEF_HEADLESS_FLUTTER_LINUX_
+
+/*
+ * Stand-ins for the part of the Flutter Linux embedder API the pipeline uses, for tools built with FV_HEADLESS
+ * (benchmark, offline runner). Textures and method channels exist only as opaque handles; publishing a texture frame
+ * and invoking a method do nothing, and no FlValue is ever allocated.
+ */
+
+#include <cstddef>
+#include <cstdint>
+
+struct FlTextureRegistrar
+{
+};
+
+struct FlMethodChannel
+{
+};
+
+struct FlValue;
+
+#define FL_TEXTURE(obj) (obj)
+#define g_autoptr(T) T *
+
+inline void fl_texture_registrar_mark_texture_frame_available(FlTextureRegistrar *, void *) {}
+inline void fl_method_channel_invoke_method(FlMethodChannel *, const char *, FlValue *, void *, void *, void *) {}
+
+inline FlValue *fl_value_new_int(int64_t) { return nullptr; }
+inline FlValue *fl_value_new_string(const char *) { return nullptr; }
+inline FlValue *fl_value_new_float32_list(const float *, size_t) { return nullptr; }
+inline FlValue *fl_value_new_list() { return nullptr; }
+inline FlValue *fl_value_new_map() { return nullptr; }
+inline void fl_value_append_take(FlValue *, FlValue *) {}
+inline void fl_value_set_string_take(FlValue *, const char *, FlValue *) {}
+#endif
@@ -109,7 +109,9 @@ public:
         // gdk_gl_context_make_current(gdkContext);
         auto frame = rgbFrame->as<rs2::video_frame>();
         glBindTexture(GL_TEXTURE_2D, TEXTURE);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, frame.get_width(), frame.get_height(), 0, GL_RGB, GL_UNSIGNED_BYTE, frame.get_data());
+        // The negotiated color profile may be either order
+        GLenum format = frame.get_profile().format() == RS2_FORMAT_BGR8 ? GL_BGR : GL_RGB;
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, frame.get_width(), frame.get_height(), 0, format, GL_UNSIGNED_BYTE, frame.get_data());
     }
 
     void render(Camera *cam)
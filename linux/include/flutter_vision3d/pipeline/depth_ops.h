@@ -0,0 +1,227 @@
+#ifndef _DEF_DEPTH_OPS_
+#define _DEF_DEPTH_OPS_
+
+#include <opencv2/core/core.hpp>
+#include <cstdint>
+#include <stdexcept>
+#include "pixel_convert.h"
+
+/**
+ * @brief Single pass operators on Z16 depth (CV_16UC1, millimeters, 0 = no depth).
+ *
+ * A pixel is in range if min <= d <= max and d != 0. Holes are never in range and never masked, whatever the range.
+ * Kernels are picked like `PixelConvert::kernels()`: AVX2 or SSE2 at runtime on x86, NEON on ARM.
+ */
+namespace DepthOps
+{
+    typedef void (*ClipRow)(const uint16_t *src, uint16_t *dst, int n, uint16_t min, uint16_t max);
+    typedef void (*MaskRow)(const uint16_t *src, uint8_t *dst, int n, uint16_t min, uint16_t max, bool invert);
+
+    struct Kernels
+    {
+        const char *isa;
+        ClipRow clip;
+        MaskRow mask;
+    };
+
+    inline void clipScalar(const uint16_t *s, uint16_t *d, int i, int n, uint16_t min, uint16_t max)
+    {
+        for (; i < n; i++)
+            d[i] = s[i] >= min && s[i] <= max ? s[i] : 0;
+    }
+
+    inline void maskScalar(const uint16_t *s, uint8_t *d, int i, int n, uint16_t min, uint16_t max, bool invert)
+    {
+        for (; i < n; i++)
+        {
+            bool in = s[i] >= min && s[i] <= max;
+            d[i] = s[i] != 0 && in != invert ? 255 : 0;
+        }
+    }
+
+    inline void clipPlain(const uint16_t *s, uint16_t *d, int n, uint16_t min, uint16_t max) { clipScalar(s, d, 0, n, min, max); }
+    inline void maskPlain(const uint16_t *s, uint8_t *d, int n, uint16_t min, uint16_t max, bool invert) { maskScalar(s, d, 0, n, min, max, invert); }
+
+#ifdef FV_PIXEL_X86
+    /*
+     * SSE2 has no unsigned 16 bit compare: d >= min and d <= max are saturating subtractions that come out 0.
+     */
+    FV_TARGET("sse2")
+    inline __m128i inRangeSse2(__m128i v, __m128i min, __m128i max)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        return _mm_and_si128(_mm_cmpeq_epi16(_mm_subs_epu16(v, max), zero), _mm_cmpeq_epi16(_mm_subs_epu16(min, v), zero));
+    }
+
+    FV_TARGET("sse2")
+    inline void clipSse2(const uint16_t *s, uint16_t *d, int n, uint16_t min, uint16_t max)
+    {
+        const __m128i vmin = _mm_set1_epi16((short)min), vmax = _mm_set1_epi16((short)max);
+        int i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+            _mm_storeu_si128((__m128i *)(d + i), _mm_and_si128(v, inRangeSse2(v, vmin, vmax)));
+        }
+
+        clipScalar(s, d, i, n, min, max);
+    }
+
+    FV_TARGET("sse2")
+    inline __m128i mask8Sse2(__m128i v, __m128i min, __m128i max, bool invert)
+    {
+        __m128i hole = _mm_cmpeq_epi16(v, _mm_setzero_si128());
+        __m128i in = inRangeSse2(v, min, max);
+        // Not a hole and (in range xor invert)
+        return _mm_andnot_si128(hole, invert ? _mm_xor_si128(in, _mm_set1_epi16(-1)) : in);
+    }
+
+    FV_TARGET("sse2")
+    inline void maskSse2(const uint16_t *s, uint8_t *d, int n, uint16_t min, uint16_t max, bool invert)
+    {
+        const __m128i vmin = _mm_set1_epi16((short)min), vmax = _mm_set1_epi16((short)max);
+        int i = 0;
+        for (; i + 16 <= n; i += 16)
+        {
+            __m128i a = mask8Sse2(_mm_loadu_si128((const __m128i *)(s + i)), vmin, vmax, invert);
+            __m128i b = mask8Sse2(_mm_loadu_si128((const __m128i *)(s + i + 8)), vmin, vmax, invert);
+            // 0xffff and 0 pack to 0xff and 0
+            _mm_storeu_si128((__m128i *)(d + i), _mm_packs_epi16(a, b));
+        }
+
+        maskScalar(s, d, i, n, min, max, invert);
+    }
+
+    FV_TARGET("avx2")
+    inline __m256i mask16Avx2(__m256i v, __m256i min, __m256i max, bool invert)
+    {
+        __m256i hole = _mm256_cmpeq_epi16(v, _mm256_setzero_si256());
+        __m256i in = _mm256_and_si256(_mm256_cmpeq_epi16(_mm256_max_epu16(v, min), v), _mm256_cmpeq_epi16(_mm256_min_epu16(v, max), v));
+        return _mm256_andnot_si256(hole, invert ? _mm256_xor_si256(in, _mm256_set1_epi16(-1)) : in);
+    }
+
+    FV_TARGET("avx2")
+    inline void clipAvx2(const uint16_t *s, uint16_t *d, int n, uint16_t min, uint16_t max)
+    {
+        const __m256i vmin = _mm256_set1_epi16((short)min), vmax = _mm256_set1_epi16((short)max);
+        int i = 0;
+        for (; i + 16 <= n; i += 16)
+        {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+            __m256i in = _mm256_and_si256(_mm256_cmpeq_epi16(_mm256_max_epu16(v, vmin), v), _mm256_cmpeq_epi16(_mm256_min_epu16(v, vmax), v));
+            _mm256_storeu_si256((__m256i *)(d + i), _mm256_and_si256(v, in));
+        }
+
+        clipScalar(s, d, i, n, min, max);
+    }
+
+    FV_TARGET("avx2")
+    inline void maskAvx2(const uint16_t *s, uint8_t *d, int n, uint16_t min, uint16_t max, bool invert)
+    {
+        const __m256i vmin = _mm256_set1_epi16((short)min), vmax = _mm256_set1_epi16((short)max);
+        int i = 0;
+        for (; i + 32 <= n; i += 32)
+        {
+            __m256i a = mask16Avx2(_mm256_loadu_si256((const __m256i *)(s + i)), vmin, vmax, invert);
+            __m256i b = mask16Avx2(_mm256_loadu_si256((const __m256i *)(s + i + 16)), vmin, vmax, invert);
+            // packs interleaves the lanes of a and b, the permute puts the pixels back in order
+            _mm256_storeu_si256((__m256i *)(d + i), _mm256_permute4x64_epi64(_mm256_packs_epi16(a, b), 0xd8));
+        }
+
+        maskScalar(s, d, i, n, min, max, invert);
+    }
+#endif
+
+#ifdef FV_PIXEL_NEON
+    inline void clipNeon(const uint16_t *s, uint16_t *d, int n, uint16_t min, uint16_t max)
+    {
+        const uint16x8_t vmin = vdupq_n_u16(min), vmax = vdupq_n_u16(max);
+        int i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            uint16x8_t v = vld1q_u16(s + i);
+            vst1q_u16(d + i, vandq_u16(v, vandq_u16(vcgeq_u16(v, vmin), vcleq_u16(v, vmax))));
+        }
+
+        clipScalar(s, d, i, n, min, max);
+    }
+
+    inline void maskNeon(const uint16_t *s, uint8_t *d, int n, uint16_t min, uint16_t max, bool invert)
+    {
+        const uint16x8_t vmin = vdupq_n_u16(min), vmax = vdupq_n_u16(max);
+        int i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            uint16x8_t v = vld1q_u16(s + i);
+            uint16x8_t in = vandq_u16(vcgeq_u16(v, vmin), vcleq_u16(v, vmax));
+            if (invert)
+                in = vmvnq_u16(in);
+            vst1_u8(d + i, vmovn_u16(vandq_u16(in, vtstq_u16(v, v))));
+        }
+
+        maskScalar(s, d, i, n, min, max, invert);
+    }
+#endif
+
+    inline Kernels selectKernels()
+    {
+#if defined(FV_PIXEL_X86)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            return {"avx2", clipAvx2, maskAvx2};
+
+        if (__builtin_cpu_supports("sse2"))
+            return {"sse2", clipSse2, maskSse2};
+#elif defined(FV_PIXEL_NEON)
+        return {"neon", clipNeon, maskNeon};
+#endif
+        return {"scalar", clipPlain, maskPlain};
+    }
+
+    inline const Kernels &kernels()
+    {
+        static const Kernels k = selectKernels();
+        return k;
+    }
+
+    inline void requireDepth(const cv::Mat &m)
+    {
+        if (m.type() != CV_16UC1)
+            throw std::runtime_error("needs a 16-bit depth image, got type " + std::to_string(m.type()));
+    }
+
+    /**
+     * @brief Set depth outside [min, max] to 0, in place
+     */
+    inline void clip(cv::Mat &m, uint16_t min, uint16_t max)
+    {
+        requireDepth(m);
+        const Kernels &k = kernels();
+        for (int y = 0; y < m.rows; y++)
+            k.clip(m.ptr<uint16_t>(y), m.ptr<uint16_t>(y), m.cols, min, max);
+    }
+
+    /**
+     * @brief 8-bit mask of the pixels in [min, max], or with `invert` of the pixels nearer or farther
+     */
+    inline void mask(const cv::Mat &src, cv::Mat &dst, uint16_t min, uint16_t max, bool invert)
+    {
+        requireDepth(src);
+        dst.create(src.size(), CV_8UC1);
+        const Kernels &k = kernels();
+        for (int y = 0; y < src.rows; y++)
+            k.mask(src.ptr<uint16_t>(y), dst.ptr<uint8_t>(y), src.cols, min, max, invert);
+    }
+
+    /**
+     * @brief RGBA (CV_8UC4) of `src` through a `PixelConvert::makeDepthLut` table
+     */
+    inline void colorize(const cv::Mat &src, cv::Mat &dst, const uint32_t *lut)
+    {
+        requireDepth(src);
+        dst.create(src.size(), CV_8UC4);
+        for (int y = 0; y < src.rows; y++)
+            PixelConvert::depthRow(src.ptr<uint16_t>(y), dst.ptr<uint8_t>(y), lut, src.cols);
+    }
+}
+#endif
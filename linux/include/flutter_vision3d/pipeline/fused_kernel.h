@@ -0,0 +1,459 @@
+#ifndef _DEF_FUSED_KERNEL_
+#define _DEF_FUSED_KERNEL_
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <array>
+#include <cfloat>
+#include <climits>
+#include <cmath>
+#include <mutex>
+#include <vector>
+#include "pipeline_params.h"
+
+/**
+ * @brief One-pass replacement for a run of consecutive elementwise stages (convertTo, cvNormalized, cvThreshold,
+ * relu).
+ *
+ * Every pixel is read and written once and no intermediate Mat is allocated. Each step saturates to its output depth
+ * like the OpenCV call it replaces. 8U/16U inputs are compiled to a lookup table over the input range, built once
+ * with the kernel; other depths evaluate the chain per pixel. A `cvNormalized` step needs statistics of its input,
+ * which cost one extra read pass (a histogram for 8U/16U inputs) and a table rebuilt every frame into buffers the
+ * kernel keeps.
+ */
+class FusedKernel
+{
+public:
+    static const size_t MAX_OPS = 16;
+
+    FusedKernel(const std::vector<StageParams> &params) : ops(params)
+    {
+        // Without a normalize step the table only depends on the input depth
+        tables[0] = compile(CV_8U);
+        tables[1] = compile(CV_16U);
+    }
+
+    /**
+     * @brief Whether a stage with these parameters can be part of a fused run
+     */
+    static bool fusable(const StageParams &params)
+    {
+        if (std::holds_alternative<ConvertToParams>(params) || std::holds_alternative<ReluParams>(params))
+            return true;
+
+        // OTSU and TRIANGLE compute the threshold from the image
+        if (const ThresholdParams *p = std::get_if<ThresholdParams>(&params))
+            return p->type >= cv::THRESH_BINARY && p->type <= cv::THRESH_TOZERO_INV;
+
+        if (const NormalizeParams *p = std::get_if<NormalizeParams>(&params))
+            return p->normType == cv::NORM_MINMAX || p->normType == cv::NORM_INF || p->normType == cv::NORM_L1 || p->normType == cv::NORM_L2;
+
+        return false;
+    }
+
+    /**
+     * @brief Apply the chain to `image`, in place when the output type matches
+     *
+     * @return false if the chain does not support the image type (e.g. `relu` on a non 8UC1 image). The image is
+     * untouched and the stages must run one by one.
+     */
+    bool apply(cv::Mat &image) const
+    {
+        if (image.empty())
+            return false;
+
+        Plan plan;
+        if (!resolve(image.depth(), image.channels(), plan))
+            return false;
+
+        int range = lutRange(image.depth());
+        if (range > 0 && plan.normalizeAt < 0)
+        {
+            applyTable(plan, tables[range == 256 ? 0 : 1], image);
+            return true;
+        }
+
+        // Frames of one pipeline run one at a time; a concurrent caller (a branch sharing the stage) gets its own
+        // buffers rather than waiting
+        std::unique_lock<std::mutex> lock(scratchMutex, std::try_to_lock);
+        Scratch local;
+        Scratch &buffers = lock.owns_lock() ? scratch : local;
+
+        if (plan.normalizeAt >= 0)
+            resolveNormalize(image, plan, buffers.histogram);
+
+        if (range > 0)
+        {
+            buffers.lut.create(1, range, CV_MAKETYPE(plan.outDepth, 1));
+            fillLut(plan, buffers.lut, range);
+            applyTable(plan, buffers.lut, image);
+        }
+        else
+        {
+            cv::Mat src = image;
+            image.create(src.size(), CV_MAKETYPE(plan.outDepth, image.channels()));
+            withDepth(src.depth(), [&](auto in)
+                      { withDepth(plan.outDepth, [&](auto out)
+                                  { evaluateRows<decltype(in), decltype(out)>(plan, src, image); }); });
+        }
+
+        return true;
+    }
+
+private:
+    enum Kind
+    {
+        ConvertTo,
+        Normalize,
+        Threshold,
+        Relu,
+    };
+
+    struct Step
+    {
+        Kind kind;
+        int outDepth;
+        double a = 1.0;
+        double b = 0.0;
+        double thresh = 0.0;
+        double maxval = 0.0;
+        int type = 0;
+    };
+
+    // Steps resolved for one frame's input type
+    struct Plan
+    {
+        std::array<Step, MAX_OPS> steps;
+        size_t count = 0;
+        int normalizeAt = -1;
+        int outDepth = CV_8U;
+    };
+
+    // Normalize statistics and the table built from them, reused across frames
+    struct Scratch
+    {
+        std::vector<uint32_t> histogram;
+        cv::Mat lut;
+    };
+
+    std::vector<StageParams> ops;
+    // Tables of chains without a normalize step for 8U and 16U inputs, empty if the chain does not support the depth
+    cv::Mat tables[2];
+    mutable std::mutex scratchMutex;
+    mutable Scratch scratch;
+
+    static bool isInteger(int depth)
+    {
+        return depth < CV_32F;
+    }
+
+    static double clampRound(double v, double lo, double hi)
+    {
+        double r = std::nearbyint(v);
+        return r < lo ? lo : (r > hi ? hi : r);
+    }
+
+    static double saturate(double v, int depth)
+    {
+        switch (depth)
+        {
+        case CV_8U:
+            return clampRound(v, 0, UCHAR_MAX);
+        case CV_8S:
+            return clampRound(v, SCHAR_MIN, SCHAR_MAX);
+        case CV_16U:
+            return clampRound(v, 0, USHRT_MAX);
+        case CV_16S:
+            return clampRound(v, SHRT_MIN, SHRT_MAX);
+        case CV_32S:
+            return clampRound(v, INT_MIN, INT_MAX);
+        case CV_32F:
+            return (float)v;
+        default:
+            return v;
+        }
+    }
+
+    template <typename Fn>
+    static bool withDepth(int depth, Fn fn)
+    {
+        switch (depth)
+        {
+        case CV_8U:
+            fn(uchar());
+            return true;
+        case CV_8S:
+            fn(schar());
+            return true;
+        case CV_16U:
+            fn(ushort());
+            return true;
+        case CV_16S:
+            fn(short());
+            return true;
+        case CV_32S:
+            fn(int());
+            return true;
+        case CV_32F:
+            fn(float());
+            return true;
+        case CV_64F:
+            fn(double());
+            return true;
+        }
+
+        return false;
+    }
+
+    static int lutRange(int depth)
+    {
+        return depth == CV_8U ? 256 : (depth == CV_16U ? 65536 : 0);
+    }
+
+    cv::Mat compile(int depth) const
+    {
+        Plan plan;
+        cv::Mat lut;
+        if (!resolve(depth, 1, plan) || plan.normalizeAt >= 0)
+            return lut;
+
+        lut.create(1, lutRange(depth), CV_MAKETYPE(plan.outDepth, 1));
+        fillLut(plan, lut, lutRange(depth));
+        return lut;
+    }
+
+    /**
+     * @brief Output depth and constants of every step for an input of this type. Normalize factors are filled later.
+     */
+    bool resolve(int depth, int channels, Plan &plan) const
+    {
+        if (ops.size() > MAX_OPS)
+            return false;
+
+        for (const StageParams &params : ops)
+        {
+            Step &s = plan.steps[plan.count];
+            if (const ConvertToParams *p = std::get_if<ConvertToParams>(&params))
+            {
+                s.kind = ConvertTo;
+                s.outDepth = p->rtype < 0 ? depth : CV_MAT_DEPTH(p->rtype);
+                s.a = p->scale;
+                s.b = p->shift;
+            }
+            else if (const NormalizeParams *p = std::get_if<NormalizeParams>(&params))
+            {
+                // Only one reduction pass per frame
+                if (plan.normalizeAt >= 0)
+                    return false;
+
+                plan.normalizeAt = plan.count;
+                s.kind = Normalize;
+                s.outDepth = p->dType < 0 ? depth : CV_MAT_DEPTH(p->dType);
+            }
+            else if (const ThresholdParams *p = std::get_if<ThresholdParams>(&params))
+            {
+                if (depth != CV_8U && depth != CV_16U && depth != CV_16S && depth != CV_32F && depth != CV_64F)
+                    return false;
+
+                s.kind = Threshold;
+                s.outDepth = depth;
+                s.type = p->type;
+                // Integer images compare against floor(threshold), like cv::threshold
+                s.thresh = isInteger(depth) ? std::floor(p->threshold) : saturate(p->threshold, depth);
+                s.maxval = saturate(p->max, depth);
+            }
+            else if (const ReluParams *p = std::get_if<ReluParams>(&params))
+            {
+                // PipelineFuncOpencvRelu walks `cols` bytes per row
+                if (depth != CV_8U || channels != 1)
+                    return false;
+
+                s.kind = Relu;
+                s.outDepth = CV_8U;
+                s.thresh = p->threshold;
+            }
+            else
+                return false;
+
+            depth = s.outDepth;
+            plan.count++;
+        }
+
+        plan.outDepth = depth;
+        return true;
+    }
+
+    static double evaluate(const Plan &plan, double v, size_t from, size_t to)
+    {
+        for (size_t i = from; i < to; i++)
+        {
+            const Step &s = plan.steps[i];
+            switch (s.kind)
+            {
+            case ConvertTo:
+            case Normalize:
+                v = saturate(v * s.a + s.b, s.outDepth);
+                break;
+            case Threshold:
+                switch (s.type)
+                {
+                case cv::THRESH_BINARY:
+                    v = v > s.thresh ? s.maxval : 0;
+                    break;
+                case cv::THRESH_BINARY_INV:
+                    v = v > s.thresh ? 0 : s.maxval;
+                    break;
+                case cv::THRESH_TRUNC:
+                    v = saturate(v > s.thresh ? s.thresh : v, s.outDepth);
+                    break;
+                case cv::THRESH_TOZERO:
+                    v = v > s.thresh ? v : 0;
+                    break;
+                case cv::THRESH_TOZERO_INV:
+                    v = v > s.thresh ? 0 : v;
+                    break;
+                }
+                break;
+            case Relu:
+                v = v < s.thresh ? 0 : v;
+                break;
+            }
+        }
+
+        return v;
+    }
+
+    struct Moments
+    {
+        double min = DBL_MAX;
+        double max = -DBL_MAX;
+        double sumAbs = 0;
+        double sumSq = 0;
+        double maxAbs = 0;
+
+        void add(double v, double count)
+        {
+            min = std::min(min, v);
+            max = std::max(max, v);
+            sumAbs += std::abs(v) * count;
+            sumSq += v * v * count;
+            maxAbs = std::max(maxAbs, std::abs(v));
+        }
+    };
+
+    /**
+     * @brief Scale and shift of the normalize step from the distribution of its input, as cv::normalize computes them
+     */
+    void resolveNormalize(const cv::Mat &image, Plan &plan, std::vector<uint32_t> &histogram) const
+    {
+        size_t at = plan.normalizeAt;
+        Moments m;
+        int depth = image.depth();
+
+        if (depth == CV_8U || depth == CV_16U)
+        {
+            // Each distinct input value is evaluated once
+            histogram.assign(lutRange(depth), 0);
+            withDepth(depth, [&](auto in)
+                      {
+                using T = decltype(in);
+                size_t n = image.cols * image.channels();
+                for (int r = 0; r < image.rows; r++)
+                {
+                    const T *p = image.ptr<T>(r);
+                    for (size_t c = 0; c < n; c++)
+                        histogram[p[c]]++;
+                } });
+
+            for (size_t v = 0; v < histogram.size(); v++)
+            {
+                if (histogram[v] > 0)
+                    m.add(evaluate(plan, v, 0, at), histogram[v]);
+            }
+        }
+        else
+        {
+            withDepth(depth, [&](auto in)
+                      {
+                using T = decltype(in);
+                size_t n = image.cols * image.channels();
+                for (int r = 0; r < image.rows; r++)
+                {
+                    const T *p = image.ptr<T>(r);
+                    for (size_t c = 0; c < n; c++)
+                        m.add(evaluate(plan, p[c], 0, at), 1);
+                } });
+        }
+
+        const NormalizeParams &p = std::get<NormalizeParams>(ops[at]);
+        Step &s = plan.steps[at];
+        if (p.normType == cv::NORM_MINMAX)
+        {
+            double dmin = std::min(p.alpha, p.beta), dmax = std::max(p.alpha, p.beta);
+            s.a = (dmax - dmin) * (m.max - m.min > DBL_EPSILON ? 1.0 / (m.max - m.min) : 0);
+            s.b = dmin - m.min * s.a;
+        }
+        else
+        {
+            double norm = p.normType == cv::NORM_INF ? m.maxAbs : (p.normType == cv::NORM_L1 ? m.sumAbs : std::sqrt(m.sumSq));
+            s.a = norm > DBL_EPSILON ? p.alpha / norm : 0;
+            s.b = 0;
+        }
+    }
+
+    static void fillLut(const Plan &plan, cv::Mat &lut, int range)
+    {
+        withDepth(plan.outDepth, [&](auto out)
+                  {
+            using T = decltype(out);
+            T *p = lut.ptr<T>(0);
+            for (int v = 0; v < range; v++)
+                p[v] = (T)evaluate(plan, v, 0, plan.count); });
+    }
+
+    static void applyTable(const Plan &plan, const cv::Mat &lut, cv::Mat &image)
+    {
+        cv::Mat src = image;
+        if (src.depth() == CV_8U)
+        {
+            cv::LUT(src, lut, image);
+            return;
+        }
+
+        image.create(src.size(), CV_MAKETYPE(plan.outDepth, src.channels()));
+        withDepth(plan.outDepth, [&](auto out)
+                  { applyLut<ushort, decltype(out)>(src, lut, image); });
+    }
+
+    template <typename TI, typename TO>
+    static void applyLut(const cv::Mat &src, const cv::Mat &lut, cv::Mat &dst)
+    {
+        const TO *table = lut.ptr<TO>(0);
+        size_t n = src.cols * src.channels();
+        cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range &rows)
+                          {
+            for (int r = rows.start; r < rows.end; r++)
+            {
+                const TI *in = src.ptr<TI>(r);
+                TO *out = dst.ptr<TO>(r);
+                for (size_t c = 0; c < n; c++)
+                    out[c] = table[in[c]];
+            } });
+    }
+
+    template <typename TI, typename TO>
+    static void evaluateRows(const Plan &plan, const cv::Mat &src, cv::Mat &dst)
+    {
+        size_t n = src.cols * src.channels();
+        cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range &rows)
+                          {
+            for (int r = rows.start; r < rows.end; r++)
+            {
+                const TI *in = src.ptr<TI>(r);
+                TO *out = dst.ptr<TO>(r);
+                for (size_t c = 0; c < n; c++)
+                    out[c] = (TO)evaluate(plan, in[c], 0, plan.count);
+            } });
+    }
+};
+#endif
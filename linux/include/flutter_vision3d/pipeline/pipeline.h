@@ -1,169 +1,367 @@
 #ifndef _DEF_PIPELINE_
 #define _DEF_PIPELINE_
 
+#ifdef FV_HEADLESS
+#include "../headless/flutter_linux.h"
+#else
 #include <flutter_linux/flutter_linux.h>
+#endif
 #include <opencv2/core/core.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/highgui/highgui.hpp>
 #include <vector>
 #include <iostream>
 #include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include "../fv_texture.h"
 
-#include <sys/time.h>
-void getCurrentTime(int64_t *timer)
-{
-    struct timeval now
-    {
-    };
-
-    gettimeofday(&now, nullptr);
-    *timer = (now.tv_sec * 1000) + now.tv_usec / 1000;
-}
-
 #include "../tflite.h"
+#include "../tflite_batch.h"
 #include "flutter_vision3d_handler.h"
+#include "pipeline_stats.h"
+#include "pipeline_params.h"
+#include "stage_runtime.h"
+#include "depth_ops.h"
+#include "pipeline_plan.h"
+#include "pipeline_schema.h"
+#include "pipeline_checkpoint.h"
+#include "spsc_queue.h"
+#include "worker_pool.h"
+#include "fused_kernel.h"
+#include "stage_schedule.h"
+
+/**
+ * @brief Mutable data of one pipeline stage, shared by every snapshot that contains the stage
+ */
+struct StageState
+{
+    StageStats stats;
+    ScheduleState schedule;
+    std::atomic<bool> finished{false};
+    // Image of the branch started by this stage (`branch` stages only)
+    FvTexture branchTexture{};
+    // Built by the stage's `init`, nullptr if it has none. Replaced (atomic_store) when an edit needs a new one.
+    std::shared_ptr<StageRuntime> runtime = nullptr;
+};
+
+/**
+ * @brief Whether a stage may write into the pixels of its input image. Branches clone a shared image before such a
+ * stage (copy-on-write).
+ */
+enum class StageAccess
+{
+    Read,
+    Write,
+    // Writes a new image, into the buffer the plan reserved for it (`stageOutput`). Never touches its input.
+    Replace,
+};
 
 struct FuncDef
 {
     unsigned int index;
     const char *name;
     int interval = 0;
-    int64_t timer = 0;
-    // TODO: function parameter definition should be relaxable
-    void (*func)(FvTexture *, std::vector<uint8_t> params, FlTextureRegistrar &, std::vector<TFLiteModel *> *, FlMethodChannel *);
-    std::vector<uint8_t> params = {};
+    void (*func)(FvTexture *, const StageParams &params, FlTextureRegistrar &, std::vector<TFLiteModel *> *, FlMethodChannel *);
+    ParamDecoder decode;
+    // Space separated `name:type` fields of the raw parameters, see pipeline_schema.h
+    const char *schema = "";
+    StageAccess access = StageAccess::Read;
+    // Sends the stage's last results again when it is gated off, nullptr if it has none
+    void (*replay)(FvTexture *, const StageParams &params, FlMethodChannel *) = nullptr;
+    // Output shape from the input shape, nullptr if the stage keeps it. See `Pipeline::plan`.
+    ShapeInference infer = nullptr;
+    // Builds the state the stage keeps across frames (StageState::runtime), nullptr if it keeps none
+    StageInit init = nullptr;
+    StageParams params = {};
+    // `params` as received, edited field by field by `Pipeline::setParam`
+    std::vector<uint8_t> raw = {};
     bool runOnce = false;
+    // Skipped on frames a `changeGate` stage found unchanged
+    bool gated = false;
+    // Derived from `interval` unless set with `Pipeline::setSchedule`
+    StageSchedule schedule = {};
+    std::shared_ptr<StageState> state = nullptr;
+    // Set on the first stage of a run of elementwise stages, see `Pipeline::fuseElementwise`
+    std::shared_ptr<const FusedKernel> fused = nullptr;
+    unsigned int fusedCount = 0;
+    // Output buffer of a Replace stage, reserved by `Pipeline::plan`
+    std::shared_ptr<cv::Mat> output = nullptr;
+    // Skipped, the camera already delivers its result (see `Pipeline::setSource`)
+    bool elided = false;
 };
 
-void PipelineFuncTest(FvTexture *fv, std::vector<uint8_t> params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
+void PipelineFuncTest(FvTexture *fv, const StageParams &params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
 {
-    printf("[Pipeline:Test()] %d\n", params[0]);
+    printf("[Pipeline:Test()] %d\n", std::get<ByteParams>(params).value);
 }
 
-void PipelineFuncOpencvCvtColor(FvTexture *fv, std::vector<uint8_t> params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
+void PipelineFuncOpencvCvtColor(FvTexture *fv, const StageParams &params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
 {
     // printf("PipelineFuncOpencvCvtColor:%d\n", params[0]);
-    cv::cvtColor(fv->cvImage, fv->cvImage, params[0]);
+    cv::Mat fresh;
+    cv::Mat &out = stageOutput(fv, fresh);
+    cv::cvtColor(fv->cvImage, out, std::get<CodeParams>(params).code);
+    fv->cvImage = out;
+}
+
+bool PipelineInferCvtColor(const StageParams &params, ImageShape &shape, std::string &error)
+{
+    int code = std::get<CodeParams>(params).code;
+    return ShapeCheck::probe(shape, [code](const cv::Mat &in, cv::Mat &out)
+                             { cv::cvtColor(in, out, code); }, error);
 }
 
 /**
  * @brief cv::imwrite
  *
- * @param params first byte is length of file path string
+ * @param params PathParams
  */
-void PipelineFuncOpencvImwrite(FvTexture *fv, std::vector<uint8_t> params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
+void PipelineFuncOpencvImwrite(FvTexture *fv, const StageParams &params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
 {
-    std::string path;
-    std::stringstream ss;
-    for (int i = 1; i <= params[0]; i++)
-        ss << params[i];
-    ss >> path;
-
-    cv::imwrite(path.c_str(), fv->cvImage);
+    cv::imwrite(std::get<PathParams>(params).path, fv->cvImage);
 }
 
-void PipelineFuncOpencvImread(FvTexture *fv, std::vector<uint8_t> params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
+void PipelineFuncOpencvImread(FvTexture *fv, const StageParams &params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
 {
-    std::string path;
-    std::stringstream ss;
-    for (int i = 1; i <= params[0]; i++)
-        ss << params[i];
-    ss >> path;
+    fv->cvImage = cv::imread(std::get<PathParams>(params).path);
+}
 
-    fv->cvImage = cv::imread(path.c_str());
+// The file or the plugin decides the shape, which may change between frames
+bool PipelineInferUnknown(const StageParams &params, ImageShape &shape, std::string &error)
+{
+    shape = ImageShape{};
+    return true;
 }
 
-void PipelineFuncShow(FvTexture *fv, std::vector<uint8_t> params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
+/**
+ * @brief Convert the image to RGBA straight into the texture's back buffer and publish it. Downscaled to the display
+ * size of the texture on the way; frames beyond its display rate are skipped.
+ *
+ * @param params ShowParams
+ */
+void PipelineFuncShow(FvTexture *fv, const StageParams &params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
 {
     // printf("PipelineFuncShow: %d, %d\n", fv->cvImage.cols, fv->cvImage.rows);
-    fv->video_width = fv->cvImage.cols;
-    fv->video_height = fv->cvImage.rows;
-    fv->buffer.clear();
-    fv->buffer.resize(fv->video_width * fv->video_height * 4);
-    fv->buffer.assign(fv->cvImage.data, fv->cvImage.data + fv->cvImage.total() * fv->cvImage.channels());
-    fl_texture_registrar_mark_texture_frame_available(&registrar, FL_TEXTURE(fv));
+    const ShowParams &p = std::get<ShowParams>(params);
+    const cv::Mat &image = fv->cvImage;
+    FvTexture *target = fv->owner != nullptr ? fv->owner : fv;
+    if (!target->publishDue(getMonotonicNs()))
+        return;
+
+    const uint32_t *lut = p.depthLut ? p.depthLut->data() : nullptr;
+    cv::Size size = target->displaySize(image.size());
+    target->publishFrame(size.width, size.height, [&](uint8_t *pixels)
+                         {
+        if (size == image.size())
+        {
+            PixelConvert::toRgba(image, p.format, lut, pixels);
+            return;
+        }
+
+        // Averaging depth would blend holes into their neighbours
+        int format = PixelConvert::resolve(image, p.format);
+        int interpolation = format == PixelConvert::DepthZ16 ? cv::INTER_NEAREST : cv::INTER_AREA;
+        target->displayPixels.resize(size.area() * image.elemSize());
+        cv::Mat scaled(size, image.type(), target->displayPixels.data());
+        cv::resize(image, scaled, size, 0, 0, interpolation);
+        PixelConvert::toRgba(scaled, format, lut, pixels); });
+    fl_texture_registrar_mark_texture_frame_available(&registrar, FL_TEXTURE(target));
+}
+
+bool PipelineInferShow(const StageParams &params, ImageShape &shape, std::string &error)
+{
+    return PixelConvert::resolve(shape.type, std::get<ShowParams>(params).format, error) >= 0;
+}
+
+/**
+ * @brief Drop depth outside a range (set it to 0, like a hole)
+ *
+ * @param params DepthRangeParams
+ */
+void PipelineFuncDepthClip(FvTexture *fv, const StageParams &params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
+{
+    const DepthRangeParams &p = std::get<DepthRangeParams>(params);
+    DepthOps::clip(fv->cvImage, p.min, p.max);
+}
+
+bool PipelineInferDepth(const StageParams &params, ImageShape &shape, std::string &error)
+{
+    return ShapeCheck::type(shape, CV_16UC1, error);
+}
+
+/**
+ * @brief Depth to RGBA through a color map, in one table lookup per pixel
+ *
+ * @param params DepthColorizeParams
+ */
+void PipelineFuncDepthColorize(FvTexture *fv, const StageParams &params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
+{
+    cv::Mat fresh;
+    cv::Mat &out = stageOutput(fv, fresh);
+    DepthOps::colorize(fv->cvImage, out, std::get<DepthColorizeParams>(params).lut->data());
+    fv->cvImage = out;
+}
+
+bool PipelineInferDepthColorize(const StageParams &params, ImageShape &shape, std::string &error)
+{
+    if (!ShapeCheck::type(shape, CV_16UC1, error))
+        return false;
+
+    shape.type = CV_8UC4;
+    return true;
+}
+
+/**
+ * @brief Depth to an 8-bit mask of the pixels within (or, inverted, nearer or farther than) a range
+ *
+ * @param params DepthRangeParams
+ */
+void PipelineFuncDepthMask(FvTexture *fv, const StageParams &params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
+{
+    const DepthRangeParams &p = std::get<DepthRangeParams>(params);
+    cv::Mat fresh;
+    cv::Mat &out = stageOutput(fv, fresh);
+    DepthOps::mask(fv->cvImage, out, p.min, p.max, p.invert);
+    fv->cvImage = out;
+}
+
+bool PipelineInferDepthMask(const StageParams &params, ImageShape &shape, std::string &error)
+{
+    if (!ShapeCheck::type(shape, CV_16UC1, error))
+        return false;
+
+    shape.type = CV_8UC1;
+    return true;
 }
 
 /**
  * @brief cv::Mat::convertTo
  *
- * @param params 0: convert type, 1~4: alpha (double)
+ * @param params ConvertToParams
  */
-void PipelineFuncOpencvConvertTo(FvTexture *fv, std::vector<uint8_t> params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
+void PipelineFuncOpencvConvertTo(FvTexture *fv, const StageParams &params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
 {
-    // printf("ConvertTo:Param:%d\n", params[0]);
-    float scale = *reinterpret_cast<float *>(&params[1]);
-    float shift = *reinterpret_cast<float *>(&params[5]);
-    fv->cvImage.convertTo(fv->cvImage, params[0], scale, shift);
+    const ConvertToParams &p = std::get<ConvertToParams>(params);
+    cv::Mat fresh;
+    cv::Mat &out = stageOutput(fv, fresh);
+    fv->cvImage.convertTo(out, p.rtype, p.scale, p.shift);
+    fv->cvImage = out;
 }
 
-void PipelineFuncOpencvApplyColorMap(FvTexture *fv, std::vector<uint8_t> params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
+bool PipelineInferConvertTo(const StageParams &params, ImageShape &shape, std::string &error)
 {
-    cv::applyColorMap(fv->cvImage, fv->cvImage, params[0]);
+    int rtype = std::get<ConvertToParams>(params).rtype;
+    if (rtype >= 0)
+        shape.type = CV_MAKETYPE(CV_MAT_DEPTH(rtype), CV_MAT_CN(shape.type));
+
+    return true;
+}
+
+void PipelineFuncOpencvApplyColorMap(FvTexture *fv, const StageParams &params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
+{
+    cv::Mat fresh;
+    cv::Mat &out = stageOutput(fv, fresh);
+    cv::applyColorMap(fv->cvImage, out, std::get<CodeParams>(params).code);
+    fv->cvImage = out;
+}
+
+bool PipelineInferApplyColorMap(const StageParams &params, ImageShape &shape, std::string &error)
+{
+    if (shape.type != CV_8UC1 && shape.type != CV_8UC3)
+    {
+        error = "needs an 8UC1 or 8UC3 image, got " + shape.str();
+        return false;
+    }
+
+    shape.type = CV_8UC3;
+    return true;
 }
 
 /**
  * @brief OpenCV resize
  *
- * @param params [0-1]: width, [2-3]: height [4]: mode
+ * @param params ResizeParams
  */
-void PipelineFuncOpencvResize(FvTexture *fv, std::vector<uint8_t> params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
+void PipelineFuncOpencvResize(FvTexture *fv, const StageParams &params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
 {
-    int width = (params[0] << 8) + params[1];
-    int height = (params[2] << 8) + params[3];
+    const ResizeParams &p = std::get<ResizeParams>(params);
+    cv::Mat fresh;
+    cv::Mat &out = stageOutput(fv, fresh);
+    cv::resize(fv->cvImage, out, p.size, 0, 0, p.interpolation);
+    fv->cvImage = out;
+}
 
-    cv::resize(fv->cvImage, fv->cvImage, cv::Size(width, height), params[4]);
+bool PipelineInferResize(const StageParams &params, ImageShape &shape, std::string &error)
+{
+    shape.size = std::get<ResizeParams>(params).size;
+    return true;
 }
 
 /**
  * @brief Crop image
  *
- * @param params x, y, width, height: each contains 2 bytes
+ * @param params CropParams
  */
-void PipelineFuncCrop(FvTexture *fv, std::vector<uint8_t> params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
-{
-    // TODO: Check ROI is valid
-    int xStart = (params[0] << 8) + params[1];
-    int xEnd = (params[2] << 8) + params[3];
-    int yStart = (params[4] << 8) + params[5];
-    int yEnd = (params[6] << 8) + params[7];
-    fv->cvImage = fv->cvImage(cv::Range(yStart, yEnd), cv::Range(xStart, xEnd));
+void PipelineFuncCrop(FvTexture *fv, const StageParams &params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
+{
+    const CropParams &p = std::get<CropParams>(params);
+    if (p.cols.end > fv->cvImage.cols || p.rows.end > fv->cvImage.rows)
+        throw std::out_of_range("crop area exceeds image size");
+
+    fv->cvImage = fv->cvImage(p.rows, p.cols);
     // printf("Crop: %d, %d, %d\n", fv->cvImage.cols, fv->cvImage.rows, fv->cvImage.channels());
 }
 
-void PipelineFuncOpencvRectangle(FvTexture *fv, std::vector<uint8_t> params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
+bool PipelineInferCrop(const StageParams &params, ImageShape &shape, std::string &error)
+{
+    const CropParams &p = std::get<CropParams>(params);
+    if (p.cols.end > shape.size.width || p.rows.end > shape.size.height)
+    {
+        error = "crop area exceeds image size " + shape.str();
+        return false;
+    }
+
+    shape.size = cv::Size(p.cols.size(), p.rows.size());
+    return true;
+}
+
+void PipelineFuncOpencvRectangle(FvTexture *fv, const StageParams &params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
+{
+    const ShapeParams &p = std::get<ShapeParams>(params);
+    cv::rectangle(fv->cvImage, p.p1, p.p2, p.color, p.thickness, p.lineType, p.shift);
+}
+
+void PipelineFuncOpencvRotate(FvTexture *fv, const StageParams &params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
 {
-    float x1 = *reinterpret_cast<float *>(&params[0]);
-    float y1 = *reinterpret_cast<float *>(&params[4]);
-    float x2 = *reinterpret_cast<float *>(&params[8]);
-    float y2 = *reinterpret_cast<float *>(&params[12]);
-    uint8_t r = params[16];
-    uint8_t g = params[17];
-    uint8_t b = params[18];
-    uint8_t alpha = params[19];
-    uint8_t thickness = params[20];
-    uint8_t lineType = params[21];
-    uint8_t shift = params[22];
-    cv::rectangle(fv->cvImage, cv::Point(x1, y1), cv::Point(x2, y2), cv::Scalar(b, g, r, alpha), thickness, lineType, shift);
+    cv::Mat fresh;
+    cv::Mat &out = stageOutput(fv, fresh);
+    cv::rotate(fv->cvImage, out, std::get<CodeParams>(params).code);
+    fv->cvImage = out;
 }
 
-void PipelineFuncOpencvRotate(FvTexture *fv, std::vector<uint8_t> params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
+bool PipelineInferRotate(const StageParams &params, ImageShape &shape, std::string &error)
 {
-    cv::rotate(fv->cvImage, fv->cvImage, params[0]);
+    if (std::get<CodeParams>(params).code != cv::ROTATE_180)
+        std::swap(shape.size.width, shape.size.height);
+
+    return true;
 }
 
-void PipelineFuncTfSetInputTensor(FvTexture *fv, std::vector<uint8_t> params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
+void PipelineFuncTfSetInputTensor(FvTexture *fv, const StageParams &params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
 {
-    if (params[2] == 0)
-        models->at(params[0])->setInput<uint8_t>(params[1], fv->cvImage, fv->cvImage.cols * fv->cvImage.rows * fv->cvImage.channels());
-    else if (params[2] == 1)
-        models->at(params[0])->setInput<float>(params[1], fv->cvImage, fv->cvImage.cols * fv->cvImage.rows * fv->cvImage.channels());
+    const TensorInputParams &p = std::get<TensorInputParams>(params);
+    if (p.dataType == 0)
+        models->at(p.modelIndex)->setInput<uint8_t>(p.tensorIndex, fv->cvImage, fv->cvImage.cols * fv->cvImage.rows * fv->cvImage.channels());
+    else if (p.dataType == 1)
+        models->at(p.modelIndex)->setInput<float>(p.tensorIndex, fv->cvImage, fv->cvImage.cols * fv->cvImage.rows * fv->cvImage.channels());
 }
 
-void PipelineFuncTfInference(FvTexture *fv, std::vector<uint8_t> params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
+void PipelineFuncTfInference(FvTexture *fv, const StageParams &params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
 {
-    bool success = models->at(params[0])->inference();
+    bool success = models->at(std::get<InferenceParams>(params).modelIndex)->inference();
     if (!success)
     {
         printf("Inference Failed!!!!\n");
@@ -173,37 +371,67 @@ void PipelineFuncTfInference(FvTexture *fv, std::vector<uint8_t> params, FlTextu
     fl_method_channel_invoke_method(flChannel, "onInference", nullptr, nullptr, nullptr, NULL);
 }
 
-void PipelineFuncCustomHandler(FvTexture *fv, std::vector<uint8_t> params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
+/**
+ * @brief The model's outputs are still those of the last inference
+ */
+void PipelineReplayTfInference(FvTexture *fv, const StageParams &params, FlMethodChannel *flChannel)
+{
+    fl_method_channel_invoke_method(flChannel, "onInference", nullptr, nullptr, nullptr, NULL);
+}
+
+void PipelineFuncCustomHandler(FvTexture *fv, const StageParams &params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
 {
-    int size = (params[0] << 8) + params[1];
-    float *result = new float[size]{0};
-    flutterVision3dHandler(fv->cvImage, result);
-    fl_method_channel_invoke_method(flChannel, "onHandled", fl_value_new_float32_list(result, size), nullptr, nullptr, NULL);
+    std::vector<float> &result = stageRuntime<CustomHandlerRuntime>(fv).result;
+    result.assign(std::get<CustomHandlerParams>(params).size, 0.0f);
+    flutterVision3dHandler(fv->cvImage, result.data());
+
+    g_autoptr(FlValue) value = fl_value_new_float32_list(result.data(), result.size());
+    fl_method_channel_invoke_method(flChannel, "onHandled", value, nullptr, nullptr, NULL);
+}
+
+void PipelineReplayCustomHandler(FvTexture *fv, const StageParams &params, FlMethodChannel *flChannel)
+{
+    const std::vector<float> &result = stageRuntime<CustomHandlerRuntime>(fv).result;
+    g_autoptr(FlValue) value = fl_value_new_float32_list(result.data(), result.size());
+    fl_method_channel_invoke_method(flChannel, "onHandled", value, nullptr, nullptr, NULL);
 }
 
-void PipelineFuncOpencvNormalize(FvTexture *fv, std::vector<uint8_t> params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
+void PipelineFuncOpencvNormalize(FvTexture *fv, const StageParams &params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
 {
-    float alpha = *reinterpret_cast<float *>(&params[0]);
-    float beta = *reinterpret_cast<float *>(&params[4]);
-    uint8_t normType = params[8];
-    uint8_t dType = params[9];
+    const NormalizeParams &p = std::get<NormalizeParams>(params);
+    cv::Mat fresh;
+    cv::Mat &out = stageOutput(fv, fresh);
+    cv::normalize(fv->cvImage, out, p.alpha, p.beta, p.normType, p.dType);
+    fv->cvImage = out;
+}
+
+bool PipelineInferNormalize(const StageParams &params, ImageShape &shape, std::string &error)
+{
+    int dType = std::get<NormalizeParams>(params).dType;
+    if (dType >= 0)
+        shape.type = CV_MAKETYPE(CV_MAT_DEPTH(dType), CV_MAT_CN(shape.type));
+
+    return true;
+}
 
-    cv::normalize(fv->cvImage, fv->cvImage, alpha, beta, normType, dType);
+void PipelineFuncOpencvThreshold(FvTexture *fv, const StageParams &params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
+{
+    const ThresholdParams &p = std::get<ThresholdParams>(params);
+    cv::threshold(fv->cvImage, fv->cvImage, p.threshold, p.max, p.type);
 }
 
-void PipelineFuncOpencvThreshold(FvTexture *fv, std::vector<uint8_t> params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
+bool PipelineInferThreshold(const StageParams &params, ImageShape &shape, std::string &error)
 {
-    float threshold = *reinterpret_cast<float *>(&params[0]);
-    float max = *reinterpret_cast<float *>(&params[4]);
-    uint8_t type = params[8];
+    // OTSU and TRIANGLE work on 8-bit single channel images only
+    if ((std::get<ThresholdParams>(params).type & (cv::THRESH_OTSU | cv::THRESH_TRIANGLE)) != 0)
+        return ShapeCheck::type(shape, CV_8UC1, error);
 
-    cv::threshold(fv->cvImage, fv->cvImage, threshold, max, type);
+    return true;
 }
 
-void PipelineFuncOpencvRelu(FvTexture *fv, std::vector<uint8_t> params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
+void PipelineFuncOpencvRelu(FvTexture *fv, const StageParams &params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
 {
-    float threshold = *reinterpret_cast<float *>(&params[0]);
-    uchar thresholdValueUchar = static_cast<uchar>(threshold * 255.0);
+    uchar thresholdValueUchar = std::get<ReluParams>(params).threshold;
     uchar *p;
     for (int i = 0; i < fv->cvImage.rows; ++i)
     {
@@ -218,13 +446,18 @@ void PipelineFuncOpencvRelu(FvTexture *fv, std::vector<uint8_t> params, FlTextur
     }
 }
 
-void PipelineZeroDepthFilter(FvTexture *fv, std::vector<uint8_t> params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
+void PipelineZeroDepthFilter(FvTexture *fv, const StageParams &params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
 {
-    cv::Mat temp;
-    fv->cvImage.copyTo(temp);
+    // Reads the input, fills holes in a copy of it
+    const cv::Mat temp = fv->cvImage;
+    cv::Mat fresh;
+    cv::Mat &out = stageOutput(fv, fresh);
+    temp.copyTo(out);
+    fv->cvImage = out;
 
-    int threshold = params[0];
-    int halfRange = params[1];
+    const ZeroDepthFilterParams &p = std::get<ZeroDepthFilterParams>(params);
+    int threshold = p.threshold;
+    int halfRange = p.halfRange;
 
     cv::parallel_for_(cv::Range(halfRange, fv->cvImage.rows - halfRange), [&](const cv::Range &rowRange)
                       {
@@ -258,248 +491,1683 @@ void PipelineZeroDepthFilter(FvTexture *fv, std::vector<uint8_t> params, FlTextu
         } });
 }
 
-void PipelineCopyTo(FvTexture *fv, std::vector<uint8_t> params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
+void PipelineCopyTo(FvTexture *fv, const StageParams &params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
+{
+    fv->cvImage.copyTo(*std::get<CopyToParams>(params).dst);
+}
+
+void PipelineOpencvLine(FvTexture *fv, const StageParams &params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
 {
-    uint64_t pointer =
-        (static_cast<uint64_t>(params[0]) << 56) +
-        (static_cast<uint64_t>(params[1]) << 48) +
-        (static_cast<uint64_t>(params[2]) << 40) +
-        (static_cast<uint64_t>(params[3]) << 32) +
-        (static_cast<uint64_t>(params[4]) << 24) +
-        (static_cast<uint64_t>(params[5]) << 16) +
-        (static_cast<uint64_t>(params[6]) << 8) +
-        static_cast<uint64_t>(params[7]);
+    const ShapeParams &p = std::get<ShapeParams>(params);
+    cv::line(fv->cvImage, p.p1, p.p2, p.color, p.thickness, p.lineType);
+}
 
-    std::uintptr_t p = pointer;
-    cv::Mat *mat = (cv::Mat *)p;
-    fv->cvImage.copyTo(*mat);
-    // std::cout << "[CopyTo]: " << pointer << "," << mat->cols << "," << mat->rows << "," << mat->channels() << std::endl;
+/**
+ * @brief Segment boundary. Does nothing when the pipeline runs inline (`runOnce`). In `Pipeline::run` the stages
+ * after it run on their own worker thread.
+ *
+ * @param params SegmentParams
+ */
+void PipelineFuncSegment(FvTexture *fv, const StageParams &params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
+{
 }
 
-void PipelineOpencvLine(FvTexture *fv, std::vector<uint8_t> params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
+/**
+ * @brief Send `onBatchInference` with the outputs of the stage's last run
+ */
+void PipelineReplayTfBatchInference(FvTexture *fv, const StageParams &params, FlMethodChannel *flChannel)
 {
-    float x1 = *reinterpret_cast<float *>(&params[0]);
-    float y1 = *reinterpret_cast<float *>(&params[4]);
-    float x2 = *reinterpret_cast<float *>(&params[8]);
-    float y2 = *reinterpret_cast<float *>(&params[12]);
-    uint8_t r = params[16];
-    uint8_t g = params[17];
-    uint8_t b = params[18];
-    uint8_t alpha = params[19];
-    uint8_t thickness = params[20];
-    uint8_t lineType = params[21];
+    const BatchInferenceRuntime &r = stageRuntime<BatchInferenceRuntime>(fv);
+    if (r.last.empty())
+        return;
+
+    FvTexture *target = fv->owner != nullptr ? fv->owner : fv;
+    g_autoptr(FlValue) result = fl_value_new_map();
+    FlValue *tensors = fl_value_new_list();
+    for (const std::vector<float> &o : r.last)
+        fl_value_append_take(tensors, fl_value_new_float32_list(o.data(), o.size()));
 
-    cv::line(fv->cvImage, cv::Point(x1, y1), cv::Point(x2, y2), cv::Scalar(b, g, r, alpha), thickness, lineType);
+    fl_value_set_string_take(result, "textureId", fl_value_new_int(target->textureId));
+    fl_value_set_string_take(result, "model", fl_value_new_int(r.lastModel));
+    fl_value_set_string_take(result, "outputs", tensors);
+    fl_method_channel_invoke_method(flChannel, "onBatchInference", result, nullptr, nullptr, NULL);
 }
 
-const FuncDef pipelineFuncs[] = {
-    {0, "test", 0, 0, PipelineFuncTest},
-    {1, "cvtColor", 0, 0, PipelineFuncOpencvCvtColor},
-    {2, "imwrite", 0, 0, PipelineFuncOpencvImwrite},
-    {3, "show", 0, 0, PipelineFuncShow},
-    {4, "convertTo", 0, 0, PipelineFuncOpencvConvertTo},
-    {5, "applyColorMap", 0, 0, PipelineFuncOpencvApplyColorMap},
-    {6, "resize", 0, 0, PipelineFuncOpencvResize},
-    {7, "crop", 0, 0, PipelineFuncCrop},
-    {8, "imread", 0, 0, PipelineFuncOpencvImread},
-    {9, "cvRectangle", 0, 0, PipelineFuncOpencvRectangle},
-    {10, "rotate", 0, 0, PipelineFuncOpencvRotate},
-    {11, "tfSetTenorInput", 0, 0, PipelineFuncTfSetInputTensor},
-    {12, "tfInference", 0, 0, PipelineFuncTfInference},
-    {13, "customHandler", 0, 0, PipelineFuncCustomHandler},
-    {14, "cvNormalized", 0, 0, PipelineFuncOpencvNormalize},
-    {15, "cvThreshold", 0, 0, PipelineFuncOpencvThreshold},
-    {16, "relu", 0, 0, PipelineFuncOpencvRelu},
-    {17, "zeroDepthFilter", 0, 0, PipelineZeroDepthFilter},
-    {18, "PipelineCopyTo", 0, 0, PipelineCopyTo},
-    {19, "cvLine", 0, 0, PipelineOpencvLine},
-};
+/**
+ * @brief Run the image as one item of a batched `Invoke` shared with the other pipelines using the model, see
+ * TFLiteBatcher. Sends `onBatchInference` with the texture id of the pipeline and the outputs of its item.
+ *
+ * @param params BatchInferenceParams
+ */
+void PipelineFuncTfBatchInference(FvTexture *fv, const StageParams &params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
+{
+    const BatchInferenceParams &p = std::get<BatchInferenceParams>(params);
+    if (p.modelIndex >= models->size())
+        throw std::runtime_error("model " + std::to_string(p.modelIndex) + " is not loaded");
+
+    std::vector<std::vector<float>> outputs;
+    std::string error;
+    TFLiteModel *model = models->at(p.modelIndex);
+    if (!TFLiteBatcher::of(model, p.tensorIndex).infer(fv->cvImage, p.maxBatch, p.deadlineMs, outputs, error))
+        throw std::runtime_error(error);
+
+    BatchInferenceRuntime &r = stageRuntime<BatchInferenceRuntime>(fv);
+    std::swap(r.last, outputs);
+    r.lastModel = p.modelIndex;
+    PipelineReplayTfBatchInference(fv, params, flChannel);
+}
 
-class Pipeline
+/**
+ * @brief Send `onPluginResult` with the results of the stage's last `process`, if it wrote any
+ */
+void PipelineReplayPluginStage(FvTexture *fv, const StageParams &params, FlMethodChannel *flChannel)
 {
-public:
-    std::string error = "";
+    const PluginStageRuntime &r = stageRuntime<PluginStageRuntime>(fv);
+    const PluginStageInstance &stage = *r.instance;
+    if (stage.lastSize == 0)
+        return;
 
-    Pipeline()
-    {
-        img = cv::Mat(1, 1, CV_8UC4, cv::Scalar(255, 0, 0, 255));
-        imgPtr = &img;
-    }
+    FvTexture *target = fv->owner != nullptr ? fv->owner : fv;
+    g_autoptr(FlValue) value = fl_value_new_map();
+    fl_value_set_string_take(value, "stage", fl_value_new_string(r.name.c_str()));
+    fl_value_set_string_take(value, "textureId", fl_value_new_int(target->textureId));
+    fl_value_set_string_take(value, "result", fl_value_new_float32_list(stage.result.data(), stage.lastSize));
+    fl_method_channel_invoke_method(flChannel, "onPluginResult", value, nullptr, nullptr, NULL);
+}
 
-    Pipeline(cv::Mat *m)
-    {
-        imgPtr = m;
-    }
+/**
+ * @brief Stage of a runtime loaded library (fv_stage_plugin.h). Sends `onPluginResult` when the stage wrote results.
+ *
+ * @param params PluginStageParams
+ */
+void PipelineFuncPluginStage(FvTexture *fv, const StageParams &params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
+{
+    PluginStageRuntime &r = stageRuntime<PluginStageRuntime>(fv);
+    PluginStageInstance &stage = *r.instance;
+    cv::Mat &m = fv->cvImage;
+
+    FvImageView image{m.data, m.cols, m.rows, m.channels(), m.depth(), m.step[0]};
+    FvResultBuffer result{stage.result.data(), (uint32_t)stage.result.size(), 0};
+    int ret = stage.desc->process(stage.instance, &image, &result);
+    if (ret != 0)
+        throw std::runtime_error(r.name + " returned " + std::to_string(ret));
+
+    stage.lastSize = std::min(result.size, result.capacity);
+    PipelineReplayPluginStage(fv, params, flChannel);
+}
+
+/**
+ * @brief Start of a branch. Consecutive branches up to the next `join` get the same input image and run concurrently.
+ * The stages after `join` continue with the image from before the first branch.
+ */
+void PipelineFuncBranch(FvTexture *fv, const StageParams &params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
+{
+}
+
+void PipelineFuncJoin(FvTexture *fv, const StageParams &params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
+{
+}
+
+/**
+ * @brief Compare a downsampled copy of the frame with the frame of the last change and set `sceneChanged` for the
+ * gated stages after it. The first frame, and any frame of a new size or type, counts as changed.
+ *
+ * @param params ChangeGateParams
+ */
+void PipelineFuncChangeGate(FvTexture *fv, const StageParams &params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
+{
+    const ChangeGateParams &p = std::get<ChangeGateParams>(params);
+    ChangeGateRuntime &s = stageRuntime<ChangeGateRuntime>(fv);
+    const cv::Mat &m = fv->cvImage;
+    cv::Size size(std::max(1, m.cols / (int)p.scale), std::max(1, m.rows / (int)p.scale));
 
-    void add(unsigned int index, const uint8_t *params, unsigned int len, int insertAt = -1, int interval = 0, bool append = false, bool runOnce = false)
+    cv::Mat *current;
+    if (p.mode == ChangeGateParams::DepthOccupancy)
     {
-        FuncDef f = pipelineFuncs[index];
-        f.interval = interval;
-        f.runOnce = runOnce;
+        if (m.type() != CV_16UC1)
+            throw std::runtime_error("depth occupancy needs a 16-bit depth image");
 
-        if (runOnce)
+        // Nearest, so holes are not averaged into the depth around them
+        cv::resize(m, s.small, size, 0, 0, cv::INTER_NEAREST);
+        current = &s.small;
+    }
+    else
+    {
+        cv::resize(m, s.small, size, 0, 0, cv::INTER_AREA);
+        current = &s.small;
+        if (s.small.channels() == 3 || s.small.channels() == 4)
         {
-            runOnceFinished = false;
+            cv::cvtColor(s.small, s.gray, s.small.channels() == 3 ? cv::COLOR_RGB2GRAY : cv::COLOR_RGBA2GRAY);
+            current = &s.gray;
         }
+    }
 
-        for (unsigned int i = 0; i < len; i++)
-            f.params.push_back(*(params + i));
-
-        if (append)
+    bool changed = true;
+    if (s.reference.size() == current->size() && s.reference.type() == current->type())
+    {
+        size_t count = 0;
+        if (p.mode == ChangeGateParams::DepthOccupancy)
         {
-            if (insertAt == -1)
-                funcs.push_back(f);
-            else
+            for (int y = 0; y < current->rows; y++)
             {
-                if (insertAt > (int)funcs.size() - 1)
-                    insertAt = funcs.size() - 1;
-
-                if (insertAt < 0)
-                    insertAt = 0;
-
-                funcs.insert(funcs.begin() + insertAt, f);
+                const uint16_t *a = current->ptr<uint16_t>(y);
+                const uint16_t *b = s.reference.ptr<uint16_t>(y);
+                for (int x = 0; x < current->cols; x++)
+                {
+                    if (a[x] != 0 && b[x] != 0 && std::abs((int)a[x] - (int)b[x]) > p.threshold)
+                        count++;
+                }
             }
         }
         else
         {
-            if (insertAt == -1)
-                funcs.push_back(f);
-            else
-                funcs.at(insertAt) = f;
+            cv::absdiff(*current, s.reference, s.diff);
+            cv::compare(s.diff, p.threshold, s.mask, cv::CMP_GT);
+            count = cv::countNonZero(s.mask);
         }
+
+        changed = count >= p.minChanged * current->total() && count > 0;
     }
 
-    int removeAt(unsigned int index)
+    if (changed)
     {
-        funcs.erase(funcs.begin() + index);
-        return 0;
+        // Slow drifts add up against the reference until they count as a change
+        cv::swap(s.reference, *current);
+        s.holdLeft = p.hold;
     }
-
-    int runOnce(FvTexture *fv, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel, int &from, int &to)
+    else if (s.holdLeft > 0)
     {
-        if (to == -1 || to >= funcs.size())
-            to = funcs.size();
-
-        for (int i = from; i < to; i++)
-        {
-            // printf("Run:%s\n", funcs[i].name);
-            try
-            {
-                error = "";
-                funcs[i].func(fv, funcs[i].params, registrar, models, flChannel);
-            }
-            catch (std::exception &e)
-            {
-                error = e.what();
-                return -1;
-            }
-        }
-
-        return 0;
+        s.holdLeft--;
+        changed = true;
     }
 
-    int run(FvTexture *fv, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
-    {
-        std::vector<size_t> removeIndex = {};
+    fv->sceneChanged = changed;
+}
 
-        isRunning = true;
-        for (int i = 0; i < funcs.size(); i++)
-        {
-            if (funcs[i].interval > 0)
-            {
-                getCurrentTime(&ts);
-                if (ts - funcs[i].timer < funcs[i].interval)
-                {
-                    continue;
-                }
-            }
+bool PipelineInferChangeGate(const StageParams &params, ImageShape &shape, std::string &error)
+{
+    if (std::get<ChangeGateParams>(params).mode == ChangeGateParams::DepthOccupancy)
+        return ShapeCheck::type(shape, CV_16UC1, error);
 
-            try
-            {
-                // printf("[Run] %s\n", funcs[i].name);
-                funcs[i].func(fv, funcs[i].params, registrar, models, flChannel);
-                if (funcs[i].runOnce)
-                    removeIndex.push_back(i);
-            }
-            catch (std::exception &e)
-            {
-                error = e.what();
-                std::cout << "[Pipeline Error]" << funcs[i].name << ":" << error << std::endl;
-                isRunning = false;
-                return -1;
-            }
+    return true;
+}
 
-            if (funcs[i].interval > 0)
-            {
-                getCurrentTime(&funcs[i].timer);
-            }
-        }
+/**
+ * @brief `regCopy` and `regOp`: an operation on two registers of the camera's `RegisterFile`, the result stored into a
+ * third one. `cur` as the destination replaces the image flowing through the pipeline.
+ *
+ * @param params RegisterParams
+ */
+void PipelineFuncRegister(FvTexture *fv, const StageParams &params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
+{
+    const RegisterParams &p = std::get<RegisterParams>(params);
+    if (p.op == RegisterParams::Copy && p.a == p.dst)
+        return;
 
-        for (size_t index : removeIndex)
-        {
-            if (index < funcs.size())
-            {
-                funcs.erase(funcs.begin() + index);
-            }
-        }
+    if (fv->registers == nullptr)
+        throw std::runtime_error("no register file");
 
-        if (!removeIndex.empty())
+    cv::Mat fresh;
+    cv::Mat &out = stageOutput(fv, fresh);
+    cv::Mat &scratch = stageRuntime<RegisterRuntime>(fv).scratch;
+    fv->registers->with(fv->cvImage, out, p.a, p.b, p.dst, [&p, &scratch](const cv::Mat &a, const cv::Mat &b, cv::Mat &dst)
+                        {
+        switch (p.op)
         {
-            runOnceFinished = true;
-        }
+        case RegisterParams::Copy:
+            a.copyTo(dst);
+            break;
+        case RegisterParams::Add:
+            cv::add(a, b, dst);
+            break;
+        case RegisterParams::Subtract:
+            cv::subtract(a, b, dst);
+            break;
+        case RegisterParams::AbsDiff:
+            cv::absdiff(a, b, dst);
+            break;
+        case RegisterParams::And:
+            cv::bitwise_and(a, b, dst);
+            break;
+        case RegisterParams::Or:
+            cv::bitwise_or(a, b, dst);
+            break;
+        case RegisterParams::Xor:
+            cv::bitwise_xor(a, b, dst);
+            break;
+        case RegisterParams::Min:
+            cv::min(a, b, dst);
+            break;
+        case RegisterParams::Max:
+            cv::max(a, b, dst);
+            break;
+        case RegisterParams::Mask:
+            // Zeroes are taken from b before dst, which may be b, is written
+            cv::compare(b, 0.0, scratch, cv::CMP_EQ);
+            a.copyTo(dst);
+            dst.setTo(0, scratch);
+            break;
+        case RegisterParams::Blend:
+            cv::addWeighted(a, p.alpha, b, 1.0 - p.alpha, 0, dst);
+            break;
+        } });
 
-        isRunning = false;
+    if (p.dst == RegisterFile::CUR)
+        fv->cvImage = out;
+}
 
-        return 0;
-    }
+bool PipelineInferRegister(const StageParams &params, ImageShape &shape, std::string &error)
+{
+    const RegisterParams &p = std::get<RegisterParams>(params);
+    // Another register's shape is only known at run time
+    if (p.dst == RegisterFile::CUR && p.a != RegisterFile::CUR)
+        shape = ImageShape{};
 
-    void clear()
-    {
-        while (isRunning)
-            ;
+    return true;
+}
 
-        funcs.clear();
-    }
+/**
+ * @brief Run a pipeline compiled in C++ (see static_pipeline.h) as one stage
+ *
+ * @param params StaticPipelineParams
+ */
+void PipelineFuncStaticPipeline(FvTexture *fv, const StageParams &params, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
+{
+    cv::Mat fresh;
+    cv::Mat &out = stageOutput(fv, fresh);
+    stageRuntime<StaticPipelineRuntime>(fv).pipeline->run(fv->cvImage, out);
+    fv->cvImage = out;
+}
 
-    void reset()
+bool PipelineInferStaticPipeline(const StageParams &params, ImageShape &shape, std::string &error)
+{
+    // A throwaway instance, the stage's own may be running on the camera thread
+    std::shared_ptr<CompiledPipeline> pipeline = StaticPipelineRegistry::shared().create(std::get<StaticPipelineParams>(params).name, error);
+    if (pipeline == nullptr)
+        return false;
+
+    try
     {
-        for (int i = 0; i < funcs.size(); i++)
-        {
-            funcs[i].timer = 0;
-        }
+        return ShapeCheck::probe(shape, [&pipeline](const cv::Mat &in, cv::Mat &out)
+                                 { pipeline->run(in, out); }, error);
     }
-
-    bool checkRunOnceFinished()
+    catch (std::exception &e)
     {
-        if (runOnceFinished)
-        {
-            runOnceFinished = false;
-            return true;
-        }
-
+        // Crop bounds and pixel type checks of the compiled stages
+        error = e.what();
         return false;
     }
+}
 
-    std::string getPipelineInfo()
-    {
-        std::string info;
+const FuncDef pipelineFuncs[] = {
+    {0, "test", 0, PipelineFuncTest, decodeByteParams, "value:u8"},
+    {1, "cvtColor", 0, PipelineFuncOpencvCvtColor, decodeCodeParams, "code:u8", StageAccess::Replace, nullptr, PipelineInferCvtColor},
+    {2, "imwrite", 0, PipelineFuncOpencvImwrite, decodePathParams, "path:str"},
+    {3, "show", 0, PipelineFuncShow, decodeShowParams, "format:u8? colorMap:u8? min:u16? max:u16?", StageAccess::Read, nullptr, PipelineInferShow},
+    {4, "convertTo", 0, PipelineFuncOpencvConvertTo, decodeConvertToParams, "rtype:u8 scale:f32 shift:f32", StageAccess::Replace, nullptr, PipelineInferConvertTo},
+    {5, "applyColorMap", 0, PipelineFuncOpencvApplyColorMap, decodeCodeParams, "colorMap:u8", StageAccess::Replace, nullptr, PipelineInferApplyColorMap},
+    {6, "resize", 0, PipelineFuncOpencvResize, decodeResizeParams, "width:u16 height:u16 mode:u8", StageAccess::Replace, nullptr, PipelineInferResize},
+    {7, "crop", 0, PipelineFuncCrop, decodeCropParams, "xStart:u16 xEnd:u16 yStart:u16 yEnd:u16", StageAccess::Read, nullptr, PipelineInferCrop},
+    {8, "imread", 0, PipelineFuncOpencvImread, decodePathParams, "path:str", StageAccess::Read, nullptr, PipelineInferUnknown},
+    {9, "cvRectangle", 0, PipelineFuncOpencvRectangle, decodeShapeParams, "x1:f32 y1:f32 x2:f32 y2:f32 r:u8 g:u8 b:u8 alpha:u8 thickness:u8 lineType:u8 shift:u8?", StageAccess::Write},
+    {10, "rotate", 0, PipelineFuncOpencvRotate, decodeRotateParams, "code:u8", StageAccess::Replace, nullptr, PipelineInferRotate},
+    {11, "tfSetTenorInput", 0, PipelineFuncTfSetInputTensor, decodeTensorInputParams, "model:u8 tensor:u8 dataType:u8"},
+    {12, "tfInference", 0, PipelineFuncTfInference, decodeInferenceParams, "model:u8", StageAccess::Read, PipelineReplayTfInference},
+    {13, "customHandler", 0, PipelineFuncCustomHandler, decodeCustomHandlerParams, "size:u16", StageAccess::Write, PipelineReplayCustomHandler, nullptr, initCustomHandlerRuntime},
+    {14, "cvNormalized", 0, PipelineFuncOpencvNormalize, decodeNormalizeParams, "alpha:f32 beta:f32 normType:u8 dType:i8", StageAccess::Replace, nullptr, PipelineInferNormalize},
+    {15, "cvThreshold", 0, PipelineFuncOpencvThreshold, decodeThresholdParams, "threshold:f32 max:f32 type:u8", StageAccess::Write, nullptr, PipelineInferThreshold},
+    {16, "relu", 0, PipelineFuncOpencvRelu, decodeReluParams, "threshold:f32", StageAccess::Write},
+    {17, "zeroDepthFilter", 0, PipelineZeroDepthFilter, decodeZeroDepthFilterParams, "threshold:u8 range:u8", StageAccess::Replace},
+    {18, "PipelineCopyTo", 0, PipelineCopyTo, decodeCopyToParams, "mat:u64"},
+    {19, "cvLine", 0, PipelineOpencvLine, decodeShapeParams, "x1:f32 y1:f32 x2:f32 y2:f32 r:u8 g:u8 b:u8 alpha:u8 thickness:u8 lineType:u8", StageAccess::Write},
+    {20, "segment", 0, PipelineFuncSegment, decodeSegmentParams, "queueSize:u8?"},
+    {21, "branch", 0, PipelineFuncBranch, decodeNoParams, ""},
+    {22, "join", 0, PipelineFuncJoin, decodeNoParams, ""},
+    {23, "tfBatchInference", 0, PipelineFuncTfBatchInference, decodeBatchInferenceParams, "model:u8 tensor:u8 maxBatch:u8 deadlineMs:u8", StageAccess::Read, PipelineReplayTfBatchInference, nullptr, initBatchInferenceRuntime},
+    {24, "pluginStage", 0, PipelineFuncPluginStage, decodePluginStageParams, "stage:str", StageAccess::Write, PipelineReplayPluginStage, PipelineInferUnknown, initPluginStageRuntime},
+    {25, "changeGate", 0, PipelineFuncChangeGate, decodeChangeGateParams, "mode:u8 threshold:f32 minChanged:f32 scale:u8 hold:u8?", StageAccess::Read, nullptr, PipelineInferChangeGate, initChangeGateRuntime},
+    {26, "depthClip", 0, PipelineFuncDepthClip, decodeDepthRangeParams, "min:u16 max:u16", StageAccess::Write, nullptr, PipelineInferDepth},
+    {27, "depthColorize", 0, PipelineFuncDepthColorize, decodeDepthColorizeParams, "colorMap:u8 min:u16 max:u16", StageAccess::Replace, nullptr, PipelineInferDepthColorize},
+    {28, "depthMask", 0, PipelineFuncDepthMask, decodeDepthRangeParams, "min:u16 max:u16 invert:u8?", StageAccess::Replace, nullptr, PipelineInferDepthMask},
+    {29, "regCopy", 0, PipelineFuncRegister, decodeRegisterCopyParams, "src:reg dst:reg", StageAccess::Replace, nullptr, PipelineInferRegister, initRegisterRuntime},
+    {30, "regOp", 0, PipelineFuncRegister, decodeRegisterOpParams, "op:u8 a:reg b:reg dst:reg alpha:f32?", StageAccess::Replace, nullptr, PipelineInferRegister, initRegisterRuntime},
+    {31, "staticPipeline", 0, PipelineFuncStaticPipeline, decodeStaticPipelineParams, "name:str", StageAccess::Replace, nullptr, PipelineInferStaticPipeline, initStaticPipelineRuntime},
+};
 
-        for (int i = 0; i < funcs.size(); i++)
-        {
-            info += funcs[i].name;
+/**
+ * @brief Pipeline stage list with snapshot (RCU) semantics.
+ *
+ * The stage list is immutable once published. Editors (GTK main thread) copy the current list, modify and plan the
+ * copy and publish it with an atomic pointer store, one editor at a time (`planMutex`). The camera thread loads the
+ * published list once per frame, so an edit takes effect at the next frame boundary and never blocks or races with a
+ * running frame. The camera thread only plans itself (new input shape, finished run-once stages) when no editor is
+ * planning; otherwise it keeps the published list and tries again on the next frame. Mutable per-stage data lives in
+ * StageState, which is shared between snapshots so counters and timers survive edits.
+ *
+ * Stages with an interval or a frame cadence are gated by a StageScheduler (monotonic timer wheel, per-pipeline frame
+ * counter), see stage_schedule.h.
+ *
+ * `segment` stages split the list into segments. The first segment runs on the camera thread; every following one
+ * runs on a dedicated worker thread fed by a bounded SPSC frame queue, so frame N+1 is preprocessed while frame N is
+ * still in a later segment (e.g. `tfInference`). A frame carries the snapshot it started with through all segments.
+ * A full queue blocks the upstream segment, which throttles the camera loop to the slowest segment.
+ *
+ * `branch` ... `join` forks a frame: every branch starts from a header of the same image buffer and the branches run
+ * concurrently on the shared WorkerPool. A branch clones the buffer only before a stage that writes into it while it
+ * is still shared.
+ *
+ * Every published list is scanned for runs of consecutive elementwise stages, which `run` executes as one FusedKernel
+ * pass. The list itself (info, stats, indices) is unchanged.
+ *
+ * A `changeGate` stage marks frames where nothing moved. Gated stages after it (`setGated`) are skipped on those frames
+ * and send their last results again instead. The mark travels with the frame into later segments and branches.
+ *
+ * Every published list is planned for the current input shape (see `plan`): the shape is carried through the stages
+ * to reject edits a stage cannot take, and every Replace stage that runs on every frame gets a preallocated output
+ * buffer, so a frame of a stable shape runs without allocating images. The list is replanned when the input shape
+ * changes (first frame, video mode change).
+ */
+class Pipeline
+{
+public:
+    Pipeline()
+    {
+        img = cv::Mat(1, 1, CV_8UC4, cv::Scalar(255, 0, 0, 255));
+        imgPtr = &img;
+    }
+
+    Pipeline(cv::Mat *m)
+    {
+        imgPtr = m;
+    }
+
+    ~Pipeline()
+    {
+        stopWorkers();
+    }
+
+    /**
+     * @brief Decode the stage parameters and insert the stage
+     *
+     * @return 0 on success. -1 if the function index, its parameters or the position are invalid, `getError()` holds
+     * the reason.
+     */
+    int add(unsigned int index, const uint8_t *params, unsigned int len, int insertAt = -1, int interval = 0, bool append = false, bool runOnce = false)
+    {
+        std::vector<uint8_t> raw = {};
+        if (params != nullptr)
+            raw.assign(params, params + len);
+
+        FuncDef f;
+        std::string makeError;
+        if (!makeStage(index, raw, interval, runOnce, f, makeError))
+        {
+            setError(makeError);
+            return -1;
+        }
+
+        // Cleared before the publish, under planMutex: `maintain` cannot report the new stage finished in between
+        bool wasFinished = false;
+        bool inserted = update([&](FuncList &funcs)
+                               {
+            if (append)
+            {
+                if (insertAt == -1)
+                    funcs.push_back(f);
+                else
+                {
+                    int at = insertAt;
+                    if (at > (int)funcs.size() - 1)
+                        at = funcs.size() - 1;
+
+                    if (at < 0)
+                        at = 0;
+
+                    funcs.insert(funcs.begin() + at, f);
+                }
+            }
+            else
+            {
+                if (insertAt == -1)
+                    funcs.push_back(f);
+                else if (insertAt >= 0 && insertAt < (int)funcs.size())
+                    funcs[insertAt] = f;
+                else
+                {
+                    setError("insert position " + std::to_string(insertAt) + " is out of range");
+                    return false;
+                }
+            }
+
+            if (runOnce)
+                wasFinished = runOnceFinished.exchange(false);
+
+            return true; });
+
+        if (!inserted)
+        {
+            // Nothing was published
+            if (wasFinished)
+                runOnceFinished = true;
+
+            return -1;
+        }
+
+        return 0;
+    }
+
+    /**
+     * @brief Build a stage from its function index and raw parameters
+     *
+     * @return false if the index or the parameters are invalid
+     */
+    static bool makeStage(unsigned int index, const std::vector<uint8_t> &raw, int interval, bool runOnce, FuncDef &f, std::string &error)
+    {
+        if (index >= sizeof(pipelineFuncs) / sizeof(FuncDef))
+        {
+            error = "unknown pipeline function " + std::to_string(index);
+            return false;
+        }
+
+        f = pipelineFuncs[index];
+        f.interval = interval;
+        f.schedule = StageSchedule::everyMs(interval > 0 ? interval : 0);
+        f.runOnce = runOnce;
+        f.state = std::make_shared<StageState>();
+
+        std::string decodeError;
+        if (!f.decode(raw, f.params, decodeError))
+        {
+            error = std::string(f.name) + ": " + decodeError;
+            return false;
+        }
+
+        if (f.init != nullptr)
+        {
+            f.state->runtime = f.init(f.params, decodeError);
+            if (f.state->runtime == nullptr)
+            {
+                error = std::string(f.name) + ": " + decodeError;
+                return false;
+            }
+        }
+
+        f.raw = raw;
+        return true;
+    }
+
+    /**
+     * @brief Replace the whole stage list in one publish. Build `funcs` with `makeStage`.
+     *
+     * @return 0 on success. -1 if a stage cannot take the image it would get (see `check`), the list is unchanged.
+     */
+    int load(const std::vector<FuncDef> &funcs)
+    {
+        // Cleared before the publish, see `add`
+        bool wasFinished = false;
+        bool loaded = update([&](FuncList &current)
+                             {
+            current = funcs;
+            for (const FuncDef &f : funcs)
+            {
+                if (f.runOnce)
+                    wasFinished = runOnceFinished.exchange(false) || wasFinished;
+            }
+
+            return true; });
+
+        if (!loaded)
+        {
+            if (wasFinished)
+                runOnceFinished = true;
+
+            return -1;
+        }
+
+        return 0;
+    }
+
+    /**
+     * @brief Hold off planning by other threads, e.g. to `check` and `load` lists of several pipelines as one
+     * operation. This thread's own edits still plan; the camera thread keeps the published list meanwhile.
+     */
+    std::unique_lock<std::recursive_mutex> lockPlanning()
+    {
+        return std::unique_lock<std::recursive_mutex>(planMutex);
+    }
+
+    /**
+     * @brief Whether `load(funcs)` would succeed, without loading anything
+     */
+    bool check(const std::vector<FuncDef> &funcs, std::string &error)
+    {
+        std::lock_guard<std::recursive_mutex> lock(planMutex);
+        return walk(funcs, inputShape, error);
+    }
+
+    int removeAt(unsigned int index)
+    {
+        bool removed = update([&](FuncList &funcs)
+                              {
+            if (index >= funcs.size())
+            {
+                setError("stage " + std::to_string(index) + " is out of range");
+                return false;
+            }
+
+            funcs.erase(funcs.begin() + index);
+            return true; });
+
+        return removed ? 0 : -1;
+    }
+
+    /**
+     * @brief Skip the stage at `at` on frames a `changeGate` stage found unchanged. Takes effect from the next frame.
+     */
+    int setGated(unsigned int at, bool gated)
+    {
+        bool changed = update([&](FuncList &funcs)
+                              {
+            if (at >= funcs.size())
+            {
+                setError("stage " + std::to_string(at) + " is out of range");
+                return false;
+            }
+
+            funcs[at].gated = gated;
+            return true; });
+
+        return changed ? 0 : -1;
+    }
+
+    /**
+     * @brief Set one parameter of the stage at `at` by its schema name, e.g. `threshold` of `cvThreshold`. `value` is
+     * written like a recipe parameter. Takes effect from the next frame.
+     *
+     * Publishes a new list like every edit: the running frame keeps the parameters it started with and the camera
+     * thread never waits, so this can follow a slider. Statistics, schedules and the stage's runtime state are kept;
+     * the state is only rebuilt when it no longer fits the new parameters (`StageRuntime::fits`).
+     *
+     * @return 0 on success. -1 if there is no such stage or field, the value does not fit it, or the stage cannot take
+     * its image with it (see `plan`); `getError()` holds the reason.
+     */
+    int setParam(unsigned int at, const std::string &field, const std::string &value)
+    {
+        std::shared_ptr<StageState> state;
+        std::shared_ptr<StageRuntime> runtime;
+        bool changed = update([&](FuncList &funcs)
+                              {
+            if (at >= funcs.size())
+            {
+                setError("stage " + std::to_string(at) + " is out of range");
+                return false;
+            }
+
+            FuncDef &f = funcs[at];
+            std::vector<uint8_t> raw = f.raw;
+            StageParams params;
+            std::string paramError;
+            if (!PipelineRecipe::setField(f.schema, raw, field, value, paramError) || !f.decode(raw, params, paramError))
+            {
+                setError(std::string(f.name) + ": " + paramError);
+                return false;
+            }
+
+            std::shared_ptr<StageRuntime> current = std::atomic_load(&f.state->runtime);
+            if (f.init != nullptr && (current == nullptr || !current->fits(params)))
+            {
+                runtime = f.init(params, paramError);
+                if (runtime == nullptr)
+                {
+                    setError(std::string(f.name) + ": " + paramError);
+                    return false;
+                }
+
+                state = f.state;
+            }
+
+            f.raw = std::move(raw);
+            f.params = std::move(params);
+            return true; });
+
+        // Not before the publish: a rejected edit keeps the old state
+        if (changed && state != nullptr)
+            std::atomic_store(&state->runtime, runtime);
+
+        return changed ? 0 : -1;
+    }
+
+    /**
+     * @brief Change when the stage at `at` runs. Takes effect from the next frame.
+     */
+    int setSchedule(unsigned int at, const StageSchedule &schedule)
+    {
+        bool changed = update([&](FuncList &funcs)
+                              {
+            if (at >= funcs.size())
+            {
+                setError("stage " + std::to_string(at) + " is out of range");
+                return false;
+            }
+
+            FuncDef &f = funcs[at];
+            f.schedule = schedule;
+            f.interval = schedule.cadence == StageSchedule::EveryMs ? schedule.period : 0;
+            f.state->schedule.generation.fetch_add(1, std::memory_order_relaxed);
+            f.state->schedule.due.store(false, std::memory_order_relaxed);
+            return true; });
+
+        return changed ? 0 : -1;
+    }
+
+    /**
+     * @brief Run stages [from, to) once on the current image, e.g. to tune a frozen frame
+     *
+     * With checkpoints (`setCheckpointBudget`), a run from 0 keeps the input and the output of every stage, and a run
+     * from k starts from the latest valid checkpoint before k; `from` is set to the first stage that actually ran.
+     */
+    int runOnce(FvTexture *fv, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel, int &from, int &to)
+    {
+        std::shared_ptr<const FuncList> funcs = snapshot();
+        if (registers != nullptr)
+            fv->registers = registers;
+
+        if (to == -1 || to >= funcs->size())
+            to = funcs->size();
+
+        bool checkpointing = checkpoints.enabled();
+        std::vector<uint64_t> signatures;
+        if (checkpointing)
+        {
+            signatures = stageSignatures(*funcs);
+            if (from <= 0)
+            {
+                checkpoints.clear();
+                checkpoints.put(StageCheckpoints::INPUT, 0, fv->cvImage, fv->sceneChanged);
+            }
+            else
+            {
+                cv::Mat image;
+                bool sceneChanged = true;
+                int k = checkpoints.restore(std::min(from, (int)funcs->size()) - 1, signatures, image, sceneChanged);
+                if (k >= StageCheckpoints::INPUT)
+                {
+                    fv->cvImage = image;
+                    fv->sceneChanged = sceneChanged;
+                    from = k + 1;
+                }
+            }
+        }
+
+        for (int i = from; i < to; i++)
+        {
+            // printf("Run:%s\n", funcs[i].name);
+            const FuncDef &f = funcs->at(i);
+            if (skipElided(f, fv->cvImage))
+                continue;
+
+            try
+            {
+                setError("");
+                if (f.func == PipelineFuncBranch)
+                {
+                    bool ranOnce = false;
+                    size_t join = nextStage(*funcs, i + 1, to, PipelineFuncJoin);
+                    if (runBranches(*funcs, i, join, scheduler.currentFrame(), fv, registrar, models, flChannel, ranOnce, false) != 0)
+                        return -1;
+
+                    i = join;
+                    if (checkpointing && join < funcs->size())
+                        checkpoints.put(join, signatures[join], fv->cvImage, fv->sceneChanged);
+
+                    continue;
+                }
+
+                // Checkpoints hold references: never write into them
+                if (checkpointing && f.access == StageAccess::Write && isShared(fv->cvImage))
+                    fv->cvImage = fv->cvImage.clone();
+
+                // Never into plan buffers, the camera thread writes the frames it publishes there
+                runStage(f, fv, registrar, models, flChannel, false);
+                if (checkpointing)
+                    checkpoints.put(i, signatures[i], fv->cvImage, fv->sceneChanged);
+            }
+            catch (std::exception &e)
+            {
+                f.state->stats.error();
+                setError(e.what());
+                return -1;
+            }
+        }
+
+        return 0;
+    }
+
+    /**
+     * @brief Memory for `runOnce` checkpoints in bytes, 0 (default) disables them
+     */
+    void setCheckpointBudget(size_t bytes)
+    {
+        checkpoints.setBudget(bytes);
+    }
+
+    /**
+     * @brief Register file shared by the pipelines of the camera, and the stream register this pipeline's input frames
+     * are published to (`RegisterFile::RGB`, `DEPTH` or `IR`)
+     */
+    void setRegisters(RegisterFile *file, unsigned int stream)
+    {
+        std::lock_guard<std::recursive_mutex> lock(planMutex);
+        registers = file;
+        inputRegister = stream;
+        if (registers != nullptr)
+            registers->want(streamReads(*snapshot()));
+    }
+
+    int run(FvTexture *fv, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
+    {
+        if (registers != nullptr)
+        {
+            fv->registers = registers;
+            registers->publish(inputRegister, fv->cvImage);
+        }
+
+        // The first frame and video mode changes replan the list for the new shape
+        ImageShape shape = ImageShape::of(fv->cvImage);
+        if (shape != lastInput)
+        {
+            lastInput = shape;
+            replanPending = true;
+        }
+
+        if (replanPending || finishedPending.load(std::memory_order_relaxed))
+            maintain();
+
+        // Picks up edits published since the last frame
+        std::shared_ptr<const FuncList> funcs = snapshot();
+        int64_t frameStart = getMonotonicNs();
+        uint64_t frame = scheduler.beginFrame(funcs);
+        fv->sceneChanged = true;
+
+        size_t end = segmentEnd(*funcs, 0);
+        if (end < funcs->size())
+            syncWorkers(*funcs, fv, registrar, models, flChannel);
+        else if (!workers.empty())
+            stopWorkers();
+
+        bool ranOnce = false;
+        if (runSegment(*funcs, 0, end, frame, fv, registrar, models, flChannel, ranOnce) != 0)
+            return -1;
+
+        if (ranOnce)
+            finishedPending = true;
+
+        if (end < funcs->size())
+            handOff(*workers[0], fv->cvImage, fv->sceneChanged, funcs, frame, frameStart, false);
+        else
+            frameStats.record(getMonotonicNs() - frameStart, 0, 0);
+
+        return 0;
+    }
+
+    void clear()
+    {
+        update([](FuncList &funcs)
+               {
+            funcs.clear();
+            return true; });
+    }
+
+    /**
+     * @brief Make every millisecond-scheduled stage due on the next frame
+     */
+    void reset()
+    {
+        std::shared_ptr<const FuncList> funcs = snapshot();
+        for (int i = 0; i < funcs->size(); i++)
+        {
+            funcs->at(i).state->schedule.due.store(true, std::memory_order_relaxed);
+        }
+    }
+
+    bool checkRunOnceFinished()
+    {
+        return runOnceFinished.exchange(false);
+    }
+
+    std::string getPipelineInfo()
+    {
+        std::shared_ptr<const FuncList> funcs = snapshot();
+        std::string info;
+
+        for (int i = 0; i < funcs->size(); i++)
+        {
+            info += funcs->at(i).name;
             info += " => ";
         }
 
         return info;
     }
 
+    /**
+     * @brief Snapshot of per-stage counters. The last entry is the whole pipeline ("frame").
+     *
+     * @param resetAfter clear all counters after reading
+     */
+    std::vector<StageStatsSnapshot> getPipelineStats(bool resetAfter = false)
+    {
+        std::shared_ptr<const FuncList> funcs = snapshot();
+        std::vector<StageStatsSnapshot> stats;
+
+        for (int i = 0; i < funcs->size(); i++)
+        {
+            StageStats &s = funcs->at(i).state->stats;
+            stats.push_back(s.snapshot(funcs->at(i).name));
+            if (resetAfter)
+                s.reset();
+        }
+
+        stats.push_back(frameStats.snapshot("frame"));
+        if (resetAfter)
+            frameStats.reset();
+
+        return stats;
+    }
+
+    /**
+     * @brief Replan the published list for input images of `shape`
+     *
+     * @param strict keep the current plan if a stage cannot take the image it would get. Otherwise the list is
+     * planned up to that stage and `getError()` names it.
+     * @return 0 on success, -1 if a stage cannot take the image it would get
+     */
+    int plan(const ImageShape &shape, bool strict = true)
+    {
+        std::lock_guard<std::recursive_mutex> lock(planMutex);
+        ImageShape previous = inputShape;
+        inputShape = shape;
+
+        bool planned = update([](FuncList &funcs)
+                              { return true; }, strict);
+        if (!planned)
+            inputShape = previous;
+
+        return planned ? 0 : -1;
+    }
+
+    /**
+     * @brief Shape of the image after every stage of the published list, for input images of `shape` (unknown: the
+     * shape the list is planned for). "unknown" after stages whose output cannot be told in advance, "elided" for
+     * stages the camera makes unnecessary.
+     *
+     * @return false if a stage cannot take the image it would get, `error` says which and why
+     */
+    bool describePlan(const ImageShape &shape, std::vector<std::string> &shapes, std::string &error)
+    {
+        std::shared_ptr<const FuncList> list = snapshot();
+        std::lock_guard<std::recursive_mutex> lock(planMutex);
+        std::vector<StagePlan> plan;
+        bool ok = walk(*list, shape.known() ? shape : inputShape, error, &plan);
+        for (size_t i = 0; i < plan.size(); i++)
+            shapes.push_back(std::string(list->at(i).name) + " " + (plan[i].elided ? "elided" : plan[i].shape.str()));
+
+        return ok;
+    }
+
+    /**
+     * @brief Stream the first stages of the published list would rather get from the camera: BGR color if the list
+     * starts with an RGB/BGR swap, the size of a following resize. Cameras pick a matching profile when they start
+     * streaming, so the source delivers what those stages would produce and they are elided.
+     */
+    StreamRequest streamRequest()
+    {
+        std::shared_ptr<const FuncList> list = snapshot();
+        StreamRequest request;
+        size_t i = 0;
+        if (i < list->size() && isColorSwap(list->at(i)))
+        {
+            request.bgr = true;
+            i++;
+        }
+
+        if (i < list->size() && list->at(i).func == PipelineFuncOpencvResize && runsEveryFrame(list->at(i)))
+        {
+            const cv::Size &size = std::get<ResizeParams>(list->at(i).params).size;
+            request.width = size.width;
+            request.height = size.height;
+        }
+
+        return request;
+    }
+
+    /**
+     * @brief What the camera delivers from now on, replans the list. Only `bgr` matters: frames already in BGR order
+     * elide a leading swap stage. Sizes come with the frames.
+     */
+    void setSource(const StreamRequest &delivered)
+    {
+        std::lock_guard<std::recursive_mutex> lock(planMutex);
+        if (delivered == source)
+            return;
+
+        source = delivered;
+        update([](FuncList &funcs)
+               { return true; }, false);
+    }
+
+    std::string getError()
+    {
+        std::lock_guard<std::mutex> lock(errorMutex);
+        return error;
+    }
+
 private:
-    std::vector<FuncDef> funcs = {};
-    int64_t ts = 0;
+    typedef std::vector<FuncDef> FuncList;
+
+    std::shared_ptr<const FuncList> funcs = std::make_shared<const FuncList>();
     cv::Mat *imgPtr;
     cv::Mat img;
 
-    bool runOnceFinished = true;
-    bool isRunning = false;
+    std::atomic<bool> runOnceFinished{true};
+    StageStats frameStats;
+
+    struct FrameJob
+    {
+        cv::Mat image;
+        std::shared_ptr<const FuncList> funcs;
+        uint64_t frame = 0;
+        int64_t start = 0;
+        bool sceneChanged = true;
+    };
+
+    struct SegmentWorker
+    {
+        SpscQueue<FrameJob> queue;
+        FvTexture texture{};
+        // Image of the current frame as it came out of the queue. Goes back into the queue slot for the next frame.
+        cv::Mat input;
+        std::thread thread;
+
+        SegmentWorker(size_t queueSize) : queue(queueSize) {}
+    };
+
+    // Owned by the camera thread, which is the only caller of `run`
+    std::vector<std::unique_ptr<SegmentWorker>> workers;
+    FlTextureRegistrar *workerRegistrar = nullptr;
+    std::vector<TFLiteModel *> *workerModels = nullptr;
+    FlMethodChannel *workerChannel = nullptr;
+
+    StageScheduler scheduler;
+    StageCheckpoints checkpoints;
+    RegisterFile *registers = nullptr;
+    unsigned int inputRegister = RegisterFile::CUR;
+
+    std::mutex errorMutex;
+    std::string error = "";
+
+    // Serializes planning (`update`), which owns `inputShape`, `source` and `planBuffers`
+    std::recursive_mutex planMutex;
+    ImageShape inputShape;
+    StreamRequest source;
+    PlanBuffers planBuffers;
+    // Shape of the last frame `run` saw and whether the list still has to be planned for it, camera thread only
+    ImageShape lastInput;
+    bool replanPending = false;
+    // A run-once stage finished, it is dropped from the list by the next `maintain`
+    std::atomic<bool> finishedPending{false};
+
+    std::shared_ptr<const FuncList> snapshot() const
+    {
+        return std::atomic_load(&funcs);
+    }
+
+    /**
+     * @brief Copy the published list, apply `edit`, plan the copy and publish it. `planMutex` is held throughout, so
+     * editors run one after the other and never lose an update. `edit` returns false to abandon the change.
+     *
+     * @param strict abandon the change if the plan fails. Otherwise it is published anyway, with `getError()` set.
+     */
+    template <typename Edit>
+    bool update(Edit edit, bool strict = true)
+    {
+        std::lock_guard<std::recursive_mutex> lock(planMutex);
+        auto next = std::make_shared<FuncList>(*snapshot());
+        if (!edit(*next))
+            return false;
+
+        fuseElementwise(*next);
+
+        std::string planError;
+        std::vector<StagePlan> plan;
+        planBuffers.begin();
+        if (!walk(*next, inputShape, planError, &plan, &planBuffers))
+        {
+            setError(planError);
+            if (strict)
+                return false;
+        }
+        planBuffers.end();
+
+        for (size_t i = 0; i < next->size(); i++)
+        {
+            (*next)[i].output = plan[i].output;
+            (*next)[i].elided = plan[i].elided;
+        }
+
+        std::shared_ptr<const FuncList> published = std::move(next);
+        std::atomic_store(&funcs, published);
+        if (registers != nullptr)
+            registers->want(streamReads(*published));
+
+        return true;
+    }
+
+    /**
+     * @brief Camera thread: replan for the shape of the last frame and drop finished run-once stages. Does nothing if
+     * an editor is planning, `run` tries again with the next frame and the published list runs meanwhile.
+     */
+    void maintain()
+    {
+        std::unique_lock<std::recursive_mutex> lock(planMutex, std::try_to_lock);
+        if (!lock.owns_lock())
+            return;
+
+        if (replanPending)
+        {
+            inputShape = lastInput;
+            replanPending = false;
+        }
+
+        bool dropFinished = finishedPending.exchange(false);
+        update([dropFinished](FuncList &funcs)
+               {
+            if (dropFinished)
+                funcs.erase(std::remove_if(funcs.begin(), funcs.end(), [](const FuncDef &f)
+                                           { return f.state->finished.load(std::memory_order_relaxed); }),
+                            funcs.end());
+            return true; }, false);
+
+        if (dropFinished)
+            runOnceFinished = true;
+    }
+
+    /**
+     * @brief Stream registers read by register stages of `funcs`, one bit per register id
+     */
+    static unsigned int streamReads(const FuncList &funcs)
+    {
+        unsigned int mask = 0;
+        for (const FuncDef &f : funcs)
+        {
+            if (f.func != PipelineFuncRegister)
+                continue;
+
+            const RegisterParams &p = std::get<RegisterParams>(f.params);
+            for (unsigned int r : {p.a, p.b})
+            {
+                if (!RegisterFile::writable(r))
+                    mask |= 1u << r;
+            }
+        }
+
+        return mask;
+    }
+
+    static bool isFusable(const FuncDef &f)
+    {
+        return runsEveryFrame(f) && FusedKernel::fusable(f.params);
+    }
+
+    /**
+     * @brief Attach a FusedKernel to the first stage of every run of two or more fusable stages
+     */
+    static void fuseElementwise(FuncList &funcs)
+    {
+        for (FuncDef &f : funcs)
+        {
+            f.fused = nullptr;
+            f.fusedCount = 0;
+        }
+
+        for (size_t i = 0; i < funcs.size();)
+        {
+            size_t end = i;
+            while (end < funcs.size() && end - i < FusedKernel::MAX_OPS && isFusable(funcs[end]))
+                end++;
+
+            if (end - i >= 2)
+            {
+                std::vector<StageParams> ops;
+                for (size_t j = i; j < end; j++)
+                    ops.push_back(funcs[j].params);
+
+                funcs[i].fused = std::make_shared<const FusedKernel>(ops);
+                funcs[i].fusedCount = end - i;
+                i = end;
+            }
+            else
+                i = end > i ? end : i + 1;
+        }
+    }
+
+    static bool runsEveryFrame(const FuncDef &f)
+    {
+        return f.schedule.cadence == StageSchedule::Always && !f.runOnce && !f.gated;
+    }
+
+    static bool isColorSwap(const FuncDef &f)
+    {
+        return f.func == PipelineFuncOpencvCvtColor && std::get<CodeParams>(f.params).code == cv::COLOR_RGB2BGR && runsEveryFrame(f);
+    }
+
+    /**
+     * @brief Whether an elided stage can be skipped for `image`. A resize is elided for the planned input shape and
+     * still runs on frames of another size, until the camera thread replans for them.
+     */
+    static bool skipElided(const FuncDef &f, const cv::Mat &image)
+    {
+        if (!f.elided)
+            return false;
+
+        return f.func != PipelineFuncOpencvResize || image.size() == std::get<ResizeParams>(f.params).size;
+    }
+
+    /**
+     * @brief Carry `input` through the stages. A stage that does not run on every frame and changes the shape makes
+     * the shape unknown; stages after an unknown shape are not checked.
+     *
+     * Stages whose result the source already delivers are elided: a leading RGB/BGR swap when the camera delivers BGR
+     * (`source`), and a resize to the size the image already has.
+     *
+     * @param plan receives the plan of every stage
+     * @param buffers reserve the output buffers of the Replace stages from `buffers`
+     * @return false at the first stage that cannot take its input, `error` says which and why
+     */
+    bool walk(const FuncList &funcs, const ImageShape &input, std::string &error, std::vector<StagePlan> *plan = nullptr, PlanBuffers *buffers = nullptr)
+    {
+        if (plan != nullptr)
+            plan->assign(funcs.size(), StagePlan{});
+
+        // Buffers are per scope: a segment, or one branch of it (branch 0 is the segment outside branches)
+        unsigned int segment = 0, branch = 0, branches = 0;
+        ImageShape shape = input, parent;
+        for (size_t i = 0; i < funcs.size(); i++)
+        {
+            const FuncDef &f = funcs[i];
+            bool elided = false;
+            if (f.func == PipelineFuncSegment)
+            {
+                segment++;
+                branch = branches = 0;
+            }
+            else if (f.func == PipelineFuncBranch)
+            {
+                // Every branch starts from the image before the first one
+                if (branch == 0)
+                    parent = shape;
+
+                shape = parent;
+                branch = ++branches;
+            }
+            else if (f.func == PipelineFuncJoin)
+            {
+                if (branch != 0)
+                    shape = parent;
+
+                branch = 0;
+            }
+            else if (i == 0 && source.bgr && isColorSwap(f))
+                elided = true;
+            else if (shape.known())
+            {
+                ImageShape out = shape;
+                std::string why;
+                if (f.infer != nullptr && !f.infer(f.params, out, why))
+                {
+                    error = "stage " + std::to_string(i) + " (" + f.name + ") " + why;
+                    return false;
+                }
+
+                bool everyFrame = runsEveryFrame(f);
+                if (f.func == PipelineFuncOpencvResize && everyFrame && out == shape)
+                    elided = true;
+                else if (buffers != nullptr && f.access == StageAccess::Replace && everyFrame && out.known())
+                    (*plan)[i].output = buffers->next(segment, branch, out);
+
+                shape = everyFrame || out == shape ? out : ImageShape{};
+            }
+
+            if (plan != nullptr)
+            {
+                (*plan)[i].shape = shape;
+                (*plan)[i].elided = elided;
+            }
+        }
+
+        return true;
+    }
+
+    /**
+     * @brief Run the fused stages starting at `head`
+     *
+     * @return false if the kernel does not support the image, the stages then run one by one
+     */
+    bool runFused(const FuncDef &f, const FuncList &funcs, size_t head, FvTexture *fv, bool copyOnWrite, const cv::Mat *planned)
+    {
+        if (copyOnWrite && isShared(fv->cvImage, planned))
+            fv->cvImage = fv->cvImage.clone();
+
+        uint64_t bytesIn = imageBytes(fv->cvImage);
+        int64_t start = getMonotonicNs();
+        if (!f.fused->apply(fv->cvImage))
+            return false;
+
+        f.state->stats.record(getMonotonicNs() - start, bytesIn, imageBytes(fv->cvImage));
+
+        // Absorbed stages count the call, the time is on the head stage
+        for (size_t j = head + 1; j < head + f.fusedCount; j++)
+            funcs[j].state->stats.record(0, 0, 0);
+
+        return true;
+    }
+
+    void setError(const std::string &e)
+    {
+        std::lock_guard<std::mutex> lock(errorMutex);
+        error = e;
+    }
+
+    static uint64_t imageBytes(const cv::Mat &m)
+    {
+        return m.total() * m.elemSize();
+    }
+
+    /**
+     * @brief Run stages [from, to) of one frame
+     *
+     * @param frame frame number from `StageScheduler::beginFrame`
+     * @param ranOnce set if a run-once stage finished
+     * @param copyOnWrite clone a shared image before a stage that writes into it. A plan buffer this segment wrote the
+     * image into is not shared.
+     * @param usePlan write Replace stages into their plan buffers and branches into their StageState texture. Off for
+     * `runOnce`, which runs beside the camera thread.
+     */
+    int runSegment(const FuncList &funcs, size_t from, size_t to, uint64_t frame, FvTexture *fv, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel, bool &ranOnce, bool copyOnWrite = false, bool usePlan = true)
+    {
+        const cv::Mat *planned = nullptr;
+        for (size_t i = from; i < to; i++)
+        {
+            const FuncDef &f = funcs[i];
+            if (f.func == PipelineFuncBranch)
+            {
+                size_t join = nextStage(funcs, i + 1, to, PipelineFuncJoin);
+                if (runBranches(funcs, i, join, frame, fv, registrar, models, flChannel, ranOnce, usePlan) != 0)
+                    return -1;
+
+                // Continue after the join stage
+                i = join;
+                continue;
+            }
+
+            // A finished run-once stage stays in the list until the camera thread drops it
+            if (skipElided(f, fv->cvImage) || f.state->finished.load(std::memory_order_relaxed) || !StageScheduler::due(f, frame))
+            {
+                f.state->stats.skip();
+                continue;
+            }
+
+            if (f.gated && !fv->sceneChanged)
+            {
+                f.state->stats.skip();
+                if (f.replay != nullptr)
+                    replayStage(f, fv, flChannel);
+
+                continue;
+            }
+
+            try
+            {
+                if (f.fused != nullptr && runFused(f, funcs, i, fv, copyOnWrite, planned))
+                {
+                    i += f.fusedCount - 1;
+                    continue;
+                }
+
+                // printf("[Run] %s\n", f.name);
+                if (copyOnWrite && f.access == StageAccess::Write && isShared(fv->cvImage, planned))
+                    fv->cvImage = fv->cvImage.clone();
+
+                runStage(f, fv, registrar, models, flChannel, usePlan);
+                if (f.output != nullptr && fv->cvImage.u == f.output->u)
+                    planned = f.output.get();
+
+                if (f.runOnce)
+                {
+                    f.state->finished.store(true, std::memory_order_relaxed);
+                    ranOnce = true;
+                }
+            }
+            catch (std::exception &e)
+            {
+                f.state->stats.error();
+                setError(e.what());
+                std::cout << "[Pipeline Error]" << f.name << ":" << e.what() << std::endl;
+                return -1;
+            }
+        }
+
+        return 0;
+    }
+
+    /**
+     * @brief Run the branches in [from, to) concurrently. `from` is a branch stage.
+     */
+    int runBranches(const FuncList &funcs, size_t from, size_t to, uint64_t frame, FvTexture *fv, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel, bool &ranOnce, bool usePlan = true)
+    {
+        WaitGroup group;
+        std::atomic<int> failed{0};
+        std::atomic<bool> anyRanOnce{false};
+
+        for (size_t b = from; b < to;)
+        {
+            size_t next = nextStage(funcs, b + 1, to, PipelineFuncBranch);
+            auto task = [this, &funcs, b, next, frame, fv, &registrar, models, flChannel, &failed, &anyRanOnce, usePlan]
+            {
+                bool branchRanOnce = false;
+                if (runBranch(funcs, b, next, frame, fv, registrar, models, flChannel, branchRanOnce, usePlan) != 0)
+                    failed.fetch_add(1);
+
+                if (branchRanOnce)
+                    anyRanOnce = true;
+            };
+
+            // The calling thread takes the last branch itself
+            if (next == to)
+                task();
+            else
+            {
+                group.add(1);
+                WorkerPool::shared().submit([task, &group]
+                                            {
+                    task();
+                    group.done(); });
+            }
+
+            b = next;
+        }
+
+        group.wait();
+        if (anyRanOnce)
+            ranOnce = true;
+
+        return failed.load() == 0 ? 0 : -1;
+    }
+
+    int runBranch(const FuncList &funcs, size_t branch, size_t to, uint64_t frame, FvTexture *fv, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel, bool &ranOnce, bool usePlan = true)
+    {
+        const FuncDef &f = funcs[branch];
+        std::unique_ptr<FvTexture> own = usePlan ? nullptr : std::make_unique<FvTexture>();
+        FvTexture &texture = usePlan ? f.state->branchTexture : *own;
+        texture.cvImage = fv->cvImage;
+        texture.owner = fv->owner != nullptr ? fv->owner : fv;
+        texture.pipeline = this;
+        texture.models = fv->models;
+        texture.registers = fv->registers;
+        texture.sceneChanged = fv->sceneChanged;
+
+        int64_t start = getMonotonicNs();
+        int ret = runSegment(funcs, branch + 1, to, frame, &texture, registrar, models, flChannel, ranOnce, true, usePlan);
+        f.state->stats.record(getMonotonicNs() - start, imageBytes(fv->cvImage), imageBytes(texture.cvImage));
+
+        // Drop the reference so the parent image is unshared again after the join
+        texture.cvImage.release();
+        return ret;
+    }
+
+    /**
+     * @brief Index of the first `func` stage in [from, to), or `to`
+     */
+    static size_t nextStage(const FuncList &funcs, size_t from, size_t to, decltype(FuncDef::func) func)
+    {
+        for (size_t i = from; i < to; i++)
+        {
+            if (funcs[i].func == func)
+                return i;
+        }
+
+        return to;
+    }
+
+    /**
+     * @brief Whether writing into `m` would be visible through another header. Images wrapping external (SDK)
+     * memory are not reference counted and always treated as shared.
+     *
+     * @param planned plan buffer the caller wrote `m` into, its header in the plan does not count
+     */
+    static bool isShared(const cv::Mat &m, const cv::Mat *planned = nullptr)
+    {
+        int owners = planned != nullptr && m.u != nullptr && planned->u == m.u ? 2 : 1;
+        return !m.empty() && (m.u == nullptr || m.u->refcount > owners);
+    }
+    /**
+     * @brief Index of the first segment stage at or after `from`, or the list size
+     */
+    static size_t segmentEnd(const FuncList &funcs, size_t from)
+    {
+        for (size_t i = from; i < funcs.size(); i++)
+        {
+            if (funcs[i].func == PipelineFuncSegment)
+                return i;
+        }
+
+        return funcs.size();
+    }
+
+    /**
+     * @brief (Re)start one worker per segment stage if the segment layout of `funcs` changed
+     */
+    void syncWorkers(const FuncList &funcs, FvTexture *fv, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel)
+    {
+        size_t count = 0;
+        bool same = true;
+        for (size_t i = segmentEnd(funcs, 0); i < funcs.size(); i = segmentEnd(funcs, i + 1))
+        {
+            unsigned int queueSize = std::get<SegmentParams>(funcs[i].params).queueSize;
+            if (count >= workers.size() || workers[count]->queue.capacity() != queueSize)
+                same = false;
+
+            count++;
+        }
+
+        if (same && count == workers.size() && workers[0]->texture.owner == fv)
+            return;
+
+        stopWorkers();
+
+        workerRegistrar = &registrar;
+        workerModels = models;
+        workerChannel = flChannel;
+        for (size_t i = segmentEnd(funcs, 0); i < funcs.size(); i = segmentEnd(funcs, i + 1))
+        {
+            auto w = std::make_unique<SegmentWorker>(std::get<SegmentParams>(funcs[i].params).queueSize);
+            w->texture.owner = fv;
+            w->texture.pipeline = this;
+            w->texture.models = fv->models;
+            w->texture.registers = fv->registers;
+            workers.push_back(std::move(w));
+        }
+
+        for (size_t k = 0; k < workers.size(); k++)
+            workers[k]->thread = std::thread(&Pipeline::workerLoop, this, k);
+    }
+
+    void stopWorkers()
+    {
+        for (auto &w : workers)
+            w->queue.close();
+
+        for (auto &w : workers)
+        {
+            if (w->thread.joinable())
+                w->thread.join();
+        }
+
+        workers.clear();
+    }
+
+    /**
+     * @brief Queue a frame for a worker. Blocks while the worker's queue is full.
+     *
+     * @param move swap the image into the slot instead of copying it. Only for images the caller owns; camera images
+     * may wrap SDK memory that is reused for the next frame. Shared images (plan buffers) are copied anyway.
+     */
+    void handOff(SegmentWorker &w, cv::Mat &image, bool sceneChanged, const std::shared_ptr<const FuncList> &funcs, uint64_t frame, int64_t start, bool move)
+    {
+        FrameJob *job = w.queue.beginPush();
+        if (job == nullptr)
+            return;
+
+        // Slots keep their buffers, so neither path allocates once the frame size is stable
+        if (move && !isShared(image))
+            std::swap(job->image, image);
+        else
+        {
+            // Never copy into memory someone else still uses
+            if (isShared(job->image))
+                job->image.release();
+
+            image.copyTo(job->image);
+        }
+
+        job->funcs = funcs;
+        job->sceneChanged = sceneChanged;
+        job->frame = frame;
+        job->start = start;
+        w.queue.commitPush();
+    }
+
+    void workerLoop(size_t k)
+    {
+        SegmentWorker &w = *workers[k];
+        FrameJob *job;
+
+        while ((job = w.queue.front()) != nullptr)
+        {
+            std::swap(w.input, job->image);
+            w.texture.cvImage = w.input;
+            w.texture.sceneChanged = job->sceneChanged;
+            std::shared_ptr<const FuncList> funcs = std::move(job->funcs);
+            uint64_t frame = job->frame;
+            int64_t start = job->start;
+            w.queue.pop();
+
+            // Stages after the k-th segment stage, up to the next one
+            size_t from = segmentEnd(*funcs, 0);
+            for (size_t i = 0; i < k && from < funcs->size(); i++)
+                from = segmentEnd(*funcs, from + 1);
+
+            if (from >= funcs->size())
+                continue;
+
+            size_t to = segmentEnd(*funcs, from + 1);
+            bool ranOnce = false;
+            int ret = runSegment(*funcs, from + 1, to, frame, &w.texture, *workerRegistrar, workerModels, workerChannel, ranOnce);
+            // Removed by the camera thread with its next frame
+            if (ranOnce)
+                finishedPending = true;
+
+            if (ret != 0)
+                continue;
+
+            if (k + 1 < workers.size())
+            {
+                // Still the input buffer (no stage replaced it): move it on and keep the buffer that comes back
+                cv::Mat &out = w.texture.cvImage;
+                bool own = out.u != nullptr && out.u == w.input.u;
+                if (own)
+                    w.input.release();
+
+                handOff(*workers[k + 1], out, w.texture.sceneChanged, funcs, frame, start, true);
+                if (own)
+                    w.input = out;
+            }
+            else
+                frameStats.record(getMonotonicNs() - start, 0, 0);
+        }
+    }
+
+    /**
+     * @brief Signature of the stages up to each one, from their identity (state) and parameters. Changes when a stage
+     * at or before it is added, removed, replaced or edited.
+     */
+    static std::vector<uint64_t> stageSignatures(const FuncList &funcs)
+    {
+        std::vector<uint64_t> signatures;
+        // FNV-1a
+        uint64_t h = 1469598103934665603ULL;
+        auto mix = [&h](const void *data, size_t len)
+        {
+            for (size_t i = 0; i < len; i++)
+                h = (h ^ ((const uint8_t *)data)[i]) * 1099511628211ULL;
+        };
+
+        for (const FuncDef &f : funcs)
+        {
+            const StageState *state = f.state.get();
+            mix(&state, sizeof(state));
+            mix(&f.index, sizeof(f.index));
+            mix(f.raw.data(), f.raw.size());
+            signatures.push_back(h);
+        }
+
+        return signatures;
+    }
+
+    /**
+     * @brief Send the last results of a gated stage again, with its runtime state
+     */
+    void replayStage(const FuncDef &f, FvTexture *fv, FlMethodChannel *flChannel)
+    {
+        std::shared_ptr<StageRuntime> runtime = std::atomic_load(&f.state->runtime);
+        fv->runtime = runtime.get();
+        try
+        {
+            f.replay(fv, f.params, flChannel);
+        }
+        catch (...)
+        {
+            fv->runtime = nullptr;
+            throw;
+        }
+
+        fv->runtime = nullptr;
+    }
+
+    /**
+     * @param planned write Replace stages into their plan buffer
+     */
+    void runStage(const FuncDef &f, FvTexture *fv, FlTextureRegistrar &registrar, std::vector<TFLiteModel *> *models, FlMethodChannel *flChannel, bool planned = true)
+    {
+        uint64_t bytesIn = imageBytes(fv->cvImage);
+        // Not when the input is in the buffer too, i.e. the stage before it was skipped
+        fv->output = planned && f.output != nullptr && f.output->u != fv->cvImage.u ? f.output.get() : nullptr;
+        std::shared_ptr<StageRuntime> runtime = std::atomic_load(&f.state->runtime);
+        fv->runtime = runtime.get();
+        int64_t start = getMonotonicNs();
+        try
+        {
+            f.func(fv, f.params, registrar, models, flChannel);
+        }
+        catch (...)
+        {
+            fv->output = nullptr;
+            fv->runtime = nullptr;
+            throw;
+        }
+
+        fv->output = nullptr;
+        fv->runtime = nullptr;
+        f.state->stats.record(getMonotonicNs() - start, bytesIn, imageBytes(fv->cvImage));
+    }
 };
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,151 @@
+#ifndef _DEF_PIPELINE_CHECKPOINT_
+#define _DEF_PIPELINE_CHECKPOINT_
+
+#include <opencv2/core/core.hpp>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <vector>
+
+/**
+ * @brief Images after stages of `Pipeline::runOnce`, so a rerun from stage k starts from the output of stage k - 1
+ * instead of rerunning the stages before it.
+ *
+ * A checkpoint is a reference to the stage's output, not a copy: `runOnce` clones an image before a stage writes into
+ * it while a checkpoint holds it. Each checkpoint carries the signature of the stages up to it (`Pipeline` derives it
+ * from the stage identities and parameters), so an edit before or at a stage invalidates it. Images sharing a buffer
+ * are charged once against the budget; the least recently used checkpoints are evicted beyond it.
+ */
+class StageCheckpoints
+{
+public:
+    // Slot of the pipeline input, before stage 0
+    static const int INPUT = -1;
+
+    /**
+     * @brief Memory limit in bytes, 0 disables checkpoints and drops the ones kept
+     */
+    void setBudget(size_t bytes)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        budget = bytes;
+        evict();
+    }
+
+    bool enabled()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return budget > 0;
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        entries.clear();
+        buffers.clear();
+        used = 0;
+    }
+
+    /**
+     * @brief Keep `image` as the output of stage `stage`. Images wrapping external (SDK) memory are copied.
+     */
+    void put(int stage, uint64_t signature, const cv::Mat &image, bool sceneChanged)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (budget == 0)
+            return;
+
+        drop(stage);
+        Entry &e = entries[stage];
+        e.image = image.u == nullptr ? image.clone() : image;
+        e.signature = signature;
+        e.sceneChanged = sceneChanged;
+        e.lastUse = ++clock;
+        charge(e.image, 1);
+        evict();
+    }
+
+    /**
+     * @brief Latest valid checkpoint at or before `stage`
+     *
+     * @param signatures signature of every stage of the current list
+     * @return the checkpoint's stage (INPUT for the pipeline input), or INPUT - 1 if there is none
+     */
+    int restore(int stage, const std::vector<uint64_t> &signatures, cv::Mat &image, bool &sceneChanged)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int k = stage; k >= INPUT; k--)
+        {
+            auto it = entries.find(k);
+            if (it == entries.end() || it->second.signature != (k == INPUT ? 0 : signatures[k]))
+                continue;
+
+            it->second.lastUse = ++clock;
+            image = it->second.image;
+            sceneChanged = it->second.sceneChanged;
+            return k;
+        }
+
+        return INPUT - 1;
+    }
+
+private:
+    struct Entry
+    {
+        cv::Mat image;
+        uint64_t signature = 0;
+        bool sceneChanged = true;
+        uint64_t lastUse = 0;
+    };
+
+    std::mutex mutex;
+    size_t budget = 0;
+    size_t used = 0;
+    uint64_t clock = 0;
+    std::map<int, Entry> entries;
+    // Checkpoints per buffer, a buffer is charged while at least one holds it
+    std::map<const cv::UMatData *, int> buffers;
+
+    void charge(const cv::Mat &m, int delta)
+    {
+        if (m.u == nullptr)
+            return;
+
+        int &count = buffers[m.u];
+        if (count == 0 && delta > 0)
+            used += m.u->size;
+
+        count += delta;
+        if (count == 0)
+        {
+            used -= m.u->size;
+            buffers.erase(m.u);
+        }
+    }
+
+    void drop(int stage)
+    {
+        auto it = entries.find(stage);
+        if (it == entries.end())
+            return;
+
+        charge(it->second.image, -1);
+        entries.erase(it);
+    }
+
+    void evict()
+    {
+        while (!entries.empty() && used > budget)
+        {
+            auto oldest = entries.begin();
+            for (auto it = entries.begin(); it != entries.end(); ++it)
+            {
+                if (it->second.lastUse < oldest->second.lastUse)
+                    oldest = it;
+            }
+
+            drop(oldest->first);
+        }
+    }
+};
+#endif
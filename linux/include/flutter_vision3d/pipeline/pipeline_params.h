@@ -0,0 +1,766 @@
+#ifndef _DEF_PIPELINE_PARAMS_
+#define _DEF_PIPELINE_PARAMS_
+
+#include <opencv2/core/core.hpp>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <variant>
+#include <vector>
+#include "pixel_convert.h"
+#include "register_file.h"
+
+/*
+ * Typed stage parameters. Dart sends every stage's parameters as a byte list; Pipeline::add decodes and validates
+ * them once into one of these structs so the per-frame call only reads plain fields.
+ */
+
+struct NoParams
+{
+};
+
+struct ByteParams
+{
+    uint8_t value = 0;
+};
+
+struct CodeParams
+{
+    int code = 0;
+};
+
+struct PathParams
+{
+    std::string path;
+};
+
+struct ConvertToParams
+{
+    int rtype = -1;
+    float scale = 1.0f;
+    float shift = 0.0f;
+};
+
+struct ResizeParams
+{
+    cv::Size size;
+    int interpolation = 0;
+};
+
+struct CropParams
+{
+    cv::Range cols;
+    cv::Range rows;
+};
+
+struct ShapeParams
+{
+    cv::Point p1;
+    cv::Point p2;
+    cv::Scalar color;
+    int thickness = 1;
+    int lineType = 8;
+    int shift = 0;
+};
+
+struct TensorInputParams
+{
+    unsigned int modelIndex = 0;
+    unsigned int tensorIndex = 0;
+    unsigned int dataType = 0;
+};
+
+struct InferenceParams
+{
+    unsigned int modelIndex = 0;
+};
+
+struct CustomHandlerParams
+{
+    int size = 0;
+};
+
+struct NormalizeParams
+{
+    float alpha = 1.0f;
+    float beta = 0.0f;
+    int normType = 0;
+    int dType = -1;
+};
+
+struct ThresholdParams
+{
+    float threshold = 0.0f;
+    float max = 0.0f;
+    int type = 0;
+};
+
+struct ShowParams
+{
+    // PixelConvert::Format of the image
+    unsigned int format = PixelConvert::Auto;
+    // DepthZ16 only
+    std::shared_ptr<const std::vector<uint32_t>> depthLut = nullptr;
+};
+
+/**
+ * @brief Depth range of `depthClip` and `depthMask`, in millimeters
+ */
+struct DepthRangeParams
+{
+    uint16_t min = 0;
+    uint16_t max = 0;
+    // depthMask: mask the pixels outside the range instead
+    bool invert = false;
+};
+
+struct DepthColorizeParams
+{
+    std::shared_ptr<const std::vector<uint32_t>> lut = nullptr;
+};
+
+/**
+ * @brief Operands of `regCopy` and `regOp`, register ids of `RegisterFile`
+ */
+struct RegisterParams
+{
+    enum Op
+    {
+        Copy = 0,
+        Add = 1,
+        Subtract = 2,
+        AbsDiff = 3,
+        And = 4,
+        Or = 5,
+        Xor = 6,
+        Min = 7,
+        Max = 8,
+        // a where b (single channel) is nonzero, 0 elsewhere
+        Mask = 9,
+        // a * alpha + b * (1 - alpha)
+        Blend = 10,
+    };
+
+    unsigned int op = Copy;
+    unsigned int a = RegisterFile::CUR;
+    unsigned int b = RegisterFile::CUR;
+    unsigned int dst = RegisterFile::CUR;
+    float alpha = 0.5f;
+};
+
+struct ReluParams
+{
+    uchar threshold = 0;
+};
+
+struct ZeroDepthFilterParams
+{
+    int threshold = 0;
+    int halfRange = 0;
+};
+
+struct CopyToParams
+{
+    cv::Mat *dst = nullptr;
+};
+
+struct SegmentParams
+{
+    unsigned int queueSize = 2;
+};
+
+struct PluginStageParams
+{
+    std::string name;
+    // Passed to the stage's `init`
+    std::vector<uint8_t> config;
+};
+
+struct StaticPipelineParams
+{
+    std::string name;
+};
+
+struct BatchInferenceParams
+{
+    unsigned int modelIndex = 0;
+    unsigned int tensorIndex = 0;
+    unsigned int maxBatch = 1;
+    unsigned int deadlineMs = 0;
+};
+
+struct ChangeGateParams
+{
+    enum Mode
+    {
+        // Intensity difference of the downsampled grayscale frame
+        FrameDifference = 0,
+        // Depth change of the downsampled depth frame, holes ignored
+        DepthOccupancy = 1,
+    };
+
+    unsigned int mode = FrameDifference;
+    // Per cell: intensity levels, or millimeters for DepthOccupancy
+    float threshold = 0.0f;
+    // Fraction of cells over `threshold` that counts as a change
+    float minChanged = 0.0f;
+    unsigned int scale = 1;
+    // Frames the gate stays open after the last change
+    unsigned int hold = 0;
+};
+
+typedef std::variant<NoParams, ByteParams, CodeParams, PathParams, ConvertToParams, ResizeParams, CropParams, ShapeParams,
+                     TensorInputParams, InferenceParams, CustomHandlerParams, NormalizeParams, ThresholdParams, ReluParams,
+                     ZeroDepthFilterParams, CopyToParams, SegmentParams, BatchInferenceParams,
+                     PluginStageParams, ChangeGateParams, ShowParams, DepthRangeParams, DepthColorizeParams,
+                     RegisterParams, StaticPipelineParams>
+    StageParams;
+
+typedef bool (*ParamDecoder)(const std::vector<uint8_t> &raw, StageParams &out, std::string &error);
+
+namespace ParamReader
+{
+    inline bool require(const std::vector<uint8_t> &raw, size_t len, std::string &error)
+    {
+        if (raw.size() >= len)
+            return true;
+
+        error = "expected " + std::to_string(len) + " parameter bytes, got " + std::to_string(raw.size());
+        return false;
+    }
+
+    // Floats are sent in host byte order (see `_float2uint8`)
+    inline float f32(const std::vector<uint8_t> &raw, size_t offset)
+    {
+        float f;
+        memcpy(&f, raw.data() + offset, sizeof(float));
+        return f;
+    }
+
+    inline int u16(const std::vector<uint8_t> &raw, size_t offset)
+    {
+        return (raw[offset] << 8) + raw[offset + 1];
+    }
+
+    // Dart packs `-1` into a Uint8List as 0xff
+    inline int i8(const std::vector<uint8_t> &raw, size_t offset)
+    {
+        return (int8_t)raw[offset];
+    }
+}
+
+inline bool decodeNoParams(const std::vector<uint8_t> &raw, StageParams &out, std::string &error)
+{
+    out = NoParams{};
+    return true;
+}
+
+inline bool decodeByteParams(const std::vector<uint8_t> &raw, StageParams &out, std::string &error)
+{
+    if (!ParamReader::require(raw, 1, error))
+        return false;
+
+    out = ByteParams{raw[0]};
+    return true;
+}
+
+inline bool decodeCodeParams(const std::vector<uint8_t> &raw, StageParams &out, std::string &error)
+{
+    if (!ParamReader::require(raw, 1, error))
+        return false;
+
+    out = CodeParams{raw[0]};
+    return true;
+}
+
+inline bool decodeRotateParams(const std::vector<uint8_t> &raw, StageParams &out, std::string &error)
+{
+    if (!ParamReader::require(raw, 1, error))
+        return false;
+
+    if (raw[0] > 2)
+    {
+        error = "invalid rotate code " + std::to_string(raw[0]);
+        return false;
+    }
+
+    out = CodeParams{raw[0]};
+    return true;
+}
+
+/**
+ * @param raw first byte is length of file path string
+ */
+inline bool decodePathParams(const std::vector<uint8_t> &raw, StageParams &out, std::string &error)
+{
+    if (!ParamReader::require(raw, 1, error) || !ParamReader::require(raw, 1 + raw[0], error))
+        return false;
+
+    if (raw[0] == 0)
+    {
+        error = "empty path";
+        return false;
+    }
+
+    out = PathParams{std::string(raw.begin() + 1, raw.begin() + 1 + raw[0])};
+    return true;
+}
+
+/**
+ * @param raw 0: convert type, 1~4: scale (float), 5~8: shift (float)
+ */
+inline bool decodeConvertToParams(const std::vector<uint8_t> &raw, StageParams &out, std::string &error)
+{
+    if (!ParamReader::require(raw, 9, error))
+        return false;
+
+    out = ConvertToParams{raw[0], ParamReader::f32(raw, 1), ParamReader::f32(raw, 5)};
+    return true;
+}
+
+/**
+ * @param raw [0-1]: width, [2-3]: height [4]: mode
+ */
+inline bool decodeResizeParams(const std::vector<uint8_t> &raw, StageParams &out, std::string &error)
+{
+    if (!ParamReader::require(raw, 5, error))
+        return false;
+
+    ResizeParams p;
+    p.size = cv::Size(ParamReader::u16(raw, 0), ParamReader::u16(raw, 2));
+    p.interpolation = raw[4];
+    if (p.size.width <= 0 || p.size.height <= 0)
+    {
+        error = "resize size must be positive";
+        return false;
+    }
+
+    out = p;
+    return true;
+}
+
+/**
+ * @param raw xStart, xEnd, yStart, yEnd: each contains 2 bytes
+ */
+inline bool decodeCropParams(const std::vector<uint8_t> &raw, StageParams &out, std::string &error)
+{
+    if (!ParamReader::require(raw, 8, error))
+        return false;
+
+    CropParams p;
+    p.cols = cv::Range(ParamReader::u16(raw, 0), ParamReader::u16(raw, 2));
+    p.rows = cv::Range(ParamReader::u16(raw, 4), ParamReader::u16(raw, 6));
+    if (p.cols.start >= p.cols.end || p.rows.start >= p.rows.end)
+    {
+        error = "crop range is empty";
+        return false;
+    }
+
+    out = p;
+    return true;
+}
+
+/**
+ * @param raw x1, y1, x2, y2 (float), r, g, b, alpha, thickness, lineType, [shift]
+ */
+inline bool decodeShapeParams(const std::vector<uint8_t> &raw, StageParams &out, std::string &error)
+{
+    if (!ParamReader::require(raw, 22, error))
+        return false;
+
+    ShapeParams p;
+    p.p1 = cv::Point(ParamReader::f32(raw, 0), ParamReader::f32(raw, 4));
+    p.p2 = cv::Point(ParamReader::f32(raw, 8), ParamReader::f32(raw, 12));
+    p.color = cv::Scalar(raw[18], raw[17], raw[16], raw[19]);
+    p.thickness = raw[20];
+    p.lineType = raw[21];
+    p.shift = raw.size() > 22 ? raw[22] : 0;
+
+    out = p;
+    return true;
+}
+
+/**
+ * @param raw model index, tensor index, data type (0: uint8, 1: float)
+ */
+inline bool decodeTensorInputParams(const std::vector<uint8_t> &raw, StageParams &out, std::string &error)
+{
+    if (!ParamReader::require(raw, 3, error))
+        return false;
+
+    if (raw[2] > 1)
+    {
+        error = "unknown tensor data type " + std::to_string(raw[2]);
+        return false;
+    }
+
+    out = TensorInputParams{raw[0], raw[1], raw[2]};
+    return true;
+}
+
+inline bool decodeInferenceParams(const std::vector<uint8_t> &raw, StageParams &out, std::string &error)
+{
+    if (!ParamReader::require(raw, 1, error))
+        return false;
+
+    out = InferenceParams{raw[0]};
+    return true;
+}
+
+/**
+ * @param raw [0-1]: size of result array
+ */
+inline bool decodeCustomHandlerParams(const std::vector<uint8_t> &raw, StageParams &out, std::string &error)
+{
+    if (!ParamReader::require(raw, 2, error))
+        return false;
+
+    int size = ParamReader::u16(raw, 0);
+    if (size <= 0)
+    {
+        error = "result size must be positive";
+        return false;
+    }
+
+    out = CustomHandlerParams{size};
+    return true;
+}
+
+/**
+ * @param raw alpha, beta (float), normType, dType
+ */
+inline bool decodeNormalizeParams(const std::vector<uint8_t> &raw, StageParams &out, std::string &error)
+{
+    if (!ParamReader::require(raw, 10, error))
+        return false;
+
+    out = NormalizeParams{ParamReader::f32(raw, 0), ParamReader::f32(raw, 4), raw[8], ParamReader::i8(raw, 9)};
+    return true;
+}
+
+/**
+ * @param raw threshold, max (float), type
+ */
+inline bool decodeThresholdParams(const std::vector<uint8_t> &raw, StageParams &out, std::string &error)
+{
+    if (!ParamReader::require(raw, 9, error))
+        return false;
+
+    out = ThresholdParams{ParamReader::f32(raw, 0), ParamReader::f32(raw, 4), raw[8]};
+    return true;
+}
+
+/**
+ * @param raw threshold (float, 0.0 ~ 1.0)
+ */
+inline bool decodeReluParams(const std::vector<uint8_t> &raw, StageParams &out, std::string &error)
+{
+    if (!ParamReader::require(raw, 4, error))
+        return false;
+
+    float threshold = ParamReader::f32(raw, 0);
+    if (!(threshold >= 0.0f && threshold <= 1.0f))
+    {
+        error = "relu threshold must be within [0, 1]";
+        return false;
+    }
+
+    out = ReluParams{static_cast<uchar>(threshold * 255.0)};
+    return true;
+}
+
+/**
+ * @param raw threshold, half range of the kernel
+ */
+inline bool decodeZeroDepthFilterParams(const std::vector<uint8_t> &raw, StageParams &out, std::string &error)
+{
+    if (!ParamReader::require(raw, 2, error))
+        return false;
+
+    out = ZeroDepthFilterParams{raw[0], raw[1]};
+    return true;
+}
+
+/**
+ * @param raw address of destination cv::Mat, 8 bytes big endian
+ */
+inline bool decodeCopyToParams(const std::vector<uint8_t> &raw, StageParams &out, std::string &error)
+{
+    if (!ParamReader::require(raw, 8, error))
+        return false;
+
+    uint64_t pointer = 0;
+    for (int i = 0; i < 8; i++)
+        pointer = (pointer << 8) + raw[i];
+
+    if (pointer == 0)
+    {
+        error = "destination Mat is null";
+        return false;
+    }
+
+    std::uintptr_t p = pointer;
+    out = CopyToParams{(cv::Mat *)p};
+    return true;
+}
+
+/**
+ * @param raw [queue size (1 ~ 16)], frames buffered in front of the segment. Defaults to 2.
+ */
+inline bool decodeSegmentParams(const std::vector<uint8_t> &raw, StageParams &out, std::string &error)
+{
+    SegmentParams p;
+    if (!raw.empty())
+        p.queueSize = raw[0];
+
+    if (p.queueSize < 1 || p.queueSize > 16)
+    {
+        error = "segment queue size must be within [1, 16]";
+        return false;
+    }
+
+    out = p;
+    return true;
+}
+
+inline bool decodeBatchInferenceParams(const std::vector<uint8_t> &raw, StageParams &out, std::string &error)
+{
+    if (!ParamReader::require(raw, 4, error))
+        return false;
+
+    if (raw[2] < 1 || raw[2] > 64)
+    {
+        error = "batch size must be within [1, 64]";
+        return false;
+    }
+
+    out = BatchInferenceParams{raw[0], raw[1], raw[2], raw[3]};
+    return true;
+}
+
+/**
+ * @param raw 0: name length, name of a pipeline registered with `StaticPipelineRegistry`
+ */
+inline bool decodeStaticPipelineParams(const std::vector<uint8_t> &raw, StageParams &out, std::string &error)
+{
+    if (!ParamReader::require(raw, 1, error) || !ParamReader::require(raw, 1 + raw[0], error))
+        return false;
+
+    StaticPipelineParams p;
+    p.name = std::string(raw.begin() + 1, raw.begin() + 1 + raw[0]);
+    out = p;
+    return true;
+}
+
+/**
+ * @param raw 0: name length, name, the rest is passed to the stage's `init`
+ */
+inline bool decodePluginStageParams(const std::vector<uint8_t> &raw, StageParams &out, std::string &error)
+{
+    if (!ParamReader::require(raw, 1, error) || !ParamReader::require(raw, 1 + raw[0], error))
+        return false;
+
+    size_t offset = 1 + raw[0];
+    PluginStageParams p;
+    p.name = std::string(raw.begin() + 1, raw.begin() + offset);
+    p.config.assign(raw.begin() + offset, raw.end());
+    out = p;
+    return true;
+}
+
+/**
+ * @param raw mode, threshold (float), minChanged (float, 0.0 ~ 1.0), downsample factor, [hold frames]
+ */
+inline bool decodeChangeGateParams(const std::vector<uint8_t> &raw, StageParams &out, std::string &error)
+{
+    if (!ParamReader::require(raw, 10, error))
+        return false;
+
+    ChangeGateParams p;
+    p.mode = raw[0];
+    p.threshold = ParamReader::f32(raw, 1);
+    p.minChanged = ParamReader::f32(raw, 5);
+    p.scale = raw[9];
+    p.hold = raw.size() > 10 ? raw[10] : 0;
+    if (p.mode > ChangeGateParams::DepthOccupancy)
+    {
+        error = "unknown change gate mode " + std::to_string(p.mode);
+        return false;
+    }
+
+    if (!(p.minChanged >= 0.0f && p.minChanged <= 1.0f))
+    {
+        error = "minChanged must be within [0, 1]";
+        return false;
+    }
+
+    if (p.scale < 1)
+    {
+        error = "downsample factor must be at least 1";
+        return false;
+    }
+
+    out = p;
+    return true;
+}
+
+/**
+ * @param raw [format], [color map (255: grayscale)], [min depth (mm, u16)], [max depth (mm, u16)]. Defaults: Auto,
+ * COLORMAP_JET, 0 ~ 4000 mm
+ */
+inline bool decodeShowParams(const std::vector<uint8_t> &raw, StageParams &out, std::string &error)
+{
+    ShowParams p;
+    p.format = raw.size() > 0 ? raw[0] : PixelConvert::Auto;
+    if (p.format > PixelConvert::DepthZ16)
+    {
+        error = "unknown texture format " + std::to_string(p.format);
+        return false;
+    }
+
+    if (p.format == PixelConvert::DepthZ16)
+    {
+        int colorMap = raw.size() > 1 ? raw[1] : cv::COLORMAP_JET;
+        unsigned int min = raw.size() > 3 ? ParamReader::u16(raw, 2) : 0;
+        unsigned int max = raw.size() > 5 ? ParamReader::u16(raw, 4) : 4000;
+        if (min >= max)
+        {
+            error = "min depth must be less than max depth";
+            return false;
+        }
+
+        try
+        {
+            p.depthLut = PixelConvert::sharedDepthLut(colorMap, min, max);
+        }
+        catch (cv::Exception &e)
+        {
+            // Unknown color map
+            error = e.what();
+            return false;
+        }
+    }
+
+    out = p;
+    return true;
+}
+
+/**
+ * @param raw min depth (mm, u16), max depth (mm, u16), [invert]
+ */
+inline bool decodeDepthRangeParams(const std::vector<uint8_t> &raw, StageParams &out, std::string &error)
+{
+    if (!ParamReader::require(raw, 4, error))
+        return false;
+
+    DepthRangeParams p;
+    p.min = ParamReader::u16(raw, 0);
+    p.max = ParamReader::u16(raw, 2);
+    p.invert = raw.size() > 4 && raw[4] != 0;
+    if (p.min > p.max)
+    {
+        error = "min depth must not be greater than max depth";
+        return false;
+    }
+
+    out = p;
+    return true;
+}
+
+/**
+ * @param raw color map (255: grayscale), min depth (mm, u16), max depth (mm, u16)
+ */
+inline bool decodeDepthColorizeParams(const std::vector<uint8_t> &raw, StageParams &out, std::string &error)
+{
+    if (!ParamReader::require(raw, 5, error))
+        return false;
+
+    unsigned int min = ParamReader::u16(raw, 1);
+    unsigned int max = ParamReader::u16(raw, 3);
+    if (min >= max)
+    {
+        error = "min depth must be less than max depth";
+        return false;
+    }
+
+    DepthColorizeParams p;
+    try
+    {
+        p.lut = PixelConvert::sharedDepthLut(raw[0], min, max);
+    }
+    catch (cv::Exception &e)
+    {
+        // Unknown color map
+        error = e.what();
+        return false;
+    }
+
+    out = p;
+    return true;
+}
+
+inline bool checkRegisters(const RegisterParams &p, std::string &error)
+{
+    if (!RegisterFile::valid(p.a) || !RegisterFile::valid(p.b) || !RegisterFile::valid(p.dst))
+    {
+        error = "unknown register";
+        return false;
+    }
+
+    if (!RegisterFile::writable(p.dst))
+    {
+        error = "register " + RegisterFile::name(p.dst) + " is read-only";
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @param raw source register, destination register
+ */
+inline bool decodeRegisterCopyParams(const std::vector<uint8_t> &raw, StageParams &out, std::string &error)
+{
+    if (!ParamReader::require(raw, 2, error))
+        return false;
+
+    RegisterParams p;
+    p.a = raw[0];
+    p.b = raw[0];
+    p.dst = raw[1];
+    if (!checkRegisters(p, error))
+        return false;
+
+    out = p;
+    return true;
+}
+
+/**
+ * @param raw RegisterParams::Op, register a, register b, destination register, [alpha (f32), Blend only]
+ */
+inline bool decodeRegisterOpParams(const std::vector<uint8_t> &raw, StageParams &out, std::string &error)
+{
+    if (!ParamReader::require(raw, 4, error))
+        return false;
+
+    RegisterParams p;
+    p.op = raw[0];
+    p.a = raw[1];
+    p.b = raw[2];
+    p.dst = raw[3];
+    if (p.op > RegisterParams::Blend)
+    {
+        error = "unknown register operation " + std::to_string(p.op);
+        return false;
+    }
+
+    if (p.op == RegisterParams::Blend && raw.size() >= 8)
+        p.alpha = ParamReader::f32(raw, 4);
+
+    if (!checkRegisters(p, error))
+        return false;
+
+    out = p;
+    return true;
+}
+#endif
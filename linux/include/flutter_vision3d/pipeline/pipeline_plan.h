@@ -0,0 +1,209 @@
+#ifndef _DEF_PIPELINE_PLAN_
+#define _DEF_PIPELINE_PLAN_
+
+#include <opencv2/core/core.hpp>
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+#include "../fv_texture.h"
+#include "pipeline_params.h"
+
+/**
+ * @brief Size and type of the image between two stages. Unknown (type -1) before the first frame and after stages
+ * whose output cannot be told in advance (`imread`, a resize that does not run every frame).
+ */
+struct ImageShape
+{
+    cv::Size size = cv::Size(0, 0);
+    int type = -1;
+
+    static ImageShape of(const cv::Mat &m)
+    {
+        ImageShape s;
+        if (!m.empty())
+        {
+            s.size = m.size();
+            s.type = m.type();
+        }
+
+        return s;
+    }
+
+    bool known() const
+    {
+        return type >= 0;
+    }
+
+    bool operator==(const ImageShape &o) const
+    {
+        return size == o.size && type == o.type;
+    }
+
+    bool operator!=(const ImageShape &o) const
+    {
+        return !(*this == o);
+    }
+
+    // e.g. "8UC3"
+    static std::string typeName(int type)
+    {
+        static const char *depths[] = {"8U", "8S", "16U", "16S", "32S", "32F", "64F", "16F"};
+        return std::string(depths[CV_MAT_DEPTH(type)]) + "C" + std::to_string(CV_MAT_CN(type));
+    }
+
+    // e.g. "640x480 8UC3"
+    std::string str() const
+    {
+        if (!known())
+            return "unknown";
+
+        return std::to_string(size.width) + "x" + std::to_string(size.height) + " " + typeName(type);
+    }
+};
+
+/**
+ * @brief What the first stages of a pipeline want from the camera, see `Pipeline::streamRequest`. 0 / false: no
+ * preference. Cameras tell the pipeline what they deliver with the same struct (`Pipeline::setSource`).
+ */
+struct StreamRequest
+{
+    int width = 0;
+    int height = 0;
+    // Color frames in BGR instead of RGB order
+    bool bgr = false;
+
+    bool operator==(const StreamRequest &o) const
+    {
+        return width == o.width && height == o.height && bgr == o.bgr;
+    }
+
+    bool operator!=(const StreamRequest &o) const
+    {
+        return !(*this == o);
+    }
+};
+
+/**
+ * @brief Planned view of one stage
+ */
+struct StagePlan
+{
+    // Shape after the stage
+    ImageShape shape;
+    // Output buffer, Replace stages only
+    std::shared_ptr<cv::Mat> output = nullptr;
+    // The source already delivers what the stage would produce, it is skipped
+    bool elided = false;
+};
+
+/**
+ * @brief Output shape of a stage from its input shape
+ *
+ * @return false if the stage cannot take an image of this shape, `error` says why
+ */
+typedef bool (*ShapeInference)(const StageParams &params, ImageShape &shape, std::string &error);
+
+/**
+ * @brief Output buffers of the stages that replace the image (StageAccess::Replace), reserved when the pipeline is
+ * planned.
+ *
+ * Buffers come in pairs per scope and shape. A scope is the part of the list one thread runs at a time: a segment, or
+ * one branch of it. Consecutive replacing stages of a scope take turns on the pair, so a stage never writes into the
+ * buffer its input is in. Scopes never share buffers, so segments and branches running concurrently do not either.
+ * Replanning keeps the buffers of scopes and shapes that are still used; a running frame keeps writing into the same
+ * memory.
+ */
+class PlanBuffers
+{
+public:
+    /**
+     * @brief Start assigning the buffers of a new plan
+     */
+    void begin()
+    {
+        for (auto &entry : pairs)
+        {
+            entry.second.turn = 0;
+            entry.second.used = false;
+        }
+    }
+
+    /**
+     * @brief Buffer for the next replacing stage of the scope (`segment`, `branch`) with output `shape`, allocated if new
+     */
+    std::shared_ptr<cv::Mat> next(unsigned int segment, unsigned int branch, const ImageShape &shape)
+    {
+        Pair &pair = pairs[std::make_tuple(segment, branch, shape.size.width, shape.size.height, shape.type)];
+        std::shared_ptr<cv::Mat> &buffer = pair.buffers[pair.turn];
+        if (buffer == nullptr)
+            buffer = std::make_shared<cv::Mat>(shape.size, shape.type);
+
+        pair.turn ^= 1;
+        pair.used = true;
+        return buffer;
+    }
+
+    /**
+     * @brief Free the buffers the new plan did not assign
+     */
+    void end()
+    {
+        for (auto it = pairs.begin(); it != pairs.end();)
+            it = it->second.used ? std::next(it) : pairs.erase(it);
+    }
+
+private:
+    struct Pair
+    {
+        std::shared_ptr<cv::Mat> buffers[2];
+        unsigned int turn = 0;
+        bool used = false;
+    };
+
+    std::map<std::tuple<unsigned int, unsigned int, int, int, int>, Pair> pairs;
+};
+
+/**
+ * @brief Image a stage that replaces the image writes into: the buffer the plan reserved for the running stage
+ * (`FvTexture::output`), else `fresh`
+ */
+inline cv::Mat &stageOutput(FvTexture *fv, cv::Mat &fresh)
+{
+    return fv->output != nullptr ? *fv->output : fresh;
+}
+
+namespace ShapeCheck
+{
+    inline bool type(const ImageShape &shape, int type, std::string &error)
+    {
+        if (shape.type == type)
+            return true;
+
+        error = "needs a " + ImageShape::typeName(type) + " image, got " + shape.str();
+        return false;
+    }
+
+    /**
+     * @brief Output shape of an OpenCV call, found by running it once on a blank image of the input shape
+     */
+    template <typename Op>
+    inline bool probe(ImageShape &shape, Op op, std::string &error)
+    {
+        cv::Mat in(shape.size, shape.type, cv::Scalar::all(0));
+        cv::Mat out;
+        try
+        {
+            op(in, out);
+        }
+        catch (cv::Exception &e)
+        {
+            error = "cannot take a " + shape.str() + " image: " + e.what();
+            return false;
+        }
+
+        shape = ImageShape::of(out);
+        return true;
+    }
+}
+#endif
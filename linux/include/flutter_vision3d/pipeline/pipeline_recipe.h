@@ -0,0 +1,263 @@
+#ifndef _DEF_PIPELINE_RECIPE_
+#define _DEF_PIPELINE_RECIPE_
+
+#include <cctype>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "pipeline.h"
+#include "pipeline_schema.h"
+
+/*
+ * Pipeline recipes describe the stage lists of a camera's streams, so a whole configuration is sent with one
+ * `pipelineLoad` call.
+ *
+ * Binary (integers big endian, like the stage parameters):
+ *   "FVP" 0x01 | u16 stage count | stages..., nothing after the last stage
+ *   stage: u8 streams | u8 function index | u8 flags (bit 0: run once, bit 1: gated) | u32 interval (ms, < 2^31) |
+ *          u16 length | parameters
+ *
+ * Text, one stage per line, `#` starts a comment:
+ *   [streams] <function name> [parameters...] [interval=<ms>] [once] [gated]
+ *   streams: `rgb`, `depth`, `ir` or a comma separated combination. Defaults to the stream `pipelineLoad` is called for.
+ *   Parameters follow the function's schema (see `pipelineFuncs`). Strings with spaces are double quoted.
+ *   `gated` skips the stage on frames a `changeGate` stage found unchanged.
+ *
+ * `streams` is a VideoIndex mask, 0 means the default stream.
+ */
+struct RecipeStage
+{
+    unsigned int streams = 0;
+    unsigned int index = 0;
+    std::vector<uint8_t> params;
+    int interval = 0;
+    bool runOnce = false;
+    bool gated = false;
+};
+
+namespace PipelineRecipe
+{
+    const uint8_t MAGIC[4] = {'F', 'V', 'P', 1};
+
+    // Same bits as VideoIndex
+    const unsigned int STREAM_RGB = 0b1;
+    const unsigned int STREAM_DEPTH = 0b10;
+    const unsigned int STREAM_IR = 0b100;
+
+    inline int findFunction(const std::string &name)
+    {
+        for (unsigned int i = 0; i < sizeof(pipelineFuncs) / sizeof(FuncDef); i++)
+        {
+            if (name == pipelineFuncs[i].name)
+                return i;
+        }
+
+        return -1;
+    }
+
+    inline bool parseStreams(const std::string &token, unsigned int &streams)
+    {
+        streams = 0;
+        std::istringstream ss(token);
+        std::string name;
+        while (std::getline(ss, name, ','))
+        {
+            if (name == "rgb")
+                streams |= STREAM_RGB;
+            else if (name == "depth")
+                streams |= STREAM_DEPTH;
+            else if (name == "ir")
+                streams |= STREAM_IR;
+            else
+                return false;
+        }
+
+        return streams != 0;
+    }
+
+    /**
+     * @brief `interval=` value in ms: a decimal integer within [0, INT_MAX]
+     */
+    inline bool parseInterval(const std::string &token, int &interval)
+    {
+        char *end = nullptr;
+        long v = strtol(token.c_str(), &end, 10);
+        if (token.empty() || end == token.c_str() || *end != '\0' || v < 0 || v > INT_MAX)
+            return false;
+
+        interval = v;
+        return true;
+    }
+
+    inline std::vector<std::string> tokenize(const std::string &line)
+    {
+        std::vector<std::string> tokens;
+        size_t i = 0;
+        while (i < line.size())
+        {
+            if (isspace((unsigned char)line[i]))
+            {
+                i++;
+                continue;
+            }
+
+            if (line[i] == '#')
+                break;
+
+            std::string token;
+            if (line[i] == '"')
+            {
+                size_t close = line.find('"', i + 1);
+                if (close == std::string::npos)
+                    close = line.size();
+
+                token = line.substr(i + 1, close - i - 1);
+                i = close + 1;
+            }
+            else
+            {
+                while (i < line.size() && !isspace((unsigned char)line[i]))
+                    token += line[i++];
+            }
+
+            tokens.push_back(token);
+        }
+
+        return tokens;
+    }
+
+    inline bool parseText(const std::string &text, std::vector<RecipeStage> &stages, std::string &error)
+    {
+        std::istringstream lines(text);
+        std::string line;
+        int lineNumber = 0;
+
+        while (std::getline(lines, line))
+        {
+            lineNumber++;
+            std::vector<std::string> tokens = tokenize(line);
+            if (tokens.empty())
+                continue;
+
+            std::string at = "line " + std::to_string(lineNumber) + ": ";
+            RecipeStage stage;
+            size_t t = 0;
+            if (findFunction(tokens[0]) < 0 && parseStreams(tokens[0], stage.streams))
+                t++;
+
+            if (t >= tokens.size() || findFunction(tokens[t]) < 0)
+            {
+                error = at + "unknown pipeline function " + (t < tokens.size() ? tokens[t] : "");
+                return false;
+            }
+
+            stage.index = findFunction(tokens[t++]);
+            std::vector<std::string> values;
+            for (; t < tokens.size(); t++)
+            {
+                if (tokens[t] == "once")
+                    stage.runOnce = true;
+                else if (tokens[t] == "gated")
+                    stage.gated = true;
+                else if (tokens[t].rfind("interval=", 0) == 0)
+                {
+                    if (!parseInterval(tokens[t].substr(9), stage.interval))
+                    {
+                        error = at + "invalid interval " + tokens[t].substr(9);
+                        return false;
+                    }
+                }
+                else
+                    values.push_back(tokens[t]);
+            }
+
+            std::vector<SchemaField> fields = parseSchema(pipelineFuncs[stage.index].schema);
+            if (values.size() > fields.size())
+            {
+                error = at + "too many parameters for " + pipelineFuncs[stage.index].name;
+                return false;
+            }
+
+            for (size_t i = 0; i < fields.size(); i++)
+            {
+                if (i >= values.size())
+                {
+                    if (fields[i].optional)
+                        break;
+
+                    error = at + "missing parameter " + fields[i].name;
+                    return false;
+                }
+
+                std::string fieldError;
+                if (!encodeField(fields[i], values[i], stage.params, fieldError))
+                {
+                    error = at + fieldError;
+                    return false;
+                }
+            }
+
+            stages.push_back(stage);
+        }
+
+        return true;
+    }
+
+    inline bool parseBinary(const uint8_t *data, size_t len, std::vector<RecipeStage> &stages, std::string &error)
+    {
+        if (len < 6 || memcmp(data, MAGIC, sizeof(MAGIC)) != 0)
+        {
+            error = "not a pipeline recipe";
+            return false;
+        }
+
+        size_t count = (data[4] << 8) + data[5];
+        size_t pos = 6;
+        for (size_t i = 0; i < count; i++)
+        {
+            if (pos + 9 > len)
+            {
+                error = "stage " + std::to_string(i) + ": truncated";
+                return false;
+            }
+
+            RecipeStage stage;
+            stage.streams = data[pos];
+            stage.index = data[pos + 1];
+            stage.runOnce = (data[pos + 2] & 1) != 0;
+            stage.gated = (data[pos + 2] & 2) != 0;
+            uint32_t interval = ((uint32_t)data[pos + 3] << 24) + (data[pos + 4] << 16) + (data[pos + 5] << 8) + data[pos + 6];
+            if (interval > INT_MAX)
+            {
+                error = "stage " + std::to_string(i) + ": interval out of range";
+                return false;
+            }
+
+            stage.interval = interval;
+            size_t paramLen = (data[pos + 7] << 8) + data[pos + 8];
+            pos += 9;
+
+            if (pos + paramLen > len)
+            {
+                error = "stage " + std::to_string(i) + ": truncated parameters";
+                return false;
+            }
+
+            stage.params.assign(data + pos, data + pos + paramLen);
+            pos += paramLen;
+            stages.push_back(stage);
+        }
+
+        if (pos != len)
+        {
+            error = std::to_string(len - pos) + " bytes after the last stage";
+            return false;
+        }
+
+        return true;
+    }
+}
+#endif
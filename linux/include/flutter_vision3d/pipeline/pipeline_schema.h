@@ -0,0 +1,228 @@
+#ifndef _DEF_PIPELINE_SCHEMA_
+#define _DEF_PIPELINE_SCHEMA_
+
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "register_file.h"
+
+/*
+ * Stage parameter schemas (`FuncDef::schema`): space separated `name:type` fields, `?` marks trailing optional ones.
+ * Types: u8, i8, u16 and u64 (big endian), f32 (native), str (u8 length and bytes), reg (u8 register id, written as
+ * a `RegisterFile` name or a number). Used by recipes and by `Pipeline::setParam`.
+ */
+struct SchemaField
+{
+    std::string name;
+    std::string type;
+    bool optional = false;
+};
+
+namespace PipelineRecipe
+{
+    inline std::vector<SchemaField> parseSchema(const char *schema)
+    {
+        std::vector<SchemaField> fields;
+        std::istringstream ss(schema);
+        std::string token;
+        while (ss >> token)
+        {
+            SchemaField f;
+            size_t colon = token.find(':');
+            f.name = token.substr(0, colon);
+            f.type = colon == std::string::npos ? "" : token.substr(colon + 1);
+            if (!f.type.empty() && f.type.back() == '?')
+            {
+                f.optional = true;
+                f.type.pop_back();
+            }
+
+            fields.push_back(f);
+        }
+
+        return fields;
+    }
+
+    /**
+     * @brief Append one parameter field, written from text, in the byte layout the stage decoders expect
+     */
+    inline bool encodeField(const SchemaField &field, const std::string &token, std::vector<uint8_t> &raw, std::string &error)
+    {
+        char *end = nullptr;
+        if (field.type == "str")
+        {
+            if (token.size() > 255)
+            {
+                error = field.name + ": string longer than 255 bytes";
+                return false;
+            }
+
+            raw.push_back(token.size());
+            raw.insert(raw.end(), token.begin(), token.end());
+            return true;
+        }
+
+        if (field.type == "f32")
+        {
+            float f = strtof(token.c_str(), &end);
+            if (end == token.c_str() || *end != '\0')
+            {
+                error = field.name + ": '" + token + "' is not a number";
+                return false;
+            }
+
+            uint8_t bytes[sizeof(float)];
+            memcpy(bytes, &f, sizeof(float));
+            raw.insert(raw.end(), bytes, bytes + sizeof(float));
+            return true;
+        }
+
+        if (field.type == "reg")
+        {
+            int r = RegisterFile::parse(token);
+            if (r < 0)
+            {
+                error = field.name + ": unknown register " + token;
+                return false;
+            }
+
+            raw.push_back(r);
+            return true;
+        }
+
+        if (field.type == "u64")
+        {
+            // strtoull takes "-1" and wraps it around
+            errno = 0;
+            unsigned long long u = strtoull(token.c_str(), &end, 0);
+            if (token.find('-') != std::string::npos || end == token.c_str() || *end != '\0')
+            {
+                error = field.name + ": '" + token + "' is not an unsigned integer";
+                return false;
+            }
+
+            if (errno == ERANGE)
+            {
+                error = field.name + ": " + token + " is out of range";
+                return false;
+            }
+
+            for (int i = 7; i >= 0; i--)
+                raw.push_back(u >> (i * 8));
+
+            return true;
+        }
+
+        long long v = strtoll(token.c_str(), &end, 0);
+        if (end == token.c_str() || *end != '\0')
+        {
+            error = field.name + ": '" + token + "' is not an integer";
+            return false;
+        }
+
+        long long min = 0, max = 0;
+        int bytes = 1;
+        if (field.type == "u8")
+            max = 0xff;
+        else if (field.type == "i8")
+            min = -128, max = 127;
+        else if (field.type == "u16")
+            max = 0xffff, bytes = 2;
+        else
+        {
+            error = field.name + ": unknown field type " + field.type;
+            return false;
+        }
+
+        if (v < min || v > max)
+        {
+            error = field.name + ": " + token + " is out of range";
+            return false;
+        }
+
+        for (int i = bytes - 1; i >= 0; i--)
+            raw.push_back((uint64_t)v >> (i * 8));
+
+        return true;
+    }
+
+    /**
+     * @brief Byte range [begin, end) of every field present in `raw`. Trailing optional fields may be missing.
+     */
+    inline bool fieldRanges(const std::vector<SchemaField> &fields, const std::vector<uint8_t> &raw, std::vector<std::pair<size_t, size_t>> &ranges, std::string &error)
+    {
+        size_t pos = 0;
+        for (const SchemaField &f : fields)
+        {
+            if (pos == raw.size() && f.optional)
+                break;
+
+            size_t size = 0;
+            if (f.type == "u8" || f.type == "i8" || f.type == "reg")
+                size = 1;
+            else if (f.type == "u16")
+                size = 2;
+            else if (f.type == "f32")
+                size = 4;
+            else if (f.type == "u64")
+                size = 8;
+            else if (f.type == "str")
+                size = pos < raw.size() ? 1 + raw[pos] : 1;
+
+            if (size == 0 || pos + size > raw.size())
+            {
+                error = f.name + ": parameters too short";
+                return false;
+            }
+
+            ranges.push_back({pos, pos + size});
+            pos += size;
+        }
+
+        return true;
+    }
+
+    /**
+     * @brief Replace the field `name` of `raw` with `token`, written from text like a recipe parameter. A missing
+     * optional field is appended if it is the next one.
+     */
+    inline bool setField(const char *schema, std::vector<uint8_t> &raw, const std::string &name, const std::string &token, std::string &error)
+    {
+        std::vector<SchemaField> fields = parseSchema(schema);
+        size_t k = 0;
+        while (k < fields.size() && fields[k].name != name)
+            k++;
+
+        if (k == fields.size())
+        {
+            error = "no parameter " + name;
+            return false;
+        }
+
+        std::vector<std::pair<size_t, size_t>> ranges;
+        if (!fieldRanges(fields, raw, ranges, error))
+            return false;
+
+        if (k > ranges.size())
+        {
+            error = "set " + fields[ranges.size()].name + " before " + name;
+            return false;
+        }
+
+        std::vector<uint8_t> value;
+        if (!encodeField(fields[k], token, value, error))
+            return false;
+
+        size_t begin = k < ranges.size() ? ranges[k].first : raw.size();
+        size_t end = k < ranges.size() ? ranges[k].second : raw.size();
+        raw.erase(raw.begin() + begin, raw.begin() + end);
+        raw.insert(raw.begin() + begin, value.begin(), value.end());
+        return true;
+    }
+}
+#endif
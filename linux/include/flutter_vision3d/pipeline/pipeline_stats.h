@@ -0,0 +1,189 @@
+#ifndef _DEF_PIPELINE_STATS_
+#define _DEF_PIPELINE_STATS_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+inline int64_t getMonotonicNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct StageStatsSnapshot
+{
+    std::string name;
+    uint64_t calls = 0;
+    uint64_t skips = 0;
+    uint64_t errors = 0;
+    uint64_t bytesIn = 0;
+    uint64_t bytesOut = 0;
+    double meanUs = 0;
+    double maxUs = 0;
+    double p50Us = 0;
+    double p95Us = 0;
+    double p99Us = 0;
+};
+
+/**
+ * @brief Latency and throughput counters of one pipeline stage.
+ *
+ * Written by the camera thread and read by the GTK thread. Every field is a relaxed atomic, so recording never
+ * locks or allocates. Latencies go into a log-linear histogram (8 buckets per power of two microseconds, ~12%
+ * resolution) from which percentiles are estimated on read.
+ */
+class StageStats
+{
+public:
+    static const int SUB_BUCKET_BITS = 3;
+    static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static const int BUCKET_COUNT = 24 * SUB_BUCKETS;
+
+    StageStats()
+    {
+        reset();
+    }
+
+    void record(int64_t ns, uint64_t in, uint64_t out)
+    {
+        if (ns < 0)
+            ns = 0;
+
+        calls.fetch_add(1, std::memory_order_relaxed);
+        totalNs.fetch_add(ns, std::memory_order_relaxed);
+        bytesIn.fetch_add(in, std::memory_order_relaxed);
+        bytesOut.fetch_add(out, std::memory_order_relaxed);
+        histogram[bucketOf(ns / 1000)].fetch_add(1, std::memory_order_relaxed);
+
+        uint64_t prev = maxNs.load(std::memory_order_relaxed);
+        while ((uint64_t)ns > prev && !maxNs.compare_exchange_weak(prev, ns, std::memory_order_relaxed))
+            ;
+    }
+
+    void skip()
+    {
+        skips.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void error()
+    {
+        errors.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void reset()
+    {
+        calls = 0;
+        skips = 0;
+        errors = 0;
+        totalNs = 0;
+        maxNs = 0;
+        bytesIn = 0;
+        bytesOut = 0;
+        for (int i = 0; i < BUCKET_COUNT; i++)
+            histogram[i] = 0;
+    }
+
+    /**
+     * @brief Add the counters of `other`, e.g. the same stage of another pipeline. Percentiles stay exact, the
+     * histograms are summed.
+     */
+    void merge(const StageStats &other)
+    {
+        calls.fetch_add(other.calls.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        skips.fetch_add(other.skips.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        errors.fetch_add(other.errors.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        totalNs.fetch_add(other.totalNs.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        bytesIn.fetch_add(other.bytesIn.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        bytesOut.fetch_add(other.bytesOut.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        for (int i = 0; i < BUCKET_COUNT; i++)
+            histogram[i].fetch_add(other.histogram[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+
+        uint64_t ns = other.maxNs.load(std::memory_order_relaxed);
+        uint64_t prev = maxNs.load(std::memory_order_relaxed);
+        while (ns > prev && !maxNs.compare_exchange_weak(prev, ns, std::memory_order_relaxed))
+            ;
+    }
+
+    StageStatsSnapshot snapshot(const char *name) const
+    {
+        StageStatsSnapshot s;
+        s.name = name;
+        s.calls = calls.load(std::memory_order_relaxed);
+        s.skips = skips.load(std::memory_order_relaxed);
+        s.errors = errors.load(std::memory_order_relaxed);
+        s.bytesIn = bytesIn.load(std::memory_order_relaxed);
+        s.bytesOut = bytesOut.load(std::memory_order_relaxed);
+        s.maxUs = maxNs.load(std::memory_order_relaxed) / 1000.0;
+        if (s.calls > 0)
+            s.meanUs = totalNs.load(std::memory_order_relaxed) / 1000.0 / s.calls;
+
+        uint32_t counts[BUCKET_COUNT];
+        uint64_t total = 0;
+        for (int i = 0; i < BUCKET_COUNT; i++)
+        {
+            counts[i] = histogram[i].load(std::memory_order_relaxed);
+            total += counts[i];
+        }
+
+        s.p50Us = percentile(counts, total, 0.50);
+        s.p95Us = percentile(counts, total, 0.95);
+        s.p99Us = percentile(counts, total, 0.99);
+        return s;
+    }
+
+private:
+    std::atomic<uint64_t> calls;
+    std::atomic<uint64_t> skips;
+    std::atomic<uint64_t> errors;
+    std::atomic<uint64_t> totalNs;
+    std::atomic<uint64_t> maxNs;
+    std::atomic<uint64_t> bytesIn;
+    std::atomic<uint64_t> bytesOut;
+    std::atomic<uint32_t> histogram[BUCKET_COUNT];
+
+    static int bucketOf(uint64_t us)
+    {
+        if (us < SUB_BUCKETS)
+            return (int)us;
+
+        int msb = 63 - __builtin_clzll(us);
+        int sub = (us >> (msb - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+        int index = (msb - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub;
+        return index < BUCKET_COUNT ? index : BUCKET_COUNT - 1;
+    }
+
+    // Midpoint of the bucket in microseconds
+    static double bucketValue(int index)
+    {
+        if (index < SUB_BUCKETS)
+            return index + 0.5;
+
+        int msb = index / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+        int sub = index % SUB_BUCKETS;
+        double lower = (double)((uint64_t)(SUB_BUCKETS + sub) << (msb - SUB_BUCKET_BITS));
+        double width = (double)(1ULL << (msb - SUB_BUCKET_BITS));
+        return lower + width / 2;
+    }
+
+    static double percentile(const uint32_t *counts, uint64_t total, double p)
+    {
+        if (total == 0)
+            return 0;
+
+        uint64_t rank = (uint64_t)(p * total);
+        if (rank >= total)
+            rank = total - 1;
+
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKET_COUNT; i++)
+        {
+            seen += counts[i];
+            if (seen > rank)
+                return bucketValue(i);
+        }
+
+        return bucketValue(BUCKET_COUNT - 1);
+    }
+};
+#endif
@@ -0,0 +1,472 @@
+#ifndef _DEF_PIXEL_CONVERT_
+#define _DEF_PIXEL_CONVERT_
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FV_PIXEL_X86
+#define FV_TARGET(isa) __attribute__((target(isa)))
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define FV_PIXEL_NEON
+#endif
+
+/**
+ * @brief Row kernels converting pipeline images to the RGBA8 layout of Flutter pixel buffer textures, in the same pass
+ * that writes the texture.
+ *
+ * x86 picks AVX2 or SSSE3 kernels at runtime (`kernels()`); ARM uses NEON, which every AArch64 CPU has. Vector loops
+ * leave the last pixels of a row to the scalar kernel. Depth colorizing is a lookup in a 65536 entry table.
+ */
+namespace PixelConvert
+{
+    enum Format
+    {
+        // RGBA8, RGB8, GRAY8 or GRAY16 by the image type
+        Auto = 0,
+        Rgba = 1,
+        Bgr = 2,
+        Rgb = 3,
+        Gray8 = 4,
+        // High byte of each pixel
+        Gray16 = 5,
+        // Colorized through a depth table, see `makeDepthLut`
+        DepthZ16 = 6,
+    };
+
+    typedef void (*Rgb3Row)(const uint8_t *src, uint8_t *dst, int n);
+    typedef void (*Gray8Row)(const uint8_t *src, uint8_t *dst, int n);
+    typedef void (*Gray16Row)(const uint16_t *src, uint8_t *dst, int n);
+
+    struct Kernels
+    {
+        const char *isa;
+        Rgb3Row rgb;
+        Rgb3Row bgr;
+        Gray8Row gray8;
+        Gray16Row gray16;
+    };
+
+    template <bool Swap>
+    inline void rgb3Scalar(const uint8_t *s, uint8_t *d, int i, int n)
+    {
+        for (; i < n; i++)
+        {
+            d[4 * i] = s[3 * i + (Swap ? 2 : 0)];
+            d[4 * i + 1] = s[3 * i + 1];
+            d[4 * i + 2] = s[3 * i + (Swap ? 0 : 2)];
+            d[4 * i + 3] = 255;
+        }
+    }
+
+    inline void gray8Scalar(const uint8_t *s, uint8_t *d, int i, int n)
+    {
+        for (; i < n; i++)
+        {
+            d[4 * i] = d[4 * i + 1] = d[4 * i + 2] = s[i];
+            d[4 * i + 3] = 255;
+        }
+    }
+
+    inline void gray16Scalar(const uint16_t *s, uint8_t *d, int i, int n)
+    {
+        for (; i < n; i++)
+        {
+            d[4 * i] = d[4 * i + 1] = d[4 * i + 2] = s[i] >> 8;
+            d[4 * i + 3] = 255;
+        }
+    }
+
+    template <bool Swap>
+    inline void rgb3Plain(const uint8_t *s, uint8_t *d, int n) { rgb3Scalar<Swap>(s, d, 0, n); }
+    inline void gray8Plain(const uint8_t *s, uint8_t *d, int n) { gray8Scalar(s, d, 0, n); }
+    inline void gray16Plain(const uint16_t *s, uint8_t *d, int n) { gray16Scalar(s, d, 0, n); }
+
+#ifdef FV_PIXEL_X86
+    /*
+     * SSSE3: 16 pixels per step. Three 16 byte loads hold 16 RGB pixels; `alignr` lines up each group of four at byte
+     * 0 and one `pshufb` spreads it to RGBA.
+     */
+    template <bool Swap>
+    FV_TARGET("ssse3")
+    inline void rgb3Ssse3(const uint8_t *s, uint8_t *d, int n)
+    {
+        const __m128i shuffle = Swap ? _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1)
+                                     : _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+        const __m128i alpha = _mm_set1_epi32((int)0xff000000);
+        int i = 0;
+        for (; i + 16 <= n; i += 16)
+        {
+            __m128i a = _mm_loadu_si128((const __m128i *)(s + 3 * i));
+            __m128i b = _mm_loadu_si128((const __m128i *)(s + 3 * i + 16));
+            __m128i c = _mm_loadu_si128((const __m128i *)(s + 3 * i + 32));
+            __m128i *out = (__m128i *)(d + 4 * i);
+            _mm_storeu_si128(out, _mm_or_si128(_mm_shuffle_epi8(a, shuffle), alpha));
+            _mm_storeu_si128(out + 1, _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(b, a, 12), shuffle), alpha));
+            _mm_storeu_si128(out + 2, _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(c, b, 8), shuffle), alpha));
+            _mm_storeu_si128(out + 3, _mm_or_si128(_mm_shuffle_epi8(_mm_srli_si128(c, 4), shuffle), alpha));
+        }
+
+        rgb3Scalar<Swap>(s, d, i, n);
+    }
+
+    // Writes the RGBA of 16 gray pixels
+    FV_TARGET("ssse3")
+    inline void gray8x16Ssse3(__m128i v, uint8_t *d)
+    {
+        const __m128i ones = _mm_set1_epi8((char)0xff);
+        __m128i vvLo = _mm_unpacklo_epi8(v, v);
+        __m128i vaLo = _mm_unpacklo_epi8(v, ones);
+        __m128i vvHi = _mm_unpackhi_epi8(v, v);
+        __m128i vaHi = _mm_unpackhi_epi8(v, ones);
+        __m128i *out = (__m128i *)d;
+        _mm_storeu_si128(out, _mm_unpacklo_epi16(vvLo, vaLo));
+        _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(vvLo, vaLo));
+        _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(vvHi, vaHi));
+        _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(vvHi, vaHi));
+    }
+
+    FV_TARGET("ssse3")
+    inline void gray8Ssse3(const uint8_t *s, uint8_t *d, int n)
+    {
+        int i = 0;
+        for (; i + 16 <= n; i += 16)
+            gray8x16Ssse3(_mm_loadu_si128((const __m128i *)(s + i)), d + 4 * i);
+
+        gray8Scalar(s, d, i, n);
+    }
+
+    FV_TARGET("ssse3")
+    inline void gray16Ssse3(const uint16_t *s, uint8_t *d, int n)
+    {
+        int i = 0;
+        for (; i + 16 <= n; i += 16)
+        {
+            __m128i a = _mm_srli_epi16(_mm_loadu_si128((const __m128i *)(s + i)), 8);
+            __m128i b = _mm_srli_epi16(_mm_loadu_si128((const __m128i *)(s + i + 8)), 8);
+            gray8x16Ssse3(_mm_packus_epi16(a, b), d + 4 * i);
+        }
+
+        gray16Scalar(s, d, i, n);
+    }
+
+    /*
+     * AVX2: the same shuffles on both 128 bit lanes. Lane-wise unpack and pack scramble the pixel order, the 64 and 128
+     * bit permutes restore it.
+     */
+    template <bool Swap>
+    FV_TARGET("avx2")
+    inline void rgb3Avx2(const uint8_t *s, uint8_t *d, int n)
+    {
+        const __m256i shuffle = Swap ? _mm256_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1,
+                                                        2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1)
+                                     : _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+                                                        0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+        const __m256i alpha = _mm256_set1_epi32((int)0xff000000);
+        int i = 0;
+        // The second load of the last step reads 4 bytes past its 8 pixels
+        for (; i + 10 <= n; i += 8)
+        {
+            __m128i lo = _mm_loadu_si128((const __m128i *)(s + 3 * i));
+            __m128i hi = _mm_loadu_si128((const __m128i *)(s + 3 * i + 12));
+            __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+            _mm256_storeu_si256((__m256i *)(d + 4 * i), _mm256_or_si256(_mm256_shuffle_epi8(v, shuffle), alpha));
+        }
+
+        rgb3Scalar<Swap>(s, d, i, n);
+    }
+
+    // Writes the RGBA of 32 gray pixels
+    FV_TARGET("avx2")
+    inline void gray8x32Avx2(__m256i v, uint8_t *d)
+    {
+        const __m256i ones = _mm256_set1_epi8((char)0xff);
+        // 64 bit quarters 0 2 1 3, so the lane-wise unpacks below see pixels 0-7 | 8-15 and 16-23 | 24-31
+        v = _mm256_permute4x64_epi64(v, 0xd8);
+        __m256i vvLo = _mm256_unpacklo_epi8(v, v);
+        __m256i vaLo = _mm256_unpacklo_epi8(v, ones);
+        __m256i vvHi = _mm256_unpackhi_epi8(v, v);
+        __m256i vaHi = _mm256_unpackhi_epi8(v, ones);
+
+        // Pixels 0-3 | 8-11, 4-7 | 12-15, 16-19 | 24-27, 20-23 | 28-31
+        __m256i p0 = _mm256_unpacklo_epi16(vvLo, vaLo);
+        __m256i p1 = _mm256_unpackhi_epi16(vvLo, vaLo);
+        __m256i p2 = _mm256_unpacklo_epi16(vvHi, vaHi);
+        __m256i p3 = _mm256_unpackhi_epi16(vvHi, vaHi);
+        __m256i *out = (__m256i *)d;
+        _mm256_storeu_si256(out, _mm256_permute2x128_si256(p0, p1, 0x20));
+        _mm256_storeu_si256(out + 1, _mm256_permute2x128_si256(p0, p1, 0x31));
+        _mm256_storeu_si256(out + 2, _mm256_permute2x128_si256(p2, p3, 0x20));
+        _mm256_storeu_si256(out + 3, _mm256_permute2x128_si256(p2, p3, 0x31));
+    }
+
+    FV_TARGET("avx2")
+    inline void gray8Avx2(const uint8_t *s, uint8_t *d, int n)
+    {
+        int i = 0;
+        for (; i + 32 <= n; i += 32)
+            gray8x32Avx2(_mm256_loadu_si256((const __m256i *)(s + i)), d + 4 * i);
+
+        gray8Scalar(s, d, i, n);
+    }
+
+    FV_TARGET("avx2")
+    inline void gray16Avx2(const uint16_t *s, uint8_t *d, int n)
+    {
+        int i = 0;
+        for (; i + 32 <= n; i += 32)
+        {
+            __m256i a = _mm256_srli_epi16(_mm256_loadu_si256((const __m256i *)(s + i)), 8);
+            __m256i b = _mm256_srli_epi16(_mm256_loadu_si256((const __m256i *)(s + i + 16)), 8);
+            // packus interleaves the lanes of a and b, the permute puts the pixels back in order
+            gray8x32Avx2(_mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xd8), d + 4 * i);
+        }
+
+        gray16Scalar(s, d, i, n);
+    }
+#endif
+
+#ifdef FV_PIXEL_NEON
+    template <bool Swap>
+    inline void rgb3Neon(const uint8_t *s, uint8_t *d, int n)
+    {
+        int i = 0;
+        for (; i + 16 <= n; i += 16)
+        {
+            uint8x16x3_t in = vld3q_u8(s + 3 * i);
+            uint8x16x4_t out;
+            out.val[0] = in.val[Swap ? 2 : 0];
+            out.val[1] = in.val[1];
+            out.val[2] = in.val[Swap ? 0 : 2];
+            out.val[3] = vdupq_n_u8(255);
+            vst4q_u8(d + 4 * i, out);
+        }
+
+        rgb3Scalar<Swap>(s, d, i, n);
+    }
+
+    inline void gray8x16Neon(uint8x16_t v, uint8_t *d)
+    {
+        uint8x16x4_t out;
+        out.val[0] = out.val[1] = out.val[2] = v;
+        out.val[3] = vdupq_n_u8(255);
+        vst4q_u8(d, out);
+    }
+
+    inline void gray8Neon(const uint8_t *s, uint8_t *d, int n)
+    {
+        int i = 0;
+        for (; i + 16 <= n; i += 16)
+            gray8x16Neon(vld1q_u8(s + i), d + 4 * i);
+
+        gray8Scalar(s, d, i, n);
+    }
+
+    inline void gray16Neon(const uint16_t *s, uint8_t *d, int n)
+    {
+        int i = 0;
+        for (; i + 16 <= n; i += 16)
+            gray8x16Neon(vcombine_u8(vshrn_n_u16(vld1q_u16(s + i), 8), vshrn_n_u16(vld1q_u16(s + i + 8), 8)), d + 4 * i);
+
+        gray16Scalar(s, d, i, n);
+    }
+#endif
+
+    inline Kernels selectKernels()
+    {
+#if defined(FV_PIXEL_X86)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            return {"avx2", rgb3Avx2<false>, rgb3Avx2<true>, gray8Avx2, gray16Avx2};
+
+        if (__builtin_cpu_supports("ssse3"))
+            return {"ssse3", rgb3Ssse3<false>, rgb3Ssse3<true>, gray8Ssse3, gray16Ssse3};
+#elif defined(FV_PIXEL_NEON)
+        return {"neon", rgb3Neon<false>, rgb3Neon<true>, gray8Neon, gray16Neon};
+#endif
+        return {"scalar", rgb3Plain<false>, rgb3Plain<true>, gray8Plain, gray16Plain};
+    }
+
+    /**
+     * @brief Kernels for the CPU the process runs on
+     */
+    inline const Kernels &kernels()
+    {
+        static const Kernels k = selectKernels();
+        return k;
+    }
+
+    /**
+     * @brief RGBA of every depth value: holes (0) are opaque black, [min, max] mm spans the color map
+     *
+     * @param colorMap cv::ColormapTypes, 255 for grayscale
+     */
+    inline std::vector<uint32_t> makeDepthLut(int colorMap, unsigned int min, unsigned int max)
+    {
+        cv::Mat ramp(1, 256, CV_8UC1);
+        for (int i = 0; i < 256; i++)
+            ramp.ptr<uchar>(0)[i] = i;
+
+        cv::Mat colors;
+        if (colorMap == 255)
+            cv::cvtColor(ramp, colors, cv::COLOR_GRAY2BGR);
+        else
+            cv::applyColorMap(ramp, colors, colorMap);
+
+        uint32_t rgba[256];
+        for (int i = 0; i < 256; i++)
+        {
+            const uchar *c = colors.ptr<uchar>(0) + 3 * i;
+            uint8_t bytes[4] = {c[2], c[1], c[0], 255};
+            memcpy(&rgba[i], bytes, sizeof(bytes));
+        }
+
+        std::vector<uint32_t> lut(65536);
+        const uint8_t black[4] = {0, 0, 0, 255};
+        memcpy(&lut[0], black, sizeof(black));
+        for (unsigned int d = 1; d < lut.size(); d++)
+        {
+            unsigned int v = d <= min ? 0 : (d >= max ? 255 : (d - min) * 255 / (max - min));
+            lut[d] = rgba[v];
+        }
+
+        return lut;
+    }
+
+    /**
+     * @brief `makeDepthLut`, shared by every stage with the same color map and range. A table is built again only for
+     * a range or color map no live stage uses.
+     */
+    inline std::shared_ptr<const std::vector<uint32_t>> sharedDepthLut(int colorMap, unsigned int min, unsigned int max)
+    {
+        static std::mutex mutex;
+        static std::map<std::tuple<int, unsigned int, unsigned int>, std::weak_ptr<const std::vector<uint32_t>>> cache;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        std::weak_ptr<const std::vector<uint32_t>> &entry = cache[std::make_tuple(colorMap, min, max)];
+        std::shared_ptr<const std::vector<uint32_t>> lut = entry.lock();
+        if (lut == nullptr)
+        {
+            lut = std::make_shared<const std::vector<uint32_t>>(makeDepthLut(colorMap, min, max));
+            entry = lut;
+        }
+
+        for (auto it = cache.begin(); it != cache.end();)
+            it = it->second.expired() ? cache.erase(it) : std::next(it);
+
+        return lut;
+    }
+
+    inline void depthRow(const uint16_t *s, uint8_t *d, const uint32_t *lut, int n)
+    {
+        for (int i = 0; i < n; i++)
+            memcpy(d + 4 * i, &lut[s[i]], sizeof(uint32_t));
+    }
+
+    /**
+     * @brief Format `format` stands for with images of `type`
+     *
+     * @return -1 if the format cannot take such images, `error` says why
+     */
+    inline int resolve(int type, int format, std::string &error)
+    {
+        static const int types[] = {-1, CV_8UC4, CV_8UC3, CV_8UC3, CV_8UC1, CV_16UC1, CV_16UC1};
+        if (format < Auto || format > DepthZ16)
+        {
+            error = "unknown texture format " + std::to_string(format);
+            return -1;
+        }
+
+        if (format == Auto)
+        {
+            for (int f = Rgba; f <= Gray16; f++)
+            {
+                // RGB rather than BGR for 3 channels
+                if (types[f] == type && f != Bgr)
+                    return f;
+            }
+
+            error = "no texture format for image type " + std::to_string(type);
+            return -1;
+        }
+
+        if (type != types[format])
+        {
+            error = "texture format " + std::to_string(format) + " needs image type " + std::to_string(types[format]) + ", got " + std::to_string(type);
+            return -1;
+        }
+
+        return format;
+    }
+
+    inline Format resolve(const cv::Mat &src, int format)
+    {
+        std::string error;
+        int f = resolve(src.type(), format, error);
+        if (f < 0)
+            throw std::runtime_error(error);
+
+        return (Format)f;
+    }
+
+    /**
+     * @brief Convert `src` into `dst` (src.cols * src.rows RGBA8 pixels), row by row across OpenCV's threads
+     *
+     * @param depthLut table of `makeDepthLut`, for DepthZ16
+     */
+    inline void toRgba(const cv::Mat &src, int format, const uint32_t *depthLut, uint8_t *dst)
+    {
+        Format f = resolve(src, format);
+        if (f == DepthZ16 && depthLut == nullptr)
+            throw std::runtime_error("no depth table");
+
+        const Kernels &k = kernels();
+        size_t rowBytes = (size_t)src.cols * 4;
+        auto convertRows = [&](const cv::Range &rows)
+        {
+            for (int y = rows.start; y < rows.end; y++)
+            {
+                uint8_t *d = dst + y * rowBytes;
+                switch (f)
+                {
+                case Rgba:
+                    memcpy(d, src.ptr(y), rowBytes);
+                    break;
+                case Bgr:
+                    k.bgr(src.ptr(y), d, src.cols);
+                    break;
+                case Rgb:
+                    k.rgb(src.ptr(y), d, src.cols);
+                    break;
+                case Gray8:
+                    k.gray8(src.ptr(y), d, src.cols);
+                    break;
+                case Gray16:
+                    k.gray16(src.ptr<uint16_t>(y), d, src.cols);
+                    break;
+                default:
+                    depthRow(src.ptr<uint16_t>(y), d, depthLut, src.cols);
+                    break;
+                }
+            }
+        };
+
+        // Small frames are not worth waking the thread pool
+        if (src.total() < 320 * 240)
+            convertRows(cv::Range(0, src.rows));
+        else
+            cv::parallel_for_(cv::Range(0, src.rows), convertRows, src.total() / 65536.0);
+    }
+}
+#endif
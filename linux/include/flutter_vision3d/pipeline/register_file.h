@@ -0,0 +1,154 @@
+#ifndef _DEF_REGISTER_FILE_
+#define _DEF_REGISTER_FILE_
+
+#include <opencv2/core/core.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+
+/**
+ * @brief Image registers shared by the pipelines of one camera
+ *
+ * Register `cur` is the image flowing through the pipeline (`FvTexture::cvImage`). `r1`..`r8` are general registers:
+ * a stage stores an image there and a later stage (or a later frame, or another stream's pipeline) reads it back.
+ * `rgb`, `depth` and `ir` hold the latest input frame of each stream of the camera and are read-only; a stream's frame
+ * is only copied there while a pipeline reads it (see `want`).
+ */
+class RegisterFile
+{
+public:
+    static const unsigned int CUR = 0;
+    static const unsigned int GENERAL = 8;
+    static const unsigned int RGB = 9;
+    static const unsigned int DEPTH = 10;
+    static const unsigned int IR = 11;
+    static const unsigned int COUNT = 12;
+
+    static bool valid(unsigned int r)
+    {
+        return r < COUNT;
+    }
+
+    static bool writable(unsigned int r)
+    {
+        return r <= GENERAL;
+    }
+
+    static std::string name(unsigned int r)
+    {
+        switch (r)
+        {
+        case CUR:
+            return "cur";
+        case RGB:
+            return "rgb";
+        case DEPTH:
+            return "depth";
+        case IR:
+            return "ir";
+        default:
+            return "r" + std::to_string(r);
+        }
+    }
+
+    /**
+     * @brief Register id of a name (`cur`, `r1`..`r8`, `rgb`, `depth`, `ir`) or a number
+     *
+     * @return -1 if `token` is neither
+     */
+    static int parse(const std::string &token)
+    {
+        for (unsigned int r = 0; r < COUNT; r++)
+        {
+            if (token == name(r))
+                return r;
+        }
+
+        char *end = nullptr;
+        long r = strtol(token.c_str(), &end, 10);
+        if (token.empty() || *end != '\0' || r < 0 || r >= (long)COUNT)
+            return -1;
+
+        return r;
+    }
+
+    /**
+     * @brief Stream registers read by a pipeline, one bit per register id. Bits accumulate: a stream stays published
+     * once any pipeline of the camera read it.
+     */
+    void want(unsigned int mask)
+    {
+        wanted |= mask;
+    }
+
+    /**
+     * @brief Latest input frame of a stream, copied into the stream register when a pipeline reads it
+     */
+    void publish(unsigned int r, const cv::Mat &image)
+    {
+        if ((wanted.load() & (1u << r)) == 0 || image.empty())
+            return;
+
+        std::lock_guard<std::mutex> lock(slots[r].mutex);
+        image.copyTo(slots[r].image);
+    }
+
+    /**
+     * @brief Copy `image` into a general register
+     */
+    void store(unsigned int r, const cv::Mat &image)
+    {
+        if (!writable(r) || r == CUR)
+            throw std::runtime_error("register " + name(r) + " is not a general register");
+
+        std::lock_guard<std::mutex> lock(slots[r].mutex);
+        image.copyTo(slots[r].image);
+    }
+
+    /**
+     * @brief Runs `fn(a, b, dst)` with the images of registers `a` and `b` and the image to write register `dst` into
+     *
+     * `cur` resolves to `image` for reads and to `out` for the write. Registers are locked in id order, so stages of
+     * different streams never wait on each other crosswise; `dst` may be `a` or `b` (OpenCV's element-wise operations
+     * run in place).
+     */
+    template <typename F>
+    void with(const cv::Mat &image, cv::Mat &out, unsigned int a, unsigned int b, unsigned int dst, F fn)
+    {
+        unsigned int ids[3] = {a, b, dst};
+        std::sort(ids, ids + 3);
+        std::unique_lock<std::mutex> locks[3];
+        for (int i = 0; i < 3; i++)
+        {
+            if (ids[i] != CUR && (i == 0 || ids[i] != ids[i - 1]))
+                locks[i] = std::unique_lock<std::mutex>(slots[ids[i]].mutex);
+        }
+
+        fn(read(image, a), read(image, b), dst == CUR ? out : slots[dst].image);
+    }
+
+private:
+    struct Slot
+    {
+        std::mutex mutex;
+        cv::Mat image;
+    };
+
+    Slot slots[COUNT];
+    std::atomic<unsigned int> wanted{0};
+
+    const cv::Mat &read(const cv::Mat &image, unsigned int r)
+    {
+        if (r == CUR)
+            return image;
+
+        if (slots[r].image.empty())
+            throw std::runtime_error("register " + name(r) + " is empty");
+
+        return slots[r].image;
+    }
+};
+#endif
@@ -0,0 +1,131 @@
+#ifndef _DEF_SPSC_QUEUE_
+#define _DEF_SPSC_QUEUE_
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+/**
+ * @brief Bounded single-producer/single-consumer ring of preallocated slots.
+ *
+ * Slots are reused, so a producer can fill a slot in place (e.g. `copyTo` a cv::Mat of the same size) without
+ * allocating. Indices are lock-free atomics; the mutex and condition variable are only used to park a thread when
+ * the ring is full or empty, so a waiting side sleeps instead of spinning.
+ */
+template <typename T>
+class SpscQueue
+{
+public:
+    SpscQueue(size_t capacity) : slots(capacity + 1) {}
+
+    size_t capacity() const
+    {
+        return slots.size() - 1;
+    }
+
+    size_t size() const
+    {
+        size_t h = head.load(std::memory_order_acquire);
+        size_t t = tail.load(std::memory_order_acquire);
+        return (t + slots.size() - h) % slots.size();
+    }
+
+    /**
+     * @brief Slot to fill. Blocks while the ring is full.
+     *
+     * @return nullptr once the queue is closed
+     */
+    T *beginPush()
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t next = (t + 1) % slots.size();
+        if (next == head.load(std::memory_order_acquire))
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [&]
+                      { return closed.load() || next != head.load(std::memory_order_acquire); });
+        }
+
+        return closed.load() ? nullptr : &slots[t];
+    }
+
+    /**
+     * @brief Slot to fill, or nullptr if the ring is full or closed
+     */
+    T *tryBeginPush()
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if ((t + 1) % slots.size() == head.load(std::memory_order_acquire) || closed.load())
+            return nullptr;
+
+        return &slots[t];
+    }
+
+    void commitPush()
+    {
+        tail.store((tail.load(std::memory_order_relaxed) + 1) % slots.size(), std::memory_order_release);
+        wake();
+    }
+
+    /**
+     * @brief Oldest filled slot. Blocks while the ring is empty.
+     *
+     * @return nullptr once the queue is closed
+     */
+    T *front()
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [&]
+                      { return closed.load() || h != tail.load(std::memory_order_acquire); });
+        }
+
+        return closed.load() ? nullptr : &slots[h];
+    }
+
+    /**
+     * @brief Oldest filled slot, or nullptr if the ring is empty
+     */
+    T *tryFront()
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+            return nullptr;
+
+        return &slots[h];
+    }
+
+    void pop()
+    {
+        head.store((head.load(std::memory_order_relaxed) + 1) % slots.size(), std::memory_order_release);
+        wake();
+    }
+
+    void close()
+    {
+        closed.store(true);
+        wake();
+    }
+
+private:
+    std::vector<T> slots;
+    std::atomic<size_t> head{0};
+    std::atomic<size_t> tail{0};
+    std::atomic<bool> closed{false};
+
+    std::mutex mutex;
+    std::condition_variable cond;
+
+    void wake()
+    {
+        // Taking the lock orders the index update before a waiter's predicate check, so no wakeup is lost
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+        }
+        cond.notify_all();
+    }
+};
+#endif
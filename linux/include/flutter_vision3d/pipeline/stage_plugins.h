@@ -0,0 +1,137 @@
+#ifndef _DEF_STAGE_PLUGINS_
+#define _DEF_STAGE_PLUGINS_
+
+#include <dlfcn.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "../fv_stage_plugin.h"
+
+/**
+ * @brief One `pluginStage` of a pipeline: the plugin's instance and the result buffer the host owns for it
+ */
+class PluginStageInstance
+{
+public:
+    const FvStageDesc *desc;
+    void *instance;
+    std::vector<float> result;
+    // Floats written by the last `process`, sent again when the stage is gated off
+    uint32_t lastSize = 0;
+
+    PluginStageInstance(const FvStageDesc *desc, void *instance) : desc(desc), instance(instance), result(desc->resultCapacity) {}
+
+    ~PluginStageInstance()
+    {
+        if (desc->destroy != nullptr)
+            desc->destroy(instance);
+    }
+
+    PluginStageInstance(const PluginStageInstance &) = delete;
+    PluginStageInstance &operator=(const PluginStageInstance &) = delete;
+};
+
+/**
+ * @brief Stages of the libraries loaded with `pipelinePluginLoad`, by name
+ */
+class StagePluginRegistry
+{
+public:
+    static StagePluginRegistry &shared()
+    {
+        static StagePluginRegistry registry;
+        return registry;
+    }
+
+    /**
+     * @brief dlopen a stage library and register its stages
+     *
+     * @param names names of the registered stages
+     * @return 0 on success, -1 with `error` set otherwise. Nothing is registered on error.
+     */
+    int load(const char *path, std::vector<std::string> &names, std::string &error)
+    {
+        void *lib = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+        if (lib == nullptr)
+        {
+            error = dlerror();
+            return -1;
+        }
+
+        FvRegisterStagesFn entry = (FvRegisterStagesFn)dlsym(lib, FV_STAGE_ENTRY);
+        const FvStageDesc *stages = nullptr;
+        uint32_t count = 0;
+        if (entry == nullptr)
+            error = std::string("missing ") + FV_STAGE_ENTRY;
+        else if (entry(FV_STAGE_ABI_VERSION, &stages, &count) != 0)
+            error = "unsupported ABI version " + std::to_string(FV_STAGE_ABI_VERSION);
+        else
+        {
+            for (uint32_t i = 0; i < count; i++)
+            {
+                if (stages[i].name == nullptr || stages[i].init == nullptr || stages[i].process == nullptr)
+                    error = "stage " + std::to_string(i) + " is incomplete";
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        for (uint32_t i = 0; error.empty() && i < count; i++)
+        {
+            if (this->stages.count(stages[i].name) > 0)
+                error = std::string("stage ") + stages[i].name + " is already registered";
+        }
+
+        if (!error.empty())
+        {
+            dlclose(lib);
+            return -1;
+        }
+
+        // The library stays loaded, stages may be in use by any pipeline snapshot
+        for (uint32_t i = 0; i < count; i++)
+        {
+            this->stages[stages[i].name] = &stages[i];
+            names.push_back(stages[i].name);
+        }
+
+        return 0;
+    }
+
+    /**
+     * @brief Create an instance of stage `name`
+     *
+     * @return nullptr with `error` set if the stage is unknown or its `init` fails
+     */
+    std::shared_ptr<PluginStageInstance> create(const std::string &name, const uint8_t *params, uint32_t len, std::string &error)
+    {
+        const FvStageDesc *desc = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = stages.find(name);
+            if (it != stages.end())
+                desc = it->second;
+        }
+
+        if (desc == nullptr)
+        {
+            error = "unknown plugin stage " + name;
+            return nullptr;
+        }
+
+        void *instance = desc->init(params, len);
+        if (instance == nullptr)
+        {
+            error = name + ": init failed";
+            return nullptr;
+        }
+
+        return std::make_shared<PluginStageInstance>(desc, instance);
+    }
+
+private:
+    std::mutex mutex;
+    std::map<std::string, const FvStageDesc *> stages;
+};
+#endif
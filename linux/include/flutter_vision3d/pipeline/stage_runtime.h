@@ -0,0 +1,157 @@
+#ifndef _DEF_STAGE_RUNTIME_
+#define _DEF_STAGE_RUNTIME_
+
+#include <opencv2/core/core.hpp>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "../fv_texture.h"
+#include "pipeline_params.h"
+#include "stage_plugins.h"
+#include "static_pipeline.h"
+
+/*
+ * State a stage keeps across frames: buffers, its last results, plugin and compiled pipeline instances. The stage's
+ * `init` (next to its decoder in `pipelineFuncs`) builds it from the decoded parameters when the stage is made, and it
+ * lives in the stage's StageState, so parameters stay immutable and `Pipeline::setParam` only swaps them. A stage
+ * reads its state through `stageRuntime` while it runs.
+ */
+
+struct StageRuntime
+{
+    virtual ~StageRuntime() = default;
+
+    /**
+     * @brief Whether this state still serves the stage after its parameters changed to `params`. Otherwise
+     * `Pipeline::setParam` has the stage's `init` build a new one.
+     */
+    virtual bool fits(const StageParams &params) const
+    {
+        return true;
+    }
+};
+
+typedef std::shared_ptr<StageRuntime> (*StageInit)(const StageParams &params, std::string &error);
+
+/**
+ * @brief State of the running stage (`FvTexture::runtime`), set by the pipeline around the stage's call
+ */
+template <typename T>
+T &stageRuntime(FvTexture *fv)
+{
+    if (fv->runtime == nullptr)
+        throw std::runtime_error("stage has no runtime state");
+
+    return static_cast<T &>(*fv->runtime);
+}
+
+struct CustomHandlerRuntime : StageRuntime
+{
+    // Filled by the handler every frame, sized to the stage's result size
+    std::vector<float> result;
+};
+
+struct BatchInferenceRuntime : StageRuntime
+{
+    // Outputs of the last run and the model they came from, sent again when the stage is gated off
+    std::vector<std::vector<float>> last;
+    unsigned int lastModel = 0;
+};
+
+/**
+ * @brief Buffers of a `changeGate` stage. A reference of another size or type (new scale or mode) counts as a change.
+ */
+struct ChangeGateRuntime : StageRuntime
+{
+    // Downsampled frame of the last change
+    cv::Mat reference;
+    cv::Mat small;
+    cv::Mat gray;
+    cv::Mat diff;
+    cv::Mat mask;
+    unsigned int holdLeft = 0;
+};
+
+struct RegisterRuntime : StageRuntime
+{
+    // Mask: pixels where b is zero
+    cv::Mat scratch;
+};
+
+struct PluginStageRuntime : StageRuntime
+{
+    std::string name;
+    std::vector<uint8_t> config;
+    std::shared_ptr<PluginStageInstance> instance;
+
+    bool fits(const StageParams &params) const override
+    {
+        const PluginStageParams &p = std::get<PluginStageParams>(params);
+        return p.name == name && p.config == config;
+    }
+};
+
+struct StaticPipelineRuntime : StageRuntime
+{
+    std::string name;
+    std::shared_ptr<CompiledPipeline> pipeline;
+
+    bool fits(const StageParams &params) const override
+    {
+        return std::get<StaticPipelineParams>(params).name == name;
+    }
+};
+
+inline std::shared_ptr<StageRuntime> initCustomHandlerRuntime(const StageParams &params, std::string &error)
+{
+    std::shared_ptr<CustomHandlerRuntime> runtime = std::make_shared<CustomHandlerRuntime>();
+    runtime->result.assign(std::get<CustomHandlerParams>(params).size, 0.0f);
+    return runtime;
+}
+
+inline std::shared_ptr<StageRuntime> initBatchInferenceRuntime(const StageParams &params, std::string &error)
+{
+    return std::make_shared<BatchInferenceRuntime>();
+}
+
+inline std::shared_ptr<StageRuntime> initChangeGateRuntime(const StageParams &params, std::string &error)
+{
+    return std::make_shared<ChangeGateRuntime>();
+}
+
+inline std::shared_ptr<StageRuntime> initRegisterRuntime(const StageParams &params, std::string &error)
+{
+    return std::make_shared<RegisterRuntime>();
+}
+
+/**
+ * @return nullptr with `error` set if the stage is unknown or its `init` fails
+ */
+inline std::shared_ptr<StageRuntime> initPluginStageRuntime(const StageParams &params, std::string &error)
+{
+    const PluginStageParams &p = std::get<PluginStageParams>(params);
+    std::shared_ptr<PluginStageRuntime> runtime = std::make_shared<PluginStageRuntime>();
+    runtime->name = p.name;
+    runtime->config = p.config;
+    runtime->instance = StagePluginRegistry::shared().create(p.name, p.config.data(), p.config.size(), error);
+    if (runtime->instance == nullptr)
+        return nullptr;
+
+    return runtime;
+}
+
+/**
+ * @return nullptr with `error` set if no pipeline of that name is registered
+ */
+inline std::shared_ptr<StageRuntime> initStaticPipelineRuntime(const StageParams &params, std::string &error)
+{
+    std::shared_ptr<StaticPipelineRuntime> runtime = std::make_shared<StaticPipelineRuntime>();
+    runtime->name = std::get<StaticPipelineParams>(params).name;
+    runtime->pipeline = StaticPipelineRegistry::shared().create(runtime->name, error);
+    if (runtime->pipeline == nullptr)
+        return nullptr;
+
+    return runtime;
+}
+#endif
@@ -0,0 +1,215 @@
+#ifndef _DEF_STAGE_SCHEDULE_
+#define _DEF_STAGE_SCHEDULE_
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "pipeline_stats.h"
+
+/**
+ * @brief When a stage runs
+ *
+ * Millisecond cadences are aligned to the monotonic clock: the stage is due at `k * period + phase` ms, so pipelines
+ * of different cameras with the same period and different phases never become due in the same millisecond. Frame
+ * cadences run the stage on the frames where `frame % period == phase`, counted per pipeline from its first frame.
+ */
+struct StageSchedule
+{
+    enum Cadence
+    {
+        Always = 0,
+        EveryMs = 1,
+        EveryFrames = 2,
+    };
+
+    Cadence cadence = Always;
+    uint32_t period = 0;
+    uint32_t phase = 0;
+
+    static StageSchedule everyMs(uint32_t period, uint32_t phase = 0)
+    {
+        return period == 0 ? StageSchedule{} : StageSchedule{EveryMs, period, phase % period};
+    }
+
+    static StageSchedule everyFrames(uint32_t period, uint32_t phase = 0)
+    {
+        return period <= 1 ? StageSchedule{} : StageSchedule{EveryFrames, period, phase % period};
+    }
+};
+
+/**
+ * @brief Due flag of one stage, shared by every snapshot that contains the stage
+ */
+struct ScheduleState
+{
+    std::atomic<bool> due{false};
+    // Bumped when the stage's schedule changes, so the timer of the old schedule is dropped
+    std::atomic<uint32_t> generation{0};
+    // Generation the wheel holds a timer for
+    uint32_t armed = UINT32_MAX;
+};
+
+/**
+ * @brief Hashed timer wheel with 1 ms ticks for the millisecond cadences of one pipeline
+ *
+ * Only the thread calling `run` touches the wheel. `advance` sets the due flag of every expired timer and re-arms it
+ * for the next period; the stage clears the flag when it runs, wherever in the pipeline (segment worker, branch) that
+ * happens. Checking a stage is one atomic exchange instead of a clock read per stage and frame.
+ */
+class TimerWheel
+{
+public:
+    static const size_t SLOTS = 256;
+
+    /**
+     * @brief Start the timer of a stage. A stage armed for the first time is due right away, like the first frame of
+     * an unscheduled stage; a changed schedule waits for its next deadline.
+     */
+    void arm(const std::shared_ptr<ScheduleState> &state, const StageSchedule &schedule, int64_t nowMs)
+    {
+        uint32_t generation = state->generation.load(std::memory_order_relaxed);
+        if (state->armed == generation)
+            return;
+
+        if (state->armed == UINT32_MAX)
+            state->due.store(true, std::memory_order_relaxed);
+
+        state->armed = generation;
+        insert({state, schedule.period, schedule.phase, generation, nextDeadline(nowMs, schedule.period, schedule.phase)});
+    }
+
+    void advance(int64_t nowMs)
+    {
+        if (currentMs < 0)
+            currentMs = nowMs - 1;
+
+        if (nowMs <= currentMs)
+            return;
+
+        // Past one revolution every slot is visited once
+        int64_t ticks = std::min<int64_t>(nowMs - currentMs, SLOTS);
+        for (int64_t t = nowMs - ticks + 1; t <= nowMs; t++)
+        {
+            std::vector<Timer> &slot = slots[t % SLOTS];
+            for (size_t i = 0; i < slot.size();)
+            {
+                if (slot[i].deadline > nowMs)
+                {
+                    i++;
+                    continue;
+                }
+
+                fired.push_back(std::move(slot[i]));
+                slot[i] = std::move(slot.back());
+                slot.pop_back();
+            }
+        }
+
+        currentMs = nowMs;
+
+        for (Timer &timer : fired)
+        {
+            std::shared_ptr<ScheduleState> state = timer.state.lock();
+            if (state == nullptr || state->generation.load(std::memory_order_relaxed) != timer.generation)
+                continue;
+
+            state->due.store(true, std::memory_order_relaxed);
+            timer.deadline = nextDeadline(nowMs + 1, timer.period, timer.phase);
+            insert(std::move(timer));
+        }
+
+        fired.clear();
+    }
+
+private:
+    struct Timer
+    {
+        std::weak_ptr<ScheduleState> state;
+        uint32_t period;
+        uint32_t phase;
+        uint32_t generation;
+        int64_t deadline;
+    };
+
+    std::array<std::vector<Timer>, SLOTS> slots;
+    std::vector<Timer> fired;
+    int64_t currentMs = -1;
+
+    /**
+     * @brief First `k * period + phase` at or after `fromMs`
+     */
+    static int64_t nextDeadline(int64_t fromMs, uint32_t period, uint32_t phase)
+    {
+        int64_t k = (fromMs - phase + period - 1) / period;
+        return k * period + phase;
+    }
+
+    void insert(Timer &&timer)
+    {
+        slots[timer.deadline % SLOTS].push_back(std::move(timer));
+    }
+};
+
+/**
+ * @brief Decides per frame which scheduled stages run
+ */
+class StageScheduler
+{
+public:
+    /**
+     * @brief Start a frame: advance the timer wheel and arm the timers of newly published stages
+     *
+     * @return the frame number, passed to `due` for every stage of the frame
+     */
+    template <typename FuncList>
+    uint64_t beginFrame(const std::shared_ptr<const FuncList> &funcs)
+    {
+        int64_t nowMs = getMonotonicNs() / 1000000;
+        if (funcs != armedList)
+        {
+            // Only a new snapshot can bring new stages or schedules
+            for (const auto &f : *funcs)
+            {
+                if (f.schedule.cadence == StageSchedule::EveryMs)
+                    wheel.arm(std::shared_ptr<ScheduleState>(f.state, &f.state->schedule), f.schedule, nowMs);
+            }
+
+            armedList = funcs;
+        }
+
+        wheel.advance(nowMs);
+        return frame.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    uint64_t currentFrame() const
+    {
+        return frame.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Whether the stage runs in frame `frame`. Consumes the due flag of millisecond cadences.
+     */
+    template <typename Stage>
+    static bool due(const Stage &f, uint64_t frame)
+    {
+        switch (f.schedule.cadence)
+        {
+        case StageSchedule::EveryMs:
+            return f.state->schedule.due.exchange(false, std::memory_order_relaxed);
+        case StageSchedule::EveryFrames:
+            return frame % f.schedule.period == f.schedule.phase;
+        default:
+            return true;
+        }
+    }
+
+private:
+    TimerWheel wheel;
+    // Held so a new snapshot cannot reuse its address
+    std::shared_ptr<const void> armedList = nullptr;
+    std::atomic<uint64_t> frame{0};
+};
+#endif
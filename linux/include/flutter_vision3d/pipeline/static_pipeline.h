@@ -0,0 +1,350 @@
+#ifndef _DEF_STATIC_PIPELINE_
+#define _DEF_STATIC_PIPELINE_
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <utility>
+
+/*
+ * Pipelines composed at compile time, for fixed recipes that never change at run time:
+ *
+ *     auto p = StaticPipeline::makePipeline(StaticPipeline::Crop{{0, 0, 640, 360}},
+ *                                           StaticPipeline::ConvertScale{1.5f, 10.0f},
+ *                                           StaticPipeline::Threshold<cv::THRESH_BINARY>{128, 255},
+ *                                           StaticPipeline::ToTensor<float>{1.0 / 255});
+ *     p.run(frame, tensor);
+ *
+ * Stages are plain structs called directly, there is no per-stage dispatch or parameter decoding. A run of
+ * consecutive pointwise stages (`ConvertScale`, `Threshold`, `DepthClip`) is compiled into one loop over the pixels,
+ * specialized on the pixel type, so it reads and writes every pixel once. Views (`Crop`) cost no copy. The buffers
+ * between stages are kept by the pipeline and reused across frames.
+ *
+ * Registered by name with `StaticPipelineRegistry`, a compiled pipeline runs as a single `staticPipeline` stage of
+ * an `FvPipeline`.
+ */
+namespace StaticPipeline
+{
+    enum class Kind
+    {
+        // Returns a view of its input
+        View,
+        // Writes its output into a buffer
+        Map,
+        // `T operator()(T)` per channel value, fused with the pointwise stages next to it
+        Point,
+    };
+
+    struct Crop
+    {
+        static constexpr Kind kind = Kind::View;
+        cv::Rect rect;
+
+        cv::Mat view(const cv::Mat &in) const
+        {
+            if ((rect & cv::Rect(0, 0, in.cols, in.rows)) != rect)
+                throw std::out_of_range("crop area exceeds image size");
+
+            return in(rect);
+        }
+    };
+
+    struct Resize
+    {
+        static constexpr Kind kind = Kind::Map;
+        cv::Size size;
+        int interpolation = cv::INTER_LINEAR;
+
+        void apply(const cv::Mat &in, cv::Mat &out) const
+        {
+            cv::resize(in, out, size, 0, 0, interpolation);
+        }
+    };
+
+    struct CvtColor
+    {
+        static constexpr Kind kind = Kind::Map;
+        int code;
+
+        void apply(const cv::Mat &in, cv::Mat &out) const
+        {
+            cv::cvtColor(in, out, code);
+        }
+    };
+
+    /**
+     * @brief Convert to the depth of `T` with `value * scale + shift`, e.g. the input tensor of a float model
+     */
+    template <typename T>
+    struct ToTensor
+    {
+        static constexpr Kind kind = Kind::Map;
+        double scale = 1.0;
+        double shift = 0.0;
+
+        void apply(const cv::Mat &in, cv::Mat &out) const
+        {
+            in.convertTo(out, cv::DataType<T>::depth, scale, shift);
+        }
+    };
+
+    /**
+     * @brief `value * alpha + beta`, saturated to the pixel type like cv::Mat::convertTo with the same depth
+     */
+    struct ConvertScale
+    {
+        static constexpr Kind kind = Kind::Point;
+        float alpha = 1.0f;
+        float beta = 0.0f;
+
+        template <typename T>
+        T operator()(T v) const
+        {
+            return cv::saturate_cast<T>(v * alpha + beta);
+        }
+    };
+
+    /**
+     * @brief cv::threshold, the type is a template parameter so the comparison is resolved at compile time
+     */
+    template <int Type = cv::THRESH_BINARY>
+    struct Threshold
+    {
+        static_assert(Type >= cv::THRESH_BINARY && Type <= cv::THRESH_TOZERO_INV, "OTSU and TRIANGLE are not pointwise");
+        static constexpr Kind kind = Kind::Point;
+        double thresh = 0.0;
+        double maxValue = 255.0;
+
+        template <typename T>
+        T operator()(T v) const
+        {
+            bool over = v > thresh;
+            if constexpr (Type == cv::THRESH_BINARY)
+                return over ? cv::saturate_cast<T>(maxValue) : T(0);
+            else if constexpr (Type == cv::THRESH_BINARY_INV)
+                return over ? T(0) : cv::saturate_cast<T>(maxValue);
+            else if constexpr (Type == cv::THRESH_TRUNC)
+                return over ? cv::saturate_cast<T>(thresh) : v;
+            else if constexpr (Type == cv::THRESH_TOZERO)
+                return over ? v : T(0);
+            else
+                return over ? T(0) : v;
+        }
+    };
+
+    /**
+     * @brief Depth outside [min, max] millimeters to 0, like the `depthClip` stage
+     */
+    struct DepthClip
+    {
+        static constexpr Kind kind = Kind::Point;
+        uint16_t min = 0;
+        uint16_t max = 0;
+
+        template <typename T>
+        T operator()(T v) const
+        {
+            return v >= min && v <= max ? v : T(0);
+        }
+    };
+
+    template <typename... Stages>
+    class Compiled;
+
+    template <typename... Stages>
+    Compiled<Stages...> makePipeline(Stages... stages)
+    {
+        return Compiled<Stages...>(std::move(stages)...);
+    }
+}
+
+/**
+ * @brief A compiled pipeline behind one virtual call per frame, what a `staticPipeline` stage runs
+ */
+class CompiledPipeline
+{
+public:
+    virtual ~CompiledPipeline() = default;
+
+    /**
+     * @brief Run every stage on `in`, the result is written into `out`. `in` is not modified.
+     */
+    virtual void run(const cv::Mat &in, cv::Mat &out) = 0;
+};
+
+namespace StaticPipeline
+{
+    template <typename... Stages>
+    class Compiled : public CompiledPipeline
+    {
+    public:
+        static_assert(sizeof...(Stages) > 0, "a pipeline needs at least one stage");
+
+        explicit Compiled(Stages... stages) : stages(std::move(stages)...) {}
+
+        void run(const cv::Mat &in, cv::Mat &out) override
+        {
+            step<0>(in, out);
+        }
+
+    private:
+        static constexpr size_t COUNT = sizeof...(Stages);
+
+        std::tuple<Stages...> stages;
+        // Output of stage i, unless it is the last one (written into `out`) or a view
+        cv::Mat buffers[COUNT];
+
+        template <size_t I>
+        using Stage = std::tuple_element_t<I, std::tuple<Stages...>>;
+
+        // End of the run of pointwise stages starting at I
+        template <size_t I>
+        static constexpr size_t pointEnd()
+        {
+            if constexpr (I == COUNT)
+                return I;
+            else if constexpr (Stage<I>::kind != Kind::Point)
+                return I;
+            else
+                return pointEnd<I + 1>();
+        }
+
+        template <size_t I>
+        void step(const cv::Mat &in, cv::Mat &out)
+        {
+            constexpr Kind kind = Stage<I>::kind;
+            if constexpr (kind == Kind::View)
+            {
+                cv::Mat view = std::get<I>(stages).view(in);
+                if constexpr (I + 1 == COUNT)
+                    view.copyTo(out);
+                else
+                    step<I + 1>(view, out);
+            }
+            else if constexpr (kind == Kind::Map)
+            {
+                cv::Mat &dst = I + 1 == COUNT ? out : buffers[I];
+                std::get<I>(stages).apply(in, dst);
+                if constexpr (I + 1 < COUNT)
+                    step<I + 1>(dst, out);
+            }
+            else
+            {
+                constexpr size_t end = pointEnd<I>();
+                cv::Mat &dst = end == COUNT ? out : buffers[I];
+                pointwise<I, end>(in, dst);
+                if constexpr (end < COUNT)
+                    step<end>(dst, out);
+            }
+        }
+
+        template <size_t I, size_t End>
+        void pointwise(const cv::Mat &in, cv::Mat &dst)
+        {
+            switch (in.depth())
+            {
+            case CV_8U:
+                return pointwiseRows<I, End, uchar>(in, dst);
+            case CV_16U:
+                return pointwiseRows<I, End, ushort>(in, dst);
+            case CV_16S:
+                return pointwiseRows<I, End, short>(in, dst);
+            case CV_32F:
+                return pointwiseRows<I, End, float>(in, dst);
+            default:
+                throw std::runtime_error("pointwise stages need an 8U, 16U, 16S or 32F image");
+            }
+        }
+
+        template <size_t I, size_t End, typename T>
+        void pointwiseRows(const cv::Mat &in, cv::Mat &dst)
+        {
+            dst.create(in.size(), in.type());
+            size_t n = (size_t)in.cols * in.channels();
+            cv::parallel_for_(cv::Range(0, in.rows), [&](const cv::Range &rows)
+                              {
+                for (int y = rows.start; y < rows.end; y++)
+                {
+                    const T *s = in.ptr<T>(y);
+                    T *d = dst.ptr<T>(y);
+                    for (size_t x = 0; x < n; x++)
+                        d[x] = chain<I, T>(s[x], std::make_index_sequence<End - I>{});
+                } });
+        }
+
+        template <size_t I, typename T, size_t... K>
+        T chain(T v, std::index_sequence<K...>) const
+        {
+            ((v = std::get<I + K>(stages)(v)), ...);
+            return v;
+        }
+    };
+}
+
+/**
+ * @brief Compiled pipelines by name, run by `staticPipeline` stages
+ */
+class StaticPipelineRegistry
+{
+public:
+    typedef std::function<std::shared_ptr<CompiledPipeline>()> Factory;
+
+    static StaticPipelineRegistry &shared()
+    {
+        static StaticPipelineRegistry registry;
+        return registry;
+    }
+
+    /**
+     * @brief Register a pipeline of `stages`. Every `staticPipeline` stage naming it gets its own instance (and
+     * buffers).
+     *
+     * @return false if `name` is already registered
+     */
+    template <typename... Stages>
+    bool add(const std::string &name, Stages... stages)
+    {
+        return addFactory(name, [stages...]()
+                   { return std::make_shared<StaticPipeline::Compiled<Stages...>>(stages...); });
+    }
+
+    bool addFactory(const std::string &name, Factory factory)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return factories.emplace(name, std::move(factory)).second;
+    }
+
+    /**
+     * @return nullptr with `error` set if `name` is unknown
+     */
+    std::shared_ptr<CompiledPipeline> create(const std::string &name, std::string &error)
+    {
+        Factory factory;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = factories.find(name);
+            if (it != factories.end())
+                factory = it->second;
+        }
+
+        if (!factory)
+        {
+            error = "unknown static pipeline " + name;
+            return nullptr;
+        }
+
+        return factory();
+    }
+
+private:
+    std::mutex mutex;
+    std::map<std::string, Factory> factories;
+};
+#endif
@@ -0,0 +1,114 @@
+#ifndef _DEF_WORKER_POOL_
+#define _DEF_WORKER_POOL_
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Counts outstanding tasks so the submitter can wait for all of them
+ */
+class WaitGroup
+{
+public:
+    void add(int n)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending += n;
+    }
+
+    void done()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--pending == 0)
+            cond.notify_all();
+    }
+
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [&]
+                  { return pending == 0; });
+    }
+
+private:
+    int pending = 0;
+    std::mutex mutex;
+    std::condition_variable cond;
+};
+
+/**
+ * @brief Fixed set of threads running submitted tasks in FIFO order. Tasks must not wait on other tasks of the same
+ * pool.
+ */
+class WorkerPool
+{
+public:
+    WorkerPool(unsigned int threads)
+    {
+        for (unsigned int i = 0; i < threads; i++)
+            workers.emplace_back(&WorkerPool::loop, this);
+    }
+
+    ~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        cond.notify_all();
+
+        for (auto &t : workers)
+            t.join();
+    }
+
+    /**
+     * @brief Pool shared by all pipelines, one thread per core
+     */
+    static WorkerPool &shared()
+    {
+        static WorkerPool pool(std::max(2u, std::thread::hardware_concurrency()));
+        return pool;
+    }
+
+    void submit(std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push_back(std::move(task));
+        }
+        cond.notify_one();
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    bool stopping = false;
+    std::mutex mutex;
+    std::condition_variable cond;
+
+    void loop()
+    {
+        while (true)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cond.wait(lock, [&]
+                          { return stopping || !tasks.empty(); });
+                if (tasks.empty())
+                    return;
+
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+
+            task();
+        }
+    }
+};
+#endif
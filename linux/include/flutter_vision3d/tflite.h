@@ -3,6 +3,7 @@
 
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <vector>
 
 #include <opencv2/core/core.hpp>
@@ -26,6 +27,9 @@ public:
     std::string error;
     std::vector<TensorOutput> outputTensors{};
     std::unique_ptr<tflite::Interpreter> interpreter;
+    // Held while the interpreter runs, pipelines of several cameras share the model. `tfBatchInference` runs on an
+    // interpreter of its own (see TFLiteBatcher).
+    std::mutex invokeMutex;
 
     TFLiteModel(const char *modelPath)
     {
@@ -36,22 +40,9 @@ public:
             return;
         }
 
-        tflite::ops::builtin::BuiltinOpResolver resolver;
-        tflite::InterpreterBuilder(*model, resolver)(&interpreter);
+        interpreter = newInterpreter(error);
         if (!interpreter)
-        {
-            error = "Failed to create interpreter builder";
-            return;
-        }
-
-        interpreter->SetAllowFp16PrecisionForFp32(true);
-        interpreter->SetNumThreads(4);
-
-        if (interpreter->AllocateTensors() != TfLiteStatus::kTfLiteOk)
-        {
-            error = "Failed to allocate tensors";
             return;
-        }
 
         for (unsigned int i = 0; i < interpreter->outputs().size(); i++)
         {
@@ -72,6 +63,34 @@ public:
 
     ~TFLiteModel() {}
 
+    /**
+     * @brief Another interpreter of the loaded model, with tensors of its own. The model is shared, not reloaded.
+     *
+     * @return nullptr with `error` set on failure
+     */
+    std::unique_ptr<tflite::Interpreter> newInterpreter(std::string &error)
+    {
+        std::unique_ptr<tflite::Interpreter> built;
+        tflite::ops::builtin::BuiltinOpResolver resolver;
+        tflite::InterpreterBuilder(*model, resolver)(&built);
+        if (!built)
+        {
+            error = "Failed to create interpreter builder";
+            return nullptr;
+        }
+
+        built->SetAllowFp16PrecisionForFp32(true);
+        built->SetNumThreads(4);
+
+        if (built->AllocateTensors() != TfLiteStatus::kTfLiteOk)
+        {
+            error = "Failed to allocate tensors";
+            return nullptr;
+        }
+
+        return built;
+    }
+
     template <typename T>
     void setInput(unsigned int tensorIndex, cv::Mat &img, size_t size)
     {
@@ -94,9 +113,10 @@ public:
         if (!valid)
             return false;
 
-        bool ret;
+        bool ret = false;
         try
         {
+            std::lock_guard<std::mutex> lock(invokeMutex);
             ret = interpreter->Invoke() == TfLiteStatus::kTfLiteOk;
         }
         catch (const std::exception &e)
@@ -0,0 +1,256 @@
+#ifndef _DEF_TFLITE_BATCH_
+#define _DEF_TFLITE_BATCH_
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+#include "tflite.h"
+
+/**
+ * @brief Coalesces the frames of several pipelines (cameras) into one batch-N `Invoke` of a shared model
+ *
+ * The first caller of an empty batch becomes its leader: it waits until `maxBatch` frames joined or its deadline
+ * passed, resizes the batch dimension of the input tensor, runs the batch and scatters every output tensor back to
+ * the callers. Callers block until their batch is done, so the deadline bounds the added latency. Models whose input
+ * cannot be resized run the collected frames one by one.
+ *
+ * Batches run on an interpreter of their own, built from the same loaded model: resizing its input tensor never
+ * reallocates the tensors `tfSetTenorInput`/`tfInference` use, and those stages keep their batch size.
+ */
+class TFLiteBatcher
+{
+public:
+    TFLiteBatcher(TFLiteModel *model, unsigned int tensorIndex) : tensorIndex(tensorIndex)
+    {
+        if (model->valid)
+            interpreter = model->newInterpreter(interpreterError);
+        else
+            interpreterError = "invalid model";
+
+        if (interpreter != nullptr && tensorIndex >= interpreter->inputs().size())
+        {
+            interpreterError = "no input tensor " + std::to_string(tensorIndex);
+            interpreter = nullptr;
+        }
+
+        if (interpreter != nullptr)
+        {
+            TfLiteTensor *input = inputTensor();
+            batchSize = input->dims->size > 0 ? input->dims->data[0] : 1;
+        }
+    }
+
+    /**
+     * @brief Batcher of one input tensor of `model`, shared by all pipelines
+     */
+    static TFLiteBatcher &of(TFLiteModel *model, unsigned int tensorIndex)
+    {
+        static std::mutex registryMutex;
+        static std::map<std::pair<TFLiteModel *, unsigned int>, std::unique_ptr<TFLiteBatcher>> registry;
+
+        std::lock_guard<std::mutex> lock(registryMutex);
+        std::unique_ptr<TFLiteBatcher> &batcher = registry[{model, tensorIndex}];
+        if (batcher == nullptr)
+            batcher = std::make_unique<TFLiteBatcher>(model, tensorIndex);
+
+        return *batcher;
+    }
+
+    /**
+     * @brief Run `input` as one item of a batch
+     *
+     * @param input data of one batch item, in the tensor's element type
+     * @param outputs one list per output tensor of the model, converted to float
+     * @return false on error, `error` holds the reason
+     */
+    bool infer(const cv::Mat &input, unsigned int maxBatch, unsigned int deadlineMs, std::vector<std::vector<float>> &outputs, std::string &error)
+    {
+        Request request{&input, &outputs};
+        std::unique_lock<std::mutex> lock(mutex);
+
+        bool leader = false;
+        if (open == nullptr || open->requests.size() >= open->maxBatch)
+        {
+            open = std::make_shared<Batch>();
+            open->maxBatch = maxBatch;
+            open->deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(deadlineMs);
+            leader = true;
+        }
+
+        std::shared_ptr<Batch> batch = open;
+        batch->requests.push_back(&request);
+        if (batch->requests.size() >= batch->maxBatch)
+            cond.notify_all();
+
+        if (leader)
+        {
+            cond.wait_until(lock, batch->deadline, [&]
+                            { return batch->requests.size() >= batch->maxBatch; });
+
+            // Late callers start the next batch
+            if (open == batch)
+                open = nullptr;
+
+            lock.unlock();
+            run(*batch);
+            lock.lock();
+
+            batch->done = true;
+            cond.notify_all();
+        }
+        else
+        {
+            cond.wait(lock, [&]
+                      { return batch->done; });
+        }
+
+        error = request.error;
+        return request.error.empty();
+    }
+
+private:
+    struct Request
+    {
+        const cv::Mat *input;
+        std::vector<std::vector<float>> *outputs;
+        std::string error = "";
+    };
+
+    struct Batch
+    {
+        std::vector<Request *> requests;
+        size_t maxBatch = 1;
+        std::chrono::steady_clock::time_point deadline;
+        bool done = false;
+    };
+
+    std::unique_ptr<tflite::Interpreter> interpreter;
+    std::string interpreterError = "";
+    // Batches whose deadlines overlap run one at a time
+    std::mutex invokeMutex;
+    unsigned int tensorIndex;
+    int batchSize = 1;
+    bool resizable = true;
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::shared_ptr<Batch> open = nullptr;
+
+    TfLiteTensor *inputTensor()
+    {
+        return interpreter->tensor(interpreter->inputs()[tensorIndex]);
+    }
+
+    bool resize(int n)
+    {
+        if (n == batchSize)
+            return true;
+
+        TfLiteTensor *input = inputTensor();
+        std::vector<int> dims(input->dims->data, input->dims->data + input->dims->size);
+        if (dims.empty())
+            return false;
+
+        dims[0] = n;
+        if (interpreter->ResizeInputTensor(interpreter->inputs()[tensorIndex], dims) != kTfLiteOk ||
+            interpreter->AllocateTensors() != kTfLiteOk)
+            return false;
+
+        batchSize = n;
+        return true;
+    }
+
+    void run(Batch &batch)
+    {
+        std::lock_guard<std::mutex> lock(invokeMutex);
+
+        if (interpreter == nullptr)
+        {
+            for (Request *r : batch.requests)
+                r->error = interpreterError;
+            return;
+        }
+
+        if (resizable && resize(batch.requests.size()))
+        {
+            invoke(batch.requests.data(), batch.requests.size());
+            return;
+        }
+
+        resizable = false;
+        if (!resize(1))
+        {
+            for (Request *r : batch.requests)
+                r->error = "failed to resize the input tensor";
+            return;
+        }
+
+        for (Request *&r : batch.requests)
+            invoke(&r, 1);
+    }
+
+    void invoke(Request **requests, size_t n)
+    {
+        TfLiteTensor *input = inputTensor();
+        size_t itemBytes = input->bytes / batchSize;
+        for (size_t k = 0; k < n; k++)
+        {
+            const cv::Mat &m = *requests[k]->input;
+            size_t bytes = m.total() * m.elemSize();
+            if (bytes != itemBytes || !m.isContinuous())
+            {
+                requests[k]->error = "input has " + std::to_string(bytes) + " bytes, the tensor takes " + std::to_string(itemBytes);
+                // The slot still has to be filled
+                memset((uint8_t *)input->data.raw + k * itemBytes, 0, itemBytes);
+                continue;
+            }
+
+            memcpy((uint8_t *)input->data.raw + k * itemBytes, m.data, itemBytes);
+        }
+
+        if (interpreter->Invoke() != kTfLiteOk)
+        {
+            for (size_t k = 0; k < n; k++)
+                requests[k]->error = "invoke failed";
+            return;
+        }
+
+        const std::vector<int> &outputIndices = interpreter->outputs();
+        for (size_t k = 0; k < n; k++)
+            requests[k]->outputs->resize(outputIndices.size());
+
+        for (size_t o = 0; o < outputIndices.size(); o++)
+        {
+            TfLiteTensor *t = interpreter->tensor(outputIndices[o]);
+            size_t elemSize = t->type == kTfLiteFloat32 ? sizeof(float) : (t->type == kTfLiteUInt8 ? 1 : 0);
+            if (elemSize == 0)
+            {
+                for (size_t k = 0; k < n; k++)
+                    requests[k]->error = "unsupported output tensor type " + std::to_string(t->type);
+                return;
+            }
+
+            size_t count = t->bytes / elemSize / batchSize;
+            for (size_t k = 0; k < n; k++)
+            {
+                std::vector<float> &out = (*requests[k]->outputs)[o];
+                out.resize(count);
+                if (t->type == kTfLiteFloat32)
+                    memcpy(out.data(), t->data.f + k * count, count * sizeof(float));
+                else
+                {
+                    for (size_t i = 0; i < count; i++)
+                        out[i] = t->data.uint8[k * count + i];
+                }
+            }
+        }
+    }
+};
+#endif
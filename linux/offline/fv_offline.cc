@@ -0,0 +1,340 @@
+/*
+ * Runs a pipeline recipe over recorded frames as fast as the machine allows.
+ *
+ *   fv_offline --recipe <file> --input <dir> [--output <dir>] [--stream rgb|depth|ir] [--threads <n>]
+ *              [--model <file.tflite>]... [--stats <file.json>]
+ *
+ * Frames are the images in <dir> (any format cv::imread reads, 16-bit PNG for depth), in file name order. Each worker
+ * thread runs whole frames through its own copy of the pipeline, stage state included; stage statistics are merged
+ * over all workers at the end. Results are written in frame order:
+ *   - <output>/<file name>: the image at the end of the pipeline
+ *   - <output>/frames.jsonl: one line per frame with the run time and the error, if any
+ *   - --stats: per-stage timings (same fields as `pipelineStats`) and the overall throughput
+ *
+ * `segment` stages are dropped, frames already run in parallel. Models are loaded once per worker. A `changeGate`
+ * compares the frames of its own worker, and schedules and runOnce stages count per worker; use `--threads 1` to
+ * gate and schedule like a camera does.
+ */
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <flutter_vision3d/pipeline/pipeline.h>
+#include <flutter_vision3d/pipeline/pipeline_recipe.h>
+
+namespace fs = std::filesystem;
+
+struct Options
+{
+    std::string recipe;
+    std::string input;
+    std::string output;
+    std::string stats;
+    std::vector<std::string> models;
+    unsigned int stream = PipelineRecipe::STREAM_RGB;
+    unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+};
+
+struct FrameResult
+{
+    bool ok = true;
+    std::string error = "";
+    int64_t ns = 0;
+};
+
+/**
+ * @brief Writes frame results in frame order, whatever order the workers finish in
+ */
+class OrderedWriter
+{
+public:
+    OrderedWriter(const std::string &path, const std::vector<fs::path> &frames) : frames(frames)
+    {
+        if (!path.empty())
+            out.open(path);
+    }
+
+    void put(size_t index, const FrameResult &result)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending[index] = result;
+        while (!pending.empty() && pending.begin()->first == next)
+        {
+            write(next, pending.begin()->second);
+            pending.erase(pending.begin());
+            next++;
+        }
+    }
+
+private:
+    const std::vector<fs::path> &frames;
+    std::ofstream out;
+    std::mutex mutex;
+    std::map<size_t, FrameResult> pending;
+    size_t next = 0;
+
+    void write(size_t index, const FrameResult &r)
+    {
+        if (!out.is_open())
+            return;
+
+        out << "{\"frame\": " << index << ", \"file\": \"" << frames[index].filename().string() << "\", \"ok\": " << (r.ok ? "true" : "false")
+            << ", \"ms\": " << r.ns / 1e6;
+        if (!r.ok)
+            out << ", \"error\": \"" << escape(r.error) << "\"";
+
+        out << "}\n";
+    }
+
+    static std::string escape(const std::string &s)
+    {
+        std::string e;
+        for (char c : s)
+        {
+            if (c == '"' || c == '\\')
+                e += '\\';
+            e += (unsigned char)c < 0x20 ? ' ' : c;
+        }
+
+        return e;
+    }
+};
+
+static bool parseOptions(int argc, char **argv, Options &o)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (i + 1 >= argc)
+            return false;
+
+        std::string value = argv[++i];
+        if (arg == "--recipe")
+            o.recipe = value;
+        else if (arg == "--input")
+            o.input = value;
+        else if (arg == "--output")
+            o.output = value;
+        else if (arg == "--stats")
+            o.stats = value;
+        else if (arg == "--model")
+            o.models.push_back(value);
+        else if (arg == "--threads")
+            o.threads = std::max(1, atoi(value.c_str()));
+        else if (arg == "--stream")
+        {
+            if (!PipelineRecipe::parseStreams(value, o.stream))
+                return false;
+        }
+        else
+            return false;
+    }
+
+    return !o.recipe.empty() && !o.input.empty();
+}
+
+static bool readRecipe(const std::string &path, std::vector<RecipeStage> &stages, std::string &error)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        error = "cannot open " + path;
+        return false;
+    }
+
+    std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (data.size() >= sizeof(PipelineRecipe::MAGIC) && memcmp(data.data(), PipelineRecipe::MAGIC, sizeof(PipelineRecipe::MAGIC)) == 0)
+        return PipelineRecipe::parseBinary((const uint8_t *)data.data(), data.size(), stages, error);
+
+    return PipelineRecipe::parseText(data, stages, error);
+}
+
+/**
+ * @brief Stage list of one worker. Stage state (runtime buffers, plugin instances, branch images, schedules, runOnce
+ * flags) is the worker's own, like a pipeline of another camera; statistics are merged after the run.
+ */
+static bool buildStages(const std::vector<RecipeStage> &recipe, unsigned int stream, std::vector<FuncDef> &funcs, std::string &error)
+{
+    for (const RecipeStage &stage : recipe)
+    {
+        if (stage.streams != 0 && (stage.streams & stream) == 0)
+            continue;
+
+        FuncDef f;
+        if (!Pipeline::makeStage(stage.index, stage.params, stage.interval, stage.runOnce, f, error))
+            return false;
+
+        if (f.func == PipelineFuncSegment)
+            continue;
+
+        f.gated = stage.gated;
+        funcs.push_back(f);
+    }
+
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        fprintf(stderr, "usage: %s --recipe <file> --input <dir> [--output <dir>] [--stream rgb|depth|ir] [--threads <n>] "
+                        "[--model <file.tflite>]... [--stats <file.json>]\n",
+                argv[0]);
+        return 1;
+    }
+
+    std::vector<RecipeStage> recipe;
+    std::string error;
+    if (!readRecipe(options.recipe, recipe, error))
+    {
+        fprintf(stderr, "recipe: %s\n", error.c_str());
+        return 1;
+    }
+
+    std::vector<fs::path> frames;
+    for (const fs::directory_entry &entry : fs::directory_iterator(options.input))
+    {
+        if (entry.is_regular_file())
+            frames.push_back(entry.path());
+    }
+    std::sort(frames.begin(), frames.end());
+
+    if (!options.output.empty())
+        fs::create_directories(options.output);
+
+    // Build every worker's pipeline up front so recipe errors stop the run before any frame. The stages are kept to
+    // merge their statistics.
+    std::vector<std::vector<FuncDef>> stages(options.threads);
+    std::vector<std::unique_ptr<Pipeline>> pipelines;
+    std::vector<std::vector<TFLiteModel *>> models(options.threads);
+    for (unsigned int t = 0; t < options.threads; t++)
+    {
+        std::vector<FuncDef> &funcs = stages[t];
+        if (!buildStages(recipe, options.stream, funcs, error))
+        {
+            fprintf(stderr, "recipe: %s\n", error.c_str());
+            return 1;
+        }
+
+        for (const std::string &path : options.models)
+        {
+            TFLiteModel *m = new TFLiteModel(path.c_str());
+            if (!m->valid)
+            {
+                fprintf(stderr, "%s: %s\n", path.c_str(), m->error.c_str());
+                return 1;
+            }
+
+            models[t].push_back(m);
+        }
+
+        pipelines.push_back(std::make_unique<Pipeline>());
+        if (pipelines.back()->load(funcs) != 0)
+        {
+            fprintf(stderr, "recipe: %s\n", pipelines.back()->getError().c_str());
+            return 1;
+        }
+    }
+
+    OrderedWriter writer(options.output.empty() ? "" : (fs::path(options.output) / "frames.jsonl").string(), frames);
+    StageStats frameStats;
+    std::atomic<size_t> nextFrame{0};
+    std::atomic<size_t> failed{0};
+
+    int64_t start = getMonotonicNs();
+    std::vector<std::thread> workers;
+    for (unsigned int t = 0; t < options.threads; t++)
+    {
+        workers.emplace_back([&, t]
+                             {
+            FlTextureRegistrar registrar;
+            FlMethodChannel channel;
+            FvTexture fv{};
+            fv.pipeline = pipelines[t].get();
+            fv.models = &models[t];
+            // General registers carry over between the frames of this worker only, stream registers stay empty
+            RegisterFile registers;
+            fv.registers = &registers;
+
+            size_t i;
+            while ((i = nextFrame.fetch_add(1)) < frames.size())
+            {
+                FrameResult result;
+                int64_t frameStart = getMonotonicNs();
+                fv.cvImage = cv::imread(frames[i].string(), cv::IMREAD_UNCHANGED);
+                if (fv.cvImage.empty())
+                {
+                    result.ok = false;
+                    result.error = "cannot read the image";
+                }
+                else if (pipelines[t]->run(&fv, registrar, &models[t], &channel) != 0)
+                {
+                    result.ok = false;
+                    result.error = pipelines[t]->getError();
+                }
+                else if (!options.output.empty() && !fv.cvImage.empty())
+                {
+                    cv::imwrite((fs::path(options.output) / frames[i].filename()).string(), fv.cvImage);
+                }
+
+                result.ns = getMonotonicNs() - frameStart;
+                frameStats.record(result.ns, 0, 0);
+                if (!result.ok)
+                    failed++;
+
+                writer.put(i, result);
+            } });
+    }
+
+    for (std::thread &w : workers)
+        w.join();
+
+    double seconds = (getMonotonicNs() - start) / 1e9;
+    fprintf(stderr, "%zu frames, %zu failed, %.2f s, %.1f fps, %u threads\n", frames.size(), failed.load(), seconds, frames.size() / seconds, options.threads);
+
+    if (!options.stats.empty())
+    {
+        std::vector<StageStatsSnapshot> stats;
+        for (size_t i = 0; i < stages[0].size(); i++)
+        {
+            StageStats merged;
+            for (const std::vector<FuncDef> &funcs : stages)
+                merged.merge(funcs[i].state->stats);
+
+            stats.push_back(merged.snapshot(stages[0][i].name));
+        }
+        stats.push_back(frameStats.snapshot("frame"));
+
+        std::ofstream out(options.stats);
+        out << "{\"frames\": " << frames.size() << ", \"failed\": " << failed.load() << ", \"seconds\": " << seconds
+            << ", \"fps\": " << frames.size() / seconds << ", \"threads\": " << options.threads << ", \"stages\": [";
+        for (size_t i = 0; i < stats.size(); i++)
+        {
+            const StageStatsSnapshot &s = stats[i];
+            out << (i == 0 ? "" : ",") << "\n  {\"name\": \"" << s.name << "\", \"calls\": " << s.calls << ", \"skips\": " << s.skips
+                << ", \"errors\": " << s.errors << ", \"meanUs\": " << s.meanUs << ", \"maxUs\": " << s.maxUs << ", \"p50Us\": " << s.p50Us
+                << ", \"p95Us\": " << s.p95Us << ", \"p99Us\": " << s.p99Us << "}";
+        }
+        out << "\n]}\n";
+    }
+
+    for (std::vector<TFLiteModel *> &list : models)
+    {
+        for (TFLiteModel *m : list)
+            delete m;
+    }
+
+    return failed.load() == 0 ? 0 : 2;
+}
@@ -0,0 +1,376 @@
+/*
+ * Checks the optimized kernels against the code they replace, headless (FV_HEADLESS):
+ *
+ *   - FusedKernel against its stages run one by one, on random chains of convertTo, cvNormalized, cvThreshold and
+ *     relu over 8U, 16U and 32F frames
+ *   - every PixelConvert and DepthOps vector kernel the CPU supports against the scalar kernel, at odd widths
+ *
+ * Prints one line per failing case and exits with 1 if there is any.
+ *
+ * Options:
+ *   --seed <n>     seed of the random chains (default 1)
+ *   --chains <n>   chains per frame type (default 200)
+ */
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <flutter_vision3d/pipeline/pipeline.h>
+#include <flutter_vision3d/pipeline/pipeline_recipe.h>
+#include <flutter_vision3d/pipeline/depth_ops.h>
+#include <flutter_vision3d/pipeline/pixel_convert.h>
+
+static int failures = 0;
+
+static void fail(const std::string &what)
+{
+    failures++;
+    printf("FAIL %s\n", what.c_str());
+}
+
+struct FrameKind
+{
+    const char *name;
+    int type;
+};
+
+static const FrameKind FRAME_KINDS[] = {
+    {"gray8", CV_8UC1},
+    {"rgb8", CV_8UC3},
+    {"depth16", CV_16UC1},
+    {"float32", CV_32FC1},
+};
+
+// Odd sizes, so no row is a multiple of a vector width
+static const cv::Size FRAME_SIZE(257, 41);
+
+static cv::Mat makeFrame(const FrameKind &kind)
+{
+    cv::Mat m(FRAME_SIZE, kind.type);
+    switch (CV_MAT_DEPTH(kind.type))
+    {
+    case CV_8U:
+        cv::randu(m, 0, 256);
+        break;
+    case CV_16U:
+        cv::randu(m, 0, 8000);
+        break;
+    default:
+        cv::randu(m, -100.0f, 100.0f);
+        break;
+    }
+
+    // Holes and saturated values are the edge cases of every step
+    m.row(0).setTo(0);
+    if (CV_MAT_DEPTH(kind.type) != CV_32F)
+        m.row(1).setTo(CV_MAT_DEPTH(kind.type) == CV_8U ? 255 : 65535);
+
+    return m;
+}
+
+template <typename T>
+static const T &pick(const std::vector<T> &values, std::mt19937 &rng)
+{
+    return values[std::uniform_int_distribution<size_t>(0, values.size() - 1)(rng)];
+}
+
+/**
+ * @brief Recipe line of a random fusable stage for an image of type `type`
+ */
+static std::string randomStage(int type, std::mt19937 &rng)
+{
+    // Power of two scales keep both paths exact, others exercise rounding
+    static const std::vector<std::string> scales = {"1", "0.5", "2", "0.25", "3", "0.7"};
+    static const std::vector<std::string> shifts = {"0", "1", "-3", "10", "0.5"};
+    static const std::vector<std::string> depths = {"0", "2", "5"};
+    static const std::vector<std::string> normTypes = {"32", "1", "2", "4"};
+    static const std::vector<std::string> dTypes = {"-1", "0", "2", "5"};
+    static const std::vector<std::string> thresholds = {"0", "20.5", "127", "1000", "-5"};
+    static const std::vector<std::string> maxes = {"1", "255", "4000"};
+    static const std::vector<std::string> reluThresholds = {"0", "0.25", "0.5", "1"};
+
+    // relu walks one byte per column, other types run stage by stage
+    int kinds = type == CV_8UC1 ? 4 : 3;
+    switch (std::uniform_int_distribution<int>(0, kinds - 1)(rng))
+    {
+    case 0:
+        return "convertTo " + pick(depths, rng) + " " + pick(scales, rng) + " " + pick(shifts, rng);
+    case 1:
+    {
+        std::string alpha = std::to_string(std::uniform_int_distribution<int>(0, 255)(rng));
+        std::string beta = std::to_string(std::uniform_int_distribution<int>(0, 255)(rng));
+        return "cvNormalized " + alpha + " " + beta + " " + pick(normTypes, rng) + " " + pick(dTypes, rng);
+    }
+    case 2:
+        return "cvThreshold " + pick(thresholds, rng) + " " + pick(maxes, rng) + " " +
+               std::to_string(std::uniform_int_distribution<int>(cv::THRESH_BINARY, cv::THRESH_TOZERO_INV)(rng));
+    default:
+        return "relu " + pick(reluThresholds, rng);
+    }
+}
+
+/**
+ * @brief Elements of `actual` off `expected` by more than rounding: 1 for integer images, a relative 1e-5 for float
+ */
+static int countMismatches(const cv::Mat &expected, const cv::Mat &actual)
+{
+    cv::Mat a, b;
+    expected.reshape(1).convertTo(a, CV_64F);
+    actual.reshape(1).convertTo(b, CV_64F);
+
+    int count = 0;
+    bool integer = expected.depth() < CV_32F;
+    for (int r = 0; r < a.rows; r++)
+    {
+        const double *pa = a.ptr<double>(r);
+        const double *pb = b.ptr<double>(r);
+        for (int c = 0; c < a.cols; c++)
+        {
+            double tolerance = integer ? 1.0 : 1e-5 * std::max(1.0, std::abs(pa[c]));
+            if (!(std::abs(pa[c] - pb[c]) <= tolerance))
+                count++;
+        }
+    }
+
+    return count;
+}
+
+/**
+ * @brief Random chains through FusedKernel and through their stages one by one
+ *
+ * The stages run the OpenCV calls in float where FusedKernel evaluates in double, so a value rounded the other way
+ * can land on the other side of a later threshold. A chain may differ in that many elements (1 in 10^4), no more.
+ */
+static void testFusedChains(unsigned int seed, int chains)
+{
+    std::mt19937 rng(seed);
+    cv::theRNG() = cv::RNG(seed);
+    FlTextureRegistrar registrar;
+    FlMethodChannel channel;
+    std::vector<TFLiteModel *> models;
+    int compared = 0;
+
+    for (const FrameKind &kind : FRAME_KINDS)
+    {
+        for (int n = 0; n < chains; n++)
+        {
+            cv::Mat input = makeFrame(kind);
+            std::string recipe;
+            std::vector<StageParams> params;
+
+            FvTexture fv{};
+            fv.models = &models;
+            fv.cvImage = input.clone();
+
+            int length = std::uniform_int_distribution<int>(2, 5)(rng);
+            bool ok = true;
+            for (int i = 0; i < length && ok; i++)
+            {
+                std::string line = randomStage(fv.cvImage.type(), rng);
+                std::vector<RecipeStage> stages;
+                std::string error;
+                FuncDef f;
+                if (!PipelineRecipe::parseText(line, stages, error) ||
+                    !Pipeline::makeStage(stages[0].index, stages[0].params, 0, false, f, error))
+                {
+                    fail(std::string("recipe \"") + line + "\": " + error);
+                    ok = false;
+                    break;
+                }
+
+                if (!FusedKernel::fusable(f.params))
+                {
+                    fail(std::string("not fusable: ") + line);
+                    ok = false;
+                    break;
+                }
+
+                recipe += (recipe.empty() ? "" : "; ") + line;
+                params.push_back(f.params);
+                fv.runtime = f.state->runtime.get();
+                try
+                {
+                    f.func(&fv, f.params, registrar, &models, &channel);
+                }
+                catch (const cv::Exception &)
+                {
+                    // The chain is invalid for this frame, e.g. a threshold on a depth OpenCV rejects
+                    ok = false;
+                }
+            }
+
+            if (!ok)
+                continue;
+
+            cv::Mat fused = input.clone();
+            // Two normalize steps or a depth a step does not support: the pipeline runs such chains stage by stage
+            if (!FusedKernel(params).apply(fused))
+                continue;
+
+            compared++;
+            std::string at = std::string(kind.name) + " [" + recipe + "]";
+            if (fused.type() != fv.cvImage.type() || fused.size() != fv.cvImage.size())
+            {
+                fail(at + ": type " + std::to_string(fused.type()) + ", expected " + std::to_string(fv.cvImage.type()));
+                continue;
+            }
+
+            int mismatches = countMismatches(fv.cvImage, fused);
+            if (mismatches > (int)fused.total() * fused.channels() / 10000)
+                fail(at + ": " + std::to_string(mismatches) + " elements differ");
+        }
+    }
+
+    printf("fused chains: %d compared\n", compared);
+}
+
+// 1 and the vector widths (8, 16, 32 pixels) plus or minus one, and a row of a 641 pixel wide frame
+static const int WIDTHS[] = {1, 7, 9, 15, 17, 31, 33, 63, 65, 641};
+
+// Canary bytes after the end of every row, which a kernel must not touch
+static const size_t GUARD = 64;
+
+template <typename T>
+static std::vector<T> randomRow(int n, std::mt19937 &rng, int max)
+{
+    std::vector<T> row(n);
+    std::uniform_int_distribution<int> value(0, max);
+    for (T &v : row)
+        v = value(rng);
+
+    // Holes and the extremes
+    row[0] = 0;
+    if (n > 2)
+        row[n - 1] = max;
+
+    return row;
+}
+
+template <typename T, typename Run>
+static void compareRows(const std::string &at, size_t count, Run run)
+{
+    std::vector<T> expected(count + GUARD, 0xA5), actual(count + GUARD, 0xA5);
+    run(expected.data(), actual.data());
+    for (size_t i = 0; i < count + GUARD; i++)
+    {
+        if (expected[i] != actual[i])
+        {
+            fail(at + (i < count ? ": first difference at " : ": wrote past the row at ") + std::to_string(i));
+            return;
+        }
+    }
+}
+
+static void testPixelConvert(const char *isa, const PixelConvert::Kernels &k, std::mt19937 &rng)
+{
+    for (int n : WIDTHS)
+    {
+        // Sources start one element into the buffer, so loads are not aligned either
+        std::vector<uint8_t> rgb = randomRow<uint8_t>(3 * n + 1, rng, 255);
+        std::vector<uint8_t> gray8 = randomRow<uint8_t>(n + 1, rng, 255);
+        std::vector<uint16_t> gray16 = randomRow<uint16_t>(n + 1, rng, 65535);
+        std::string at = std::string("PixelConvert ") + isa + " width " + std::to_string(n);
+
+        compareRows<uint8_t>(at + " rgb", 4 * n, [&](uint8_t *e, uint8_t *a)
+                             { PixelConvert::rgb3Plain<false>(rgb.data() + 1, e, n); k.rgb(rgb.data() + 1, a, n); });
+        compareRows<uint8_t>(at + " bgr", 4 * n, [&](uint8_t *e, uint8_t *a)
+                             { PixelConvert::rgb3Plain<true>(rgb.data() + 1, e, n); k.bgr(rgb.data() + 1, a, n); });
+        compareRows<uint8_t>(at + " gray8", 4 * n, [&](uint8_t *e, uint8_t *a)
+                             { PixelConvert::gray8Plain(gray8.data() + 1, e, n); k.gray8(gray8.data() + 1, a, n); });
+        compareRows<uint8_t>(at + " gray16", 4 * n, [&](uint8_t *e, uint8_t *a)
+                             { PixelConvert::gray16Plain(gray16.data() + 1, e, n); k.gray16(gray16.data() + 1, a, n); });
+    }
+}
+
+static void testDepthOps(const char *isa, const DepthOps::Kernels &k, std::mt19937 &rng)
+{
+    // Empty, single value, full and inverted ranges, and bounds at the extremes
+    static const uint16_t RANGES[][2] = {{0, 65535}, {1, 65535}, {500, 2000}, {1000, 1000}, {2000, 500}, {0, 0}, {65535, 65535}};
+
+    for (int n : WIDTHS)
+    {
+        std::vector<uint16_t> depth = randomRow<uint16_t>(n + 1, rng, 65535);
+        // Values near the bounds
+        for (int i = 1; i < n + 1; i += 3)
+            depth[i] = 495 + depth[i] % 11;
+
+        for (const uint16_t *range : RANGES)
+        {
+            std::string at = std::string("DepthOps ") + isa + " width " + std::to_string(n) + " range [" +
+                             std::to_string(range[0]) + ", " + std::to_string(range[1]) + "]";
+            compareRows<uint16_t>(at + " clip", n, [&](uint16_t *e, uint16_t *a)
+                                  { DepthOps::clipPlain(depth.data() + 1, e, n, range[0], range[1]);
+                                    k.clip(depth.data() + 1, a, n, range[0], range[1]); });
+
+            for (bool invert : {false, true})
+                compareRows<uint8_t>(at + (invert ? " mask inverted" : " mask"), n, [&](uint8_t *e, uint8_t *a)
+                                     { DepthOps::maskPlain(depth.data() + 1, e, n, range[0], range[1], invert);
+                                       k.mask(depth.data() + 1, a, n, range[0], range[1], invert); });
+        }
+    }
+}
+
+/**
+ * @brief Every vector kernel the CPU runs, not only the one `kernels()` picks
+ */
+static void testRowKernels(unsigned int seed)
+{
+    std::mt19937 rng(seed);
+    int tested = 0;
+
+#if defined(FV_PIXEL_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("ssse3"))
+    {
+        testPixelConvert("ssse3", {"ssse3", PixelConvert::rgb3Ssse3<false>, PixelConvert::rgb3Ssse3<true>, PixelConvert::gray8Ssse3, PixelConvert::gray16Ssse3}, rng);
+        tested++;
+    }
+
+    if (__builtin_cpu_supports("sse2"))
+    {
+        testDepthOps("sse2", {"sse2", DepthOps::clipSse2, DepthOps::maskSse2}, rng);
+        tested++;
+    }
+
+    if (__builtin_cpu_supports("avx2"))
+    {
+        testPixelConvert("avx2", {"avx2", PixelConvert::rgb3Avx2<false>, PixelConvert::rgb3Avx2<true>, PixelConvert::gray8Avx2, PixelConvert::gray16Avx2}, rng);
+        testDepthOps("avx2", {"avx2", DepthOps::clipAvx2, DepthOps::maskAvx2}, rng);
+        tested += 2;
+    }
+#elif defined(FV_PIXEL_NEON)
+    testPixelConvert("neon", {"neon", PixelConvert::rgb3Neon<false>, PixelConvert::rgb3Neon<true>, PixelConvert::gray8Neon, PixelConvert::gray16Neon}, rng);
+    testDepthOps("neon", {"neon", DepthOps::clipNeon, DepthOps::maskNeon}, rng);
+    tested += 2;
+#endif
+
+    printf("row kernels: %d kernel sets compared (selected: %s, %s)\n", tested, PixelConvert::kernels().isa, DepthOps::kernels().isa);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int seed = 1;
+    int chains = 200;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+            seed = strtoul(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--chains") == 0 && i + 1 < argc)
+            chains = atoi(argv[++i]);
+        else
+        {
+            fprintf(stderr, "usage: %s [--seed <n>] [--chains <n>]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    testFusedChains(seed, chains);
+    testRowKernels(seed);
+
+    printf("%s\n", failures == 0 ? "OK" : (std::to_string(failures) + " failures").c_str());
+    return failures == 0 ? 0 : 1;
+}